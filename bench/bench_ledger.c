@@ -0,0 +1,245 @@
+#define _POSIX_C_SOURCE 199309L
+#include "account.h"
+#include "ledger.h"
+#include "scheduler.h"
+#include "transaction.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_ACCOUNTS (16u << 20)
+#define BENCH_LOOKUPS  500000
+#define BENCH_TRANSFERS 1000000
+#define BENCH_SCANS    10
+#define BENCH_ROUNDS   5 /* each figure is the best of several rounds */
+#define BENCH_WAL      "bench_ledger.wal"
+#define BENCH_WAL_ACCOUNTS 1000
+#define BENCH_INTERACTIVE 2000
+#define BENCH_BULK_WAVE   4096
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static uint64_t xorshift(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static void bench_balance_lookups(account_store_t *s) {
+    uint64_t *ids = malloc(BENCH_LOOKUPS * sizeof(uint64_t));
+    int64_t *out = malloc(BENCH_LOOKUPS * sizeof(int64_t));
+    if (!ids || !out) exit(1);
+    uint64_t rng = 88172645463325252ull;
+    for (size_t i = 0; i < BENCH_LOOKUPS; i++) ids[i] = xorshift(&rng) % BENCH_ACCOUNTS;
+
+    double single = 1e9, batched = 1e9;
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        double t0 = now_sec();
+        int64_t sum_single = 0;
+        for (size_t i = 0; i < BENCH_LOOKUPS; i++) {
+            account_t a;
+            if (account_get(s, ids[i], &a) == LEDGER_OK) sum_single += a.balance_cents;
+        }
+        double t1 = now_sec();
+        if (account_balance_many(s, ids, BENCH_LOOKUPS, out, NULL) != LEDGER_OK) exit(1);
+        double t2 = now_sec();
+        int64_t sum_batch = 0;
+        for (size_t i = 0; i < BENCH_LOOKUPS; i++) sum_batch += out[i];
+        if (sum_single != sum_batch) exit(1);
+        if (t1 - t0 < single) single = t1 - t0;
+        if (t2 - t1 < batched) batched = t2 - t1;
+    }
+    printf("balance lookups  per-call %6.1f ns  batched %6.1f ns  (%.2fx)\n",
+           single * 1e9 / BENCH_LOOKUPS, batched * 1e9 / BENCH_LOOKUPS, single / batched);
+    free(ids);
+    free(out);
+}
+
+static void bench_transfers(account_store_t *s) {
+    transaction_t *tx = transaction_begin(s, 0);
+    if (!tx) exit(1);
+    uint64_t rng = 0x9E3779B97F4A7C15ull;
+    double best = 1e9;
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        double t0 = now_sec();
+        for (uint64_t i = 0; i < BENCH_TRANSFERS; i++) {
+            uint64_t from = xorshift(&rng) % BENCH_ACCOUNTS, to = xorshift(&rng) % BENCH_ACCOUNTS;
+            transaction_reset(tx, s, i + 2);
+            transaction_credit(tx, from, 1);
+            transaction_debit(tx, to, 1);
+            transaction_commit(tx);
+        }
+        double t = now_sec() - t0;
+        if (t < best) best = t;
+    }
+    printf("random transfers %6.1f ns/transfer\n", best * 1e9 / BENCH_TRANSFERS);
+    transaction_destroy(tx);
+}
+
+static void bench_scans(account_store_t *s) {
+    int64_t total = 0, by_type = 0;
+    double full = 1e9, typed = 1e9;
+    for (int r = 0; r < BENCH_ROUNDS * BENCH_SCANS; r++) {
+        double t0 = now_sec();
+        account_sum_balances(s, &total);
+        double t1 = now_sec();
+        account_sum_by_type(s, ACCT_SAVINGS, &by_type);
+        double t2 = now_sec();
+        if (t1 - t0 < full) full = t1 - t0;
+        if (t2 - t1 < typed) typed = t2 - t1;
+    }
+    if (total != account_total_balance(s)) exit(1);
+    printf("full scan        %6.2f ms (%.2f GB/s of balances)  by-type scan %6.2f ms\n",
+           full * 1e3, (double)BENCH_ACCOUNTS * 8 / full / 1e9, typed * 1e3);
+}
+
+static void bench_postings(account_store_t *s) {
+    account_rate_t rate = { ACCT_SAVINGS, "USD", 500000 };
+    double best = 1e9;
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        double t0 = now_sec();
+        int64_t total;
+        if (account_sum_postings(s, &rate, 1, 0, &total) != LEDGER_OK) exit(1);
+        if (account_apply_postings(s, &rate, 1, 0, (uint64_t)r + 3, total) != LEDGER_OK) exit(1);
+        double t = now_sec() - t0;
+        if (t < best) best = t;
+    }
+    printf("periodic posting %6.2f ms (%.2f ns/account, sum + apply)\n", best * 1e3, best * 1e9 / BENCH_ACCOUNTS);
+}
+
+/* Reopen time as the log grows; recovery restores the last checkpoint and
+ * replays what follows, so it should grow far slower than the log. */
+static void bench_recovery(void) {
+    static const uint64_t sizes[] = { 1000, 10000, 100000 };
+    remove(BENCH_WAL);
+    ledger_t *l = ledger_open(BENCH_WAL);
+    if (!l) exit(1);
+    for (uint64_t i = 1; i <= BENCH_WAL_ACCOUNTS; i++) {
+        uint64_t id;
+        if (ledger_create_account(l, ACCT_CHECKING, "USD", &id) != LEDGER_OK) exit(1);
+        if (ledger_deposit(l, id, 1000000) != LEDGER_OK) exit(1);
+    }
+    uint64_t rng = 88172645463325252ull, done = 0;
+    for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+        for (; done < sizes[k]; done++) {
+            uint64_t from = 1 + xorshift(&rng) % BENCH_WAL_ACCOUNTS, to = 1 + xorshift(&rng) % BENCH_WAL_ACCOUNTS;
+            if (from != to) ledger_transfer(l, from, to, 1);
+        }
+        ledger_close(l);
+        FILE *fp = fopen(BENCH_WAL, "rb");
+        if (!fp || fseek(fp, 0, SEEK_END) != 0) exit(1);
+        double mb = (double)ftell(fp) / (1 << 20);
+        fclose(fp);
+        double best = 1e9;
+        for (int r = 0; r < BENCH_ROUNDS; r++) {
+            double t0 = now_sec();
+            l = ledger_open(BENCH_WAL);
+            double t = now_sec() - t0;
+            if (!l) exit(1);
+            if (t < best) best = t;
+            if (r + 1 < BENCH_ROUNDS) ledger_close(l);
+        }
+        printf("recovery %7llu tx %7.2f MB log  %7.2f ms (%.0f MB/s)\n", (unsigned long long)sizes[k], mb,
+               best * 1e3, mb / best);
+    }
+    ledger_close(l);
+    remove(BENCH_WAL);
+}
+
+struct bulk_feeder {
+    scheduler_t *sched;
+    volatile bool stop;
+    uint64_t done;
+};
+
+/* Keeps the bulk lane saturated with waves of transfers. */
+static void *bulk_feed(void *arg) {
+    struct bulk_feeder *f = (struct bulk_feeder *)arg;
+    static sched_request_t wave[BENCH_BULK_WAVE];
+    uint64_t rng = 0x9E3779B97F4A7C15ull;
+    while (!f->stop) {
+        size_t n = 0;
+        for (; n < BENCH_BULK_WAVE; n++) {
+            uint64_t from = 1 + xorshift(&rng) % BENCH_WAL_ACCOUNTS;
+            wave[n] = (sched_request_t){ .op = SCHED_TRANSFER, .from_id = from,
+                                         .to_id = from % BENCH_WAL_ACCOUNTS + 1, .amount_cents = 1 };
+            if (scheduler_submit(f->sched, SCHED_BULK, &wave[n]) != LEDGER_OK) break;
+        }
+        for (size_t i = 0; i < n; i++) scheduler_wait(f->sched, &wave[i]);
+        f->done += n;
+    }
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Interactive transfer latency (submit to completion) while bulk transfers
+ * flood the scheduler, with interactive work on its own lane and, for
+ * comparison, queued behind the bulk work in the same lane. */
+static void bench_scheduler(void) {
+    static uint64_t lat[BENCH_INTERACTIVE];
+    for (int mode = 0; mode < 2; mode++) {
+        sched_lane_t lane = mode == 0 ? SCHED_INTERACTIVE : SCHED_BULK;
+        remove(BENCH_WAL);
+        ledger_t *l = ledger_open(BENCH_WAL);
+        if (!l) exit(1);
+        for (uint64_t i = 1; i <= BENCH_WAL_ACCOUNTS; i++) {
+            uint64_t id;
+            if (ledger_create_account(l, ACCT_CHECKING, "USD", &id) != LEDGER_OK) exit(1);
+            if (ledger_deposit(l, id, 1000000) != LEDGER_OK) exit(1);
+        }
+        scheduler_t *sched = scheduler_create(l, NULL);
+        if (!sched) exit(1);
+        struct bulk_feeder feeder = { sched, false, 0 };
+        pthread_t th;
+        if (pthread_create(&th, NULL, bulk_feed, &feeder) != 0) exit(1);
+        double t0 = now_sec();
+        for (int i = 0; i < BENCH_INTERACTIVE; i++) {
+            sched_request_t req = { .op = SCHED_TRANSFER, .from_id = 1 + (uint64_t)i % BENCH_WAL_ACCOUNTS,
+                                    .to_id = 1 + (uint64_t)(i + 7) % BENCH_WAL_ACCOUNTS, .amount_cents = 1 };
+            uint64_t start = scheduler_now_ns();
+            while (scheduler_submit(sched, lane, &req) == LEDGER_ERR_BUSY) {}
+            scheduler_wait(sched, &req);
+            lat[i] = scheduler_now_ns() - start;
+        }
+        double elapsed = now_sec() - t0;
+        feeder.stop = true;
+        pthread_join(th, NULL);
+        scheduler_destroy(sched);
+        ledger_close(l);
+        qsort(lat, BENCH_INTERACTIVE, sizeof(lat[0]), cmp_u64);
+        printf("scheduler %-17s interactive p50 %7.1f us  p99 %7.1f us  bulk %7.0f tx/s\n",
+               mode == 0 ? "(own lane)" : "(behind bulk)", lat[BENCH_INTERACTIVE / 2] / 1e3,
+               lat[BENCH_INTERACTIVE * 99 / 100] / 1e3, feeder.done / elapsed);
+    }
+    remove(BENCH_WAL);
+}
+
+int main(void) {
+    account_store_t *s = account_store_create();
+    if (!s) return 1;
+    for (uint64_t i = 0; i < BENCH_ACCOUNTS; i++) {
+        uint64_t id;
+        if (account_create(s, (account_type_t)(i % 3), "USD", &id) != LEDGER_OK) return 1;
+        account_apply_delta(s, id, (int64_t)(i & 1023), 1);
+    }
+    printf("%u accounts\n", BENCH_ACCOUNTS);
+    bench_balance_lookups(s);
+    bench_transfers(s);
+    bench_scans(s);
+    bench_postings(s);
+    account_store_destroy(s);
+    bench_recovery();
+    bench_scheduler();
+    return 0;
+}
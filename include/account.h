@@ -2,6 +2,7 @@
 #define ACCOUNT_H
 
 #include "common.h"
+#include "index.h"
 
 typedef enum {
     ACCT_CHECKING,
@@ -10,23 +11,180 @@ typedef enum {
 } account_type_t;
 
 typedef struct {
-    uint32_t id;
+    uint64_t id;
     account_type_t type;
     int64_t balance_cents;
     char currency[CURRENCY_LEN];
     uint64_t version;
 } account_t;
 
+/* Snapshot layout: next_tx_id(8) count(8), then per account
+ * id(8) type(1) pad(3) currency(4) balance(8) version(8). */
+#define ACCOUNT_SNAPSHOT_HEADER_SIZE 16
+#define ACCOUNT_SNAPSHOT_ENTRY_SIZE  32
+
+/* Periodic posting rate for one (type, currency) pair, in parts per million
+ * of the balance per period. Negative rates charge fees. */
+typedef struct {
+    account_type_t type;
+    char currency[CURRENCY_LEN];
+    int32_t rate_ppm;
+} account_rate_t;
+
+#define ACCOUNT_MAX_RATES 32
+#define ACCOUNT_RATE_PPM_MAX 1000000
+
 typedef struct account_store account_store_t;
 
+#define ACCOUNT_MAX_STRIPED 16
+
+/* Ids are 64-bit in the API, WAL and snapshots, but the store assigns them
+ * densely from 0 and addresses them below MAX_ACCOUNTS (2^40). An explicit id
+ * (replay, restore) must fall below MAX_ACCOUNTS and less than one segment
+ * (ACCOUNT_MAX_ID_GAP) past the next auto-assigned id; anything else is
+ * LEDGER_ERR_INVALID, so one stray id cannot grow the segment directory or
+ * push later ids far away. */
+#define ACCOUNT_MAX_ID_GAP (1ull << 16)
+
+/* Query iterator over the secondary indexes. Results reflect the store at
+ * the time of each step; do not modify the store while iterating. Steps may
+ * fault pages of a tiered store in. */
+typedef struct {
+    account_store_t *store;
+    index_cursor_t cursor;
+    bool by_balance;
+    bool descending;
+    bool pending;
+    uint64_t pending_id;
+    int64_t pending_balance;
+    /* Striped accounts are not in balance order; they are merged in. */
+    struct account_iter_striped {
+        uint64_t id;
+        int64_t balance;
+    } striped[ACCOUNT_MAX_STRIPED];
+    uint32_t n_striped;
+    uint32_t next_striped;
+} account_iter_t;
+
+typedef struct {
+    uint64_t resident_pages;
+    uint64_t max_resident_pages;
+    uint64_t faults;
+    uint64_t evictions;
+    uint64_t writebacks;
+} account_tier_stats_t;
+
 account_store_t *account_store_create(void);
 void account_store_destroy(account_store_t *s);
-ledger_err_t account_create(account_store_t *s, account_type_t type, const char *currency, uint32_t *out_id);
-ledger_err_t account_create_with_id(account_store_t *s, uint32_t id, account_type_t type, const char *currency);
-ledger_err_t account_get(account_store_t *s, uint32_t id, account_t *out);
-ledger_err_t account_apply_delta(account_store_t *s, uint32_t id, int64_t delta_cents, uint64_t version);
-ledger_err_t account_set_balance(account_store_t *s, uint32_t id, int64_t balance_cents, uint64_t version);
-uint32_t account_count(const account_store_t *s);
-ledger_err_t account_serialize(const account_store_t *s, uint32_t next_tx_id, void *buf, size_t cap, size_t *out_len);
+/* Removes every account; configuration such as tiering is kept. */
+void account_store_clear(account_store_t *s);
+/* Bounds the resident part of an empty store. Accounts are paged in groups
+ * of 4096 ids; at most max_resident_accounts worth of pages stay in memory
+ * and the rest live in page_path (created if missing), faulted back in
+ * transparently on access. Existing contents are only trusted through
+ * account_page_restore(). */
+ledger_err_t account_store_enable_tiering(account_store_t *s, const char *page_path, uint64_t max_resident_accounts);
+/* Writes dirty resident pages to the page file so later evictions are free. */
+ledger_err_t account_store_sync(account_store_t *s);
+/* account_store_sync() a slice at a time: visits up to `pages` resident pages
+ * from *cursor, writing back the dirty ones, and advances the cursor; *done
+ * is set once it has passed every resident page. */
+ledger_err_t account_store_sync_some(account_store_t *s, uint64_t *cursor, uint64_t pages, bool *done);
+/* Page checkpoint of a tiered store: instead of every account, it records
+ * which page-file slot holds each page, plus the folded striped balances.
+ * Layout: next_tx_id(8) count(8) next_id(8) total(8) pages(8) striped(8),
+ * one byte per page (1: on disk, 2: second slot), then per striped account
+ * id(8) balance(8) version(8). */
+#define ACCOUNT_PAGE_CHECKPOINT_HEADER_SIZE  48
+#define ACCOUNT_PAGE_CHECKPOINT_STRIPED_SIZE 24
+size_t account_page_checkpoint_size(const account_store_t *s);
+/* Writes back and syncs every dirty page, then describes the page file in
+ * buf. The previous checkpoint's pages are kept until
+ * account_page_checkpoint_commit(), which the caller may only call once the
+ * description is on disk (wal_checkpoint_external() syncs it); after it,
+ * write-backs never overwrite the new checkpoint's pages. */
+ledger_err_t account_page_checkpoint(account_store_t *s, uint64_t next_tx_id, void *buf, size_t cap, size_t *out_len);
+void account_page_checkpoint_commit(account_store_t *s);
+/* Replaces the contents of a tiered store with a page checkpoint over the
+ * same page file. Column data is read back lazily, as pages fault in. */
+ledger_err_t account_page_restore(account_store_t *s, const void *buf, size_t len, uint64_t *next_tx_id);
+/* Asks the OS to start reading the evicted pages holding ids, so a batch
+ * job's upcoming faults hit the page cache. Does not block on I/O. */
+ledger_err_t account_prefetch(const account_store_t *s, const uint64_t *ids, size_t n);
+void account_tier_stats(const account_store_t *s, account_tier_stats_t *out);
+ledger_err_t account_create(account_store_t *s, account_type_t type, const char *currency, uint64_t *out_id);
+ledger_err_t account_create_with_id(account_store_t *s, uint64_t id, account_type_t type, const char *currency);
+ledger_err_t account_get(account_store_t *s, uint64_t id, account_t *out);
+/* Batched balance reads. errs (optional) receives a per-id status; the
+ * return value is LEDGER_OK or the first per-id error. Like account_get(),
+ * it faults evicted pages in, so it needs a mutable store. */
+ledger_err_t account_balance_many(account_store_t *s, const uint64_t *ids, size_t n,
+                                  int64_t *out, ledger_err_t *errs);
+ledger_err_t account_apply_delta(account_store_t *s, uint64_t id, int64_t delta_cents, uint64_t version);
+/* Like account_apply_delta(), also returning the version it replaced so a
+ * failed transaction can roll back with account_revert_delta(), which
+ * reverses the delta and restores that version instead of stamping one. */
+ledger_err_t account_apply_delta_prev(account_store_t *s, uint64_t id, int64_t delta_cents, uint64_t version,
+                                      uint64_t *prev_version);
+ledger_err_t account_revert_delta(account_store_t *s, uint64_t id, int64_t delta_cents, uint64_t prev_version);
+ledger_err_t account_set_balance(account_store_t *s, uint64_t id, int64_t balance_cents, uint64_t version);
+uint64_t account_count(const account_store_t *s);
+/* Spreads a hot account's balance over cache-line-padded per-thread stripes.
+ * Deltas to a striped account may be applied concurrently from several
+ * threads; reads and snapshots fold the stripes. Accounts that may not go
+ * negative draw on sibling stripes before a debit is rejected. Enabling or
+ * disabling striping requires the store to be quiescent. */
+ledger_err_t account_set_striped(account_store_t *s, uint64_t id, bool striped);
+/* Running net of all balances, maintained on every balance change. */
+int64_t account_total_balance(const account_store_t *s);
+/* Full column scans (SIMD where available) for audits and reporting. */
+ledger_err_t account_sum_balances(const account_store_t *s, int64_t *out);
+ledger_err_t account_sum_by_type(const account_store_t *s, account_type_t type, int64_t *out);
+ledger_err_t account_sum_by_currency(const account_store_t *s, const char *currency, int64_t *out);
+/* Periodic posting. Every account matching a rate entry, other than the
+ * contra account and accounts that may go negative, receives
+ * balance * rate_ppm / 10^6 cents truncated toward zero; the contra account
+ * absorbs the opposite of the total. account_sum_postings() computes the
+ * total without changing any balance (a tiered store still faults pages in)
+ * and returns LEDGER_ERR_CONSTRAINT if the contra account could not absorb
+ * it. account_apply_postings() must be given that total for the same store
+ * state; it posts every account with `version` in one parallel column pass. */
+ledger_err_t account_sum_postings(account_store_t *s, const account_rate_t *rates, size_t n_rates,
+                                  uint64_t contra_id, int64_t *out_total);
+ledger_err_t account_apply_postings(account_store_t *s, const account_rate_t *rates, size_t n_rates,
+                                    uint64_t contra_id, uint64_t version, int64_t total);
+/* The same over the accounts of one slice of ids, [slice, slice + 1) times
+ * ACCOUNT_POSTING_SLICE, so a long run can be split into short ones. The
+ * contra account and accounts that may go negative stay excluded whichever
+ * slice holds them. account_posting_slices() counts the slices up to the
+ * highest id in use. */
+#define ACCOUNT_POSTING_SLICE (1ull << 16)
+uint64_t account_posting_slices(const account_store_t *s);
+ledger_err_t account_sum_postings_slice(account_store_t *s, const account_rate_t *rates, size_t n_rates,
+                                        uint64_t contra_id, uint64_t slice, int64_t *out_total);
+ledger_err_t account_apply_postings_slice(account_store_t *s, const account_rate_t *rates, size_t n_rates,
+                                          uint64_t contra_id, uint64_t slice, uint64_t version, int64_t total);
+/* Builds the requested indexes (INDEX_ATTRS, INDEX_BALANCE) from the current
+ * contents; from then on every change keeps them up to date. */
+ledger_err_t account_store_enable_index(account_store_t *s, unsigned kinds);
+/* Accounts of a type and/or currency (type < 0 or currency NULL match any),
+ * in id order. Needs INDEX_ATTRS. */
+ledger_err_t account_iter_attrs(account_store_t *s, account_iter_t *it, int type, const char *currency);
+/* Accounts with min <= balance <= max in (balance, id) order, ascending or
+ * descending. Needs INDEX_BALANCE. */
+ledger_err_t account_iter_balances(account_store_t *s, account_iter_t *it, int64_t min, int64_t max,
+                                   bool descending);
+bool account_iter_next(account_iter_t *it, uint64_t *id, int64_t *balance);
+ledger_err_t account_serialize(const account_store_t *s, uint64_t next_tx_id, void *buf, size_t cap, size_t *out_len);
+/* account_serialize() of an untiered store without holding up writers.
+ * account_snapshot_begin() fixes the snapshot at the current state and
+ * returns its length; each account_snapshot_step() serializes about one more
+ * segment of ids into buf and reports how many leading bytes are final. A
+ * change to a segment not yet serialized serializes it first, so buf ends up
+ * holding the state at begin. buf must stay valid until
+ * account_snapshot_end(). */
+ledger_err_t account_snapshot_begin(account_store_t *s, uint64_t next_tx_id, void *buf, size_t cap, size_t *out_len);
+ledger_err_t account_snapshot_step(account_store_t *s, size_t *ready);
+void account_snapshot_end(account_store_t *s);
 
 #endif
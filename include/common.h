@@ -12,12 +12,15 @@
 #define LEDGER_ERR_NOTFOUND -4
 #define LEDGER_ERR_DEADLOCK -5
 #define LEDGER_ERR_CONSTRAINT -6
+#define LEDGER_ERR_BUSY     -7
+#define LEDGER_ERR_TIMEOUT  -8
 
-#define MAX_ACCOUNTS         (1u << 20)
+#define MAX_ACCOUNTS         (1ull << 40)
 #define MAX_TX_ENTRIES       4096
 #define WAL_PATH_MAX         256
 #define CURRENCY_LEN         4
 #define WAL_MAGIC             0xAC1D0001u
+#define WAL_VERSION           2u
 
 typedef int ledger_err_t;
 
@@ -0,0 +1,49 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include "common.h"
+
+/* Secondary indexes over the account store, maintained by the store on every
+ * change: bitmaps per (type, currency) class and a skip list ordered by
+ * (balance, id). Queries walk only set bits or list nodes in range. */
+
+typedef struct account_index account_index_t;
+
+#define INDEX_ATTRS   1u
+#define INDEX_BALANCE 2u
+#define INDEX_MAX_CLASSES 256
+
+/* Iteration state; treat as opaque. */
+typedef struct {
+    const account_index_t *ix;
+    int kind;
+    uint64_t classes[INDEX_MAX_CLASSES / 64];
+    uint64_t seg;
+    int32_t sum_idx;
+    uint64_t sum_bits;
+    uint32_t word;
+    uint64_t bits;
+    const void *node;
+    int64_t min;
+    int64_t max;
+    bool descending;
+} index_cursor_t;
+
+account_index_t *account_index_create(unsigned kinds);
+void account_index_destroy(account_index_t *ix);
+void account_index_clear(account_index_t *ix);
+unsigned account_index_kinds(const account_index_t *ix);
+ledger_err_t account_index_add(account_index_t *ix, uint64_t id, uint8_t type, uint32_t currency, int64_t balance);
+/* Moves an account to its new place in balance order (re-entering it if it
+ * was detached). Does not allocate. */
+void account_index_set_balance(account_index_t *ix, uint64_t id, int64_t balance);
+/* Takes an account out of balance order, e.g. while it is striped. */
+void account_index_detach(account_index_t *ix, uint64_t id);
+
+/* type < 0 or !match_currency act as wildcards. */
+void index_cursor_attrs(index_cursor_t *c, const account_index_t *ix, int type, bool match_currency, uint32_t currency);
+void index_cursor_balances(index_cursor_t *c, const account_index_t *ix, int64_t min, int64_t max, bool descending);
+/* balance is only filled by balance cursors. */
+bool index_cursor_next(index_cursor_t *c, uint64_t *id, int64_t *balance);
+
+#endif
@@ -6,14 +6,108 @@
 
 typedef struct ledger ledger_t;
 
+/* Logged operations (transfers, refused ones included, account creations
+ * and bulk postings) between checkpoints. A transfer is at most four
+ * records, so recovery replays at most 4 * LEDGER_CHECKPOINT_INTERVAL
+ * records after the checkpoint it restores, plus, for a sliced checkpoint,
+ * those logged while it was being taken. */
+#define LEDGER_CHECKPOINT_INTERVAL 100
+
+typedef struct {
+    uint64_t from_id;
+    uint64_t to_id;
+    int64_t amount_cents;
+} ledger_transfer_t;
+
 ledger_t *ledger_open(const char *wal_path);
+/* Like ledger_open(), but keeps at most about max_resident_accounts accounts
+ * in memory; the rest are paged to page_path (see account_store_enable_tiering). */
+ledger_t *ledger_open_tiered(const char *wal_path, const char *page_path, uint64_t max_resident_accounts);
+/* Read replica: tails a primary's WAL file and serves read-only queries.
+ * Mutating calls on a follower return LEDGER_ERR_INVALID. */
+ledger_t *ledger_open_follower(const char *wal_path);
+ledger_err_t ledger_follower_poll(ledger_t *l, uint64_t *applied_lsn);
+/* Bytes of primary log not yet applied by this follower. */
+ledger_err_t ledger_replication_lag(ledger_t *l, uint64_t *lag_lsn);
+/* Failover: applies the remaining log and makes the follower writable. */
+ledger_err_t ledger_promote(ledger_t *l);
 void ledger_close(ledger_t *l);
-ledger_err_t ledger_create_account(ledger_t *l, account_type_t type, const char *currency, uint32_t *out_id);
-ledger_err_t ledger_deposit(ledger_t *l, uint32_t account_id, int64_t amount_cents);
-ledger_err_t ledger_withdraw(ledger_t *l, uint32_t account_id, int64_t amount_cents);
-ledger_err_t ledger_transfer(ledger_t *l, uint32_t from_id, uint32_t to_id, int64_t amount_cents);
-ledger_err_t ledger_balance(ledger_t *l, uint32_t account_id, int64_t *balance_cents);
-ledger_err_t ledger_history(ledger_t *l, uint32_t account_id, int64_t *out_credits, int64_t *out_debits, size_t *count);
+ledger_err_t ledger_create_account(ledger_t *l, account_type_t type, const char *currency, uint64_t *out_id);
+ledger_err_t ledger_deposit(ledger_t *l, uint64_t account_id, int64_t amount_cents);
+ledger_err_t ledger_withdraw(ledger_t *l, uint64_t account_id, int64_t amount_cents);
+ledger_err_t ledger_transfer(ledger_t *l, uint64_t from_id, uint64_t to_id, int64_t amount_cents);
+/* Group commit: each transfer is its own transaction with its own result
+ * (account 0 is the cash account, so deposits and withdrawals fit too), but
+ * the WAL is flushed once for the whole batch, with any checkpoint that
+ * falls due deferred until after it. No result is LEDGER_OK until
+ * that flush succeeds. If it fails, every applied transfer is reversed in
+ * memory, each reports LEDGER_ERR_IO and the ledger turns read-only; part of
+ * the batch may still be in the log, so reopen it to learn what committed. */
+ledger_err_t ledger_transfer_batch(ledger_t *l, const ledger_transfer_t *xfers, size_t n, ledger_err_t *results);
+ledger_err_t ledger_balance(ledger_t *l, uint64_t account_id, int64_t *balance_cents);
+/* Reads n balances in one call, prefetching ahead to hide memory latency.
+ * Missing accounts yield 0 and LEDGER_ERR_NOTFOUND in errs (if non-NULL). */
+ledger_err_t ledger_balance_many(ledger_t *l, const uint64_t *ids, size_t n, int64_t *out, ledger_err_t *errs);
+/* Periodic interest or fees: every account whose type and currency match a
+ * rate entry is posted balance * rate_ppm / 10^6 (see account_sum_postings)
+ * against contra_id, the designated income/expense account, which must be
+ * able to absorb the total unless it is the cash account. The run is one
+ * transaction and one WAL frame, written only after the total is checked;
+ * replay re-derives the postings. If the frame or the apply fails, the
+ * ledger turns read-only until reopened. */
+ledger_err_t ledger_post_periodic(ledger_t *l, const account_rate_t *rates, size_t n_rates, uint64_t contra_id,
+                                  int64_t *out_total_cents);
+/* The same for the accounts of one slice of ids (see
+ * account_sum_postings_slice), as its own transaction and frame, so a
+ * caller can run slices 0 .. ledger_posting_slices() - 1 with other work in
+ * between. Each slice is checked against the contra account on its own;
+ * one that is refused leaves the slices before it posted. */
+ledger_err_t ledger_post_periodic_slice(ledger_t *l, const account_rate_t *rates, size_t n_rates, uint64_t contra_id,
+                                        uint64_t slice, int64_t *out_total_cents);
+uint64_t ledger_posting_slices(ledger_t *l);
+/* Sliced checkpoints, for callers that must not stall on one (the scheduler
+ * turns them on). A due checkpoint no longer runs inline; the caller runs
+ * ledger_checkpoint_step() between requests until *more comes back false.
+ * Each step logs about one segment of the snapshot (see
+ * account_snapshot_begin); changes in between copy what they touch first,
+ * so the checkpoint holds the state at its first step and recovery replays
+ * the log from there. A tiered ledger writes back its dirty pages a few per
+ * step instead, and its last step logs the page checkpoint, syncing both
+ * files. If a step's log write fails the ledger turns read-only. Turning
+ * the mode off drops a checkpoint under way. */
+void ledger_set_sliced_checkpoints(ledger_t *l, bool on);
+ledger_err_t ledger_checkpoint_step(ledger_t *l, bool *more);
+/* Bulk posting frames that recovery skipped because the postings re-derived
+ * from them no longer reproduced the logged total. */
+uint64_t ledger_skipped_postings(ledger_t *l);
+/* Records the last recovery replayed after the checkpoint it restored. */
+uint64_t ledger_replayed_records(ledger_t *l);
+/* Hint for batch jobs on a tiered ledger: starts reading the pages of the
+ * given accounts in the background. A no-op when the ledger is not tiered. */
+ledger_err_t ledger_prefetch(ledger_t *l, const uint64_t *ids, size_t n);
+ledger_err_t ledger_tier_stats(ledger_t *l, account_tier_stats_t *out);
+/* Secondary indexes (INDEX_ATTRS, INDEX_BALANCE), kept current on every
+ * commit and rebuilt in memory on reopen; see account_store_enable_index. */
+ledger_err_t ledger_enable_indexes(ledger_t *l, unsigned kinds);
+ledger_err_t ledger_query_attrs(ledger_t *l, account_iter_t *it, int type, const char *currency);
+ledger_err_t ledger_query_balances(ledger_t *l, account_iter_t *it, int64_t min_cents, int64_t max_cents,
+                                   bool descending);
+/* An account's committed turnover as the log records it: cents credited
+ * (in), cents debited (out) and the number of legs. Reads the log up to what
+ * this ledger has applied, so a follower answers from its own position.
+ * Bulk postings are logged as a total only, so they count against their
+ * contra account but not against the accounts they posted. */
+ledger_err_t ledger_history(ledger_t *l, uint64_t account_id, int64_t *out_credits, int64_t *out_debits, size_t *count);
 uint64_t ledger_next_tx_id(ledger_t *l);
+/* Designates an account as hot so its balance is striped across threads.
+ * The cash account is striped by default. Not persisted across reopen. */
+ledger_err_t ledger_set_hot_account(ledger_t *l, uint64_t account_id, bool striped);
+ledger_err_t ledger_sum_by_currency(ledger_t *l, const char *currency, int64_t *out_cents);
+ledger_err_t ledger_sum_by_type(ledger_t *l, account_type_t type, int64_t *out_cents);
+/* Double-entry check: all balances, including the cash account, must net to
+ * zero. Uses the running total unless full_audit is set, in which case the
+ * balance columns are rescanned and must also agree with the running total.
+ * Returns LEDGER_ERR_CONSTRAINT when the books do not balance. */
+ledger_err_t ledger_trial_balance(ledger_t *l, bool full_audit, int64_t *out_net_cents);
 
 #endif
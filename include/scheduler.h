@@ -0,0 +1,103 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "common.h"
+#include "ledger.h"
+
+/* Admission control in front of a ledger: clients queue requests on priority
+ * lanes and one dispatcher thread, the only caller of the ledger, serves
+ * them. Each request is due by its deadline or by its lane's wait budget,
+ * whichever comes first, and the lane whose head is due soonest goes next.
+ * Runs of transfers (or balance reads) from that lane are coalesced into one
+ * group commit (or one batched read). Long jobs never hold the dispatcher
+ * for their whole length: a periodic posting runs one slice of accounts at a
+ * time and the ledger's checkpoints one step at a time, each between
+ * dispatches, so a request arriving meanwhile waits for at most one slice
+ * and one step. */
+
+typedef enum {
+    SCHED_INTERACTIVE,
+    SCHED_STANDARD,
+    SCHED_BULK,
+    SCHED_LANES
+} sched_lane_t;
+
+typedef enum {
+    SCHED_TRANSFER,      /* from_id -> to_id; account 0 is the cash account */
+    SCHED_BALANCE,       /* account_id; result in balance_cents */
+    /* rates, n_rates, contra_id; total in balance_cents. Each slice is its
+     * own transaction (ledger_post_periodic_slice); the first refused one
+     * ends the run with its error, and balance_cents holds what was posted. */
+    SCHED_POST_PERIODIC
+} sched_op_t;
+
+/* Owned by the caller and must stay valid until scheduler_wait() returns. */
+typedef struct {
+    sched_op_t op;
+    uint64_t from_id;
+    uint64_t to_id;
+    int64_t amount_cents;
+    uint64_t account_id;
+    const account_rate_t *rates;
+    size_t n_rates;
+    uint64_t contra_id;
+    /* Absolute scheduler_now_ns() time; 0 for none. A request still queued
+     * at its deadline is not run and completes with LEDGER_ERR_TIMEOUT. */
+    uint64_t deadline_ns;
+    /* Set on completion. */
+    ledger_err_t result;
+    int64_t balance_cents;
+    uint64_t batch; /* the dispatch (group commit) that served it, from 1 */
+    /* Scheduler state. */
+    uint64_t enqueued_ns;
+    uint64_t due_ns;
+    bool done;
+} sched_request_t;
+
+typedef struct {
+    uint32_t capacity[SCHED_LANES];  /* queued requests per lane */
+    uint32_t max_batch[SCHED_LANES]; /* requests per dispatch */
+    uint64_t budget_ns[SCHED_LANES]; /* target wait for requests without a deadline */
+} scheduler_config_t;
+
+#define SCHED_WAIT_BUCKETS 32
+
+typedef struct {
+    uint32_t depth;
+    uint32_t max_depth;
+    uint32_t capacity;
+    uint64_t submitted;
+    uint64_t rejected; /* turned away with LEDGER_ERR_BUSY */
+    uint64_t expired;  /* deadline passed while queued */
+    uint64_t completed;
+    uint64_t batches;
+    uint64_t wait_total_ns;
+    uint64_t wait_max_ns;
+    /* Queue wait histogram: bucket b counts waits under 2^b microseconds
+     * (the last bucket takes everything longer). */
+    uint64_t wait_hist[SCHED_WAIT_BUCKETS];
+} sched_lane_stats_t;
+
+typedef struct scheduler scheduler_t;
+
+void scheduler_default_config(scheduler_config_t *cfg);
+/* Starts the dispatcher and turns on the ledger's sliced checkpoints. The
+ * ledger must not be used directly until scheduler_destroy(), which serves
+ * everything still queued and finishes any checkpoint under way. cfg may be
+ * NULL for the defaults. */
+scheduler_t *scheduler_create(ledger_t *l, const scheduler_config_t *cfg);
+void scheduler_destroy(scheduler_t *s);
+/* Queues a request without blocking. Backpressure: LEDGER_ERR_BUSY when the
+ * lane is full, and the caller may retry, shed or degrade. */
+ledger_err_t scheduler_submit(scheduler_t *s, sched_lane_t lane, sched_request_t *req);
+/* Blocks until req completes and returns its result. */
+ledger_err_t scheduler_wait(scheduler_t *s, sched_request_t *req);
+/* Holds dispatching, e.g. around maintenance; submissions keep queueing. */
+void scheduler_pause(scheduler_t *s);
+void scheduler_resume(scheduler_t *s);
+ledger_err_t scheduler_lane_stats(scheduler_t *s, sched_lane_t lane, sched_lane_stats_t *out);
+/* Upper bound of the histogram bucket holding quantile q (e.g. 0.99). */
+uint64_t sched_wait_quantile_ns(const sched_lane_stats_t *st, double q);
+uint64_t scheduler_now_ns(void);
+
+#endif
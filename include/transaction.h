@@ -5,20 +5,27 @@
 #include "account.h"
 
 typedef struct journal_entry {
-    uint32_t account_id;
+    uint64_t account_id;
     int64_t amount_cents;
     bool is_debit;
+    uint64_t prev_version; /* set by commit so a failed commit can restore it */
 } journal_entry_t;
 
 typedef struct transaction transaction_t;
 
 transaction_t *transaction_begin(account_store_t *store, uint64_t tx_id);
-ledger_err_t transaction_debit(transaction_t *tx, uint32_t account_id, int64_t amount_cents);
-ledger_err_t transaction_credit(transaction_t *tx, uint32_t account_id, int64_t amount_cents);
+/* Re-arms a transaction for a new tx id, keeping its entry storage so a
+ * reused transaction performs no allocation in steady state. */
+ledger_err_t transaction_reset(transaction_t *tx, account_store_t *store, uint64_t tx_id);
+ledger_err_t transaction_debit(transaction_t *tx, uint64_t account_id, int64_t amount_cents);
+ledger_err_t transaction_credit(transaction_t *tx, uint64_t account_id, int64_t amount_cents);
 ledger_err_t transaction_commit(transaction_t *tx);
 void transaction_abort(transaction_t *tx);
 void transaction_destroy(transaction_t *tx);
 bool transaction_is_committed(const transaction_t *tx);
+/* The journal, with prev_version filled in once committed, for callers that
+ * must reverse a commit whose log record could not be written. */
+const journal_entry_t *transaction_entries(const transaction_t *tx, size_t *count);
 bool transaction_is_aborted(const transaction_t *tx);
 
 #endif
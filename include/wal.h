@@ -11,23 +11,91 @@ typedef enum {
     WAL_COMMIT,
     WAL_ABORT,
     WAL_CHECKPOINT,
-    WAL_CREATE_ACCOUNT
+    WAL_CREATE_ACCOUNT,
+    WAL_BULK_POSTING
 } wal_op_t;
 
 typedef struct wal wal_t;
 
-typedef int (*wal_replay_cb_t)(wal_op_t op, uint64_t tx_id, uint32_t account_id, int64_t amount,
-                               account_type_t acct_type, const char *currency, void *ctx);
-typedef int (*wal_checkpoint_restore_cb_t)(const void *snapshot, size_t len, void *ctx);
+/* A decoded log record. payload is set for frames that carry a body
+ * (checkpoint snapshots, bulk postings); during replay it is only valid for
+ * the duration of the callback. lsn is the record's byte offset. */
+typedef struct {
+    wal_op_t op;
+    uint64_t tx_id;
+    uint64_t account_id;
+    int64_t amount;
+    account_type_t acct_type;
+    const char *currency;
+    const void *payload;
+    size_t payload_len;
+    uint64_t lsn;
+} wal_entry_t;
+
+typedef int (*wal_replay_cb_t)(const wal_entry_t *e, void *ctx);
+/* external: the checkpoint was written by wal_checkpoint_external(). */
+typedef int (*wal_checkpoint_restore_cb_t)(const void *snapshot, size_t len, bool external, void *ctx);
 
 wal_t *wal_open(const char *path);
+/* Opens a WAL read-only for a follower that tails a primary's log. */
+wal_t *wal_open_follower(const char *path);
 void wal_close(wal_t *w);
-ledger_err_t wal_append(wal_t *w, wal_op_t op, uint64_t tx_id, uint32_t account_id, int64_t amount,
+ledger_err_t wal_append(wal_t *w, wal_op_t op, uint64_t tx_id, uint64_t account_id, int64_t amount,
                         account_type_t acct_type, const char *currency);
 ledger_err_t wal_begin_tx(wal_t *w, uint64_t tx_id);
 ledger_err_t wal_commit(wal_t *w, uint64_t tx_id);
 ledger_err_t wal_abort(wal_t *w, uint64_t tx_id);
 ledger_err_t wal_checkpoint(wal_t *w, const void *snapshot, size_t len);
+/* A checkpoint whose body refers to state kept outside the log, such as a
+ * tiered store's page file. Replay restores from one only after
+ * wal_use_external_checkpoints(); otherwise it skips them and recovers from
+ * an earlier ordinary checkpoint. The log is synced to disk before it
+ * returns, so the state it names may be released once it succeeds. */
+ledger_err_t wal_checkpoint_external(wal_t *w, const void *body, size_t len);
+void wal_use_external_checkpoints(wal_t *w);
+/* Sliced checkpoint: the snapshot is logged as parts, in order and with
+ * other records between them, then an end frame naming the log position the
+ * snapshot describes and its length. Recovery from the end frame joins the
+ * parts logged since that position and replays from there; replay skips
+ * parts, and a checkpoint with no end frame is never restored. */
+ledger_err_t wal_checkpoint_part(wal_t *w, const void *body, size_t len);
+ledger_err_t wal_checkpoint_end(wal_t *w, uint64_t begin_lsn, uint64_t len);
+/* Group commit: between these calls records are buffered rather than
+ * flushed one by one; wal_group_end() flushes them together. */
+void wal_group_begin(wal_t *w);
+ledger_err_t wal_group_end(wal_t *w);
+/* One self-committing frame for a whole posting run: the contra account, the
+ * posted total and an opaque body (the rate table) from which replay
+ * re-derives every posting. */
+ledger_err_t wal_bulk_posting(wal_t *w, uint64_t tx_id, uint64_t contra_id, int64_t total,
+                              const void *body, size_t len);
 ledger_err_t wal_replay(wal_t *w, wal_replay_cb_t cb, wal_checkpoint_restore_cb_t checkpoint_cb, void *ctx);
+/* Follower: applies records appended since the last call, stopping before a
+ * record that is not yet fully written. LSNs are byte offsets in the log. */
+ledger_err_t wal_tail(wal_t *w, wal_replay_cb_t cb, wal_checkpoint_restore_cb_t checkpoint_cb, void *ctx);
+/* Read-only pass over the log up to what has been applied: a follower's
+ * read position, or the end of a writer's log. Nothing is applied; for
+ * queries over the history only the log keeps. */
+ledger_err_t wal_scan(wal_t *w, wal_replay_cb_t cb, void *ctx);
+uint64_t wal_read_lsn(const wal_t *w);
+uint64_t wal_end_lsn(const wal_t *w);
+/* Turns a follower into a writer, truncating any torn tail first. */
+ledger_err_t wal_promote(wal_t *w);
+
+/* Read-only cursor over a WAL image held in memory, e.g. an mmap'd file,
+ * for offline tools. Entries point into the image. */
+typedef struct {
+    const uint8_t *base;
+    size_t len;
+    size_t pos; /* end of the last decoded record */
+} wal_iter_t;
+
+/* Checks the file header. An empty image is a valid, empty log. */
+ledger_err_t wal_iter_init(wal_iter_t *it, const void *image, size_t len);
+/* Decodes the next record, checkpoints included (their snapshot is the
+ * payload). Returns LEDGER_ERR_NOTFOUND at the end of the log or before a
+ * torn tail, classified as replay does (a record cut short, or a damaged one
+ * with no whole record after it), and LEDGER_ERR_IO on damage mid-log. */
+ledger_err_t wal_iter_next(wal_iter_t *it, wal_entry_t *e);
 
 #endif
@@ -1,160 +1,1666 @@
+#define _POSIX_C_SOURCE 200112L
+#define _DEFAULT_SOURCE
 #include "account.h"
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
-struct account_slot {
-    bool in_use;
-    account_t account;
+/* Accounts live in fixed-size segments addressed directly by id. Growing the
+ * store only allocates new segments; existing slots never move. */
+#define SEGMENT_SHIFT 16
+#define SEGMENT_SLOTS (1u << SEGMENT_SHIFT)
+#define SEGMENT_MASK  (SEGMENT_SLOTS - 1)
+#define INITIAL_DIR_CAPACITY 16
+#define BITMAP_WORDS (SEGMENT_SLOTS / 64)
+/* The version column starts one page past a power-of-two offset from the
+ * balance column so balances[i] and versions[i] do not share a cache set,
+ * while every column stays page aligned for tiering. */
+#define COLUMN_STAGGER 4096
+#define HOT_BYTES  ((size_t)SEGMENT_SLOTS * (sizeof(int64_t) + sizeof(uint64_t)) + COLUMN_STAGGER + \
+                    2 * BITMAP_WORDS * sizeof(uint64_t))
+#define COLD_BYTES ((size_t)SEGMENT_SLOTS * (sizeof(uint32_t) + sizeof(uint8_t)))
+#define HUGE_PAGE  ((size_t)2 << 20)
+
+/* With a page file attached, segments are paged in units of TIER_PAGE_SLOTS
+ * accounts. A page's slice of each column is page aligned, so eviction
+ * writes the slices to the page file at a fixed offset derived from the id
+ * and drops them with MADV_DONTNEED; the bitmaps always stay resident. A
+ * CLOCK hand over the resident pages chooses victims. */
+#define TIER_PAGE_SHIFT 12
+#define TIER_PAGE_SLOTS (1u << TIER_PAGE_SHIFT)
+#define TIER_PAGES_PER_SEGMENT (SEGMENT_SLOTS / TIER_PAGE_SLOTS)
+#define TIER_PAGE_BYTES ((size_t)TIER_PAGE_SLOTS * (sizeof(int64_t) + sizeof(uint64_t) + \
+                                                   sizeof(uint32_t) + sizeof(uint8_t)))
+#define MIN_RESIDENT_PAGES 2
+/* Each page has two slots in the file, each holding the column slices and
+ * then the page's occupancy bits, padded to a whole file page. While a
+ * checkpoint refers to one slot, write-backs go to the other. */
+#define TIER_OCCUPANCY_BYTES (TIER_PAGE_SLOTS / 8)
+#define TIER_SLOT_BYTES (TIER_PAGE_BYTES + 4096)
+
+/* PAGE_SLOT: the latest image is in the second slot. PAGE_CKPT: the last
+ * page checkpoint refers to an image of this page, in the second slot if
+ * PAGE_CKPT_SLOT is set. */
+enum {
+    PAGE_RESIDENT = 1,
+    PAGE_REFERENCED = 2,
+    PAGE_DIRTY = 4,
+    PAGE_ON_DISK = 8,
+    PAGE_SLOT = 16,
+    PAGE_CKPT = 32,
+    PAGE_CKPT_SLOT = 64,
+};
+
+/* Hot accounts spread their balance over per-thread stripes, each on its own
+ * cache line, so concurrent updates do not bounce a shared line. */
+#define STRIPE_COUNT       16
+#define MAX_STRIPED        ACCOUNT_MAX_STRIPED
+#define CACHE_LINE         64
+
+struct balance_stripe {
+    int64_t balance_cents;
+    uint64_t version;
+    uint8_t pad[CACHE_LINE - 16];
+};
+
+struct striped_account {
+    uint64_t id;
+    uint32_t currency;
+    uint8_t type;
+    struct balance_stripe *stripes;
+};
+
+/* Segments are struct-of-arrays. The hot mapping holds what transfers touch
+ * (balance, version) plus the occupancy and striping bitmaps; type and
+ * currency live in a separate cold mapping. Every column starts on a cache
+ * line, and with LEDGER_HUGEPAGES the hot mapping is backed by 2 MiB pages.
+ * Unused slots hold a zero balance, which lets the reductions run over whole
+ * columns without consulting occupancy. */
+struct account_segment {
+    int64_t *balances;
+    uint64_t *versions;
+    uint64_t *occupied;
+    uint64_t *striped;
+    uint32_t *currencies;
+    uint8_t *types;
+    uint32_t striped_count; /* lets most segments skip the striping bitmap */
+    uint32_t count;         /* occupied slots */
+    uint8_t page_state[TIER_PAGES_PER_SEGMENT];
+    void *hot;
+    size_t hot_len;
+    void *cold;
+};
+
+/* One page's slice of every column, either resident or a scratch copy. */
+struct page_cols {
+    int64_t *balances;
+    uint64_t *versions;
+    uint32_t *currencies;
+    uint8_t *types;
+};
+
+struct page_tier {
+    int fd;
+    uint64_t *clock; /* global page numbers of the resident pages */
+    uint64_t resident;
+    uint64_t hand;
+    account_tier_stats_t stats;
+    struct page_cols scratch;
+    void *scratch_mem;
+};
+
+/* An account_snapshot_begin() in progress. Segment seg's entries go to
+ * buf + offset[seg]; striped accounts are folded at begin, since stripes
+ * change without touching their segment. */
+struct snapshot {
+    bool active;
+    uint8_t *buf;
+    size_t len;
+    uint64_t segs;   /* segments it covers */
+    uint64_t next;   /* segments below are serialized */
+    uint64_t cap;    /* entries allocated in offset and done */
+    size_t *offset;  /* segs + 1 entries; offset[segs] == len */
+    uint8_t *done;
+    uint32_t n_striped;
+    struct {
+        uint64_t id;
+        int64_t balance;
+        uint64_t version;
+    } striped[MAX_STRIPED];
 };
 
 struct account_store {
-    struct account_slot *slots;
-    uint32_t capacity;
-    uint32_t next_id;
-    uint32_t count;
+    struct account_segment **segments;
+    uint64_t dir_capacity;
+    uint64_t next_id;
+    uint64_t count;
+    int64_t total_cents;
+    struct striped_account striped[MAX_STRIPED];
+    uint32_t striped_count;
+    struct page_tier *tier; /* NULL: the whole store is resident */
+    account_index_t *index; /* NULL: no secondary indexes */
+    struct snapshot snap;
+    struct post_pool *pool; /* NULL until a posting pass first runs on several threads */
 };
 
+static void post_pool_destroy(struct post_pool *p);
+
+static uint32_t next_stripe_hint;
+static __thread uint32_t thread_stripe = UINT32_MAX;
+
+static uint32_t my_stripe(void) {
+    if (thread_stripe == UINT32_MAX)
+        thread_stripe = __atomic_fetch_add(&next_stripe_hint, 1, __ATOMIC_RELAXED) % STRIPE_COUNT;
+    return thread_stripe;
+}
+
+static bool may_go_negative(uint64_t id) {
+    return id == 0;
+}
+
+static uint32_t currency_code(const char *currency) {
+    char buf[CURRENCY_LEN] = {0};
+    if (currency) strncpy(buf, currency, CURRENCY_LEN - 1);
+    uint32_t code;
+    memcpy(&code, buf, CURRENCY_LEN);
+    return code;
+}
+
 account_store_t *account_store_create(void) {
     account_store_t *s = calloc(1, sizeof(account_store_t));
     if (!s) return NULL;
-    s->capacity = 4096;
-    s->slots = calloc((size_t)s->capacity, sizeof(struct account_slot));
-    if (!s->slots) {
+    s->dir_capacity = INITIAL_DIR_CAPACITY;
+    s->segments = calloc((size_t)s->dir_capacity, sizeof(struct account_segment *));
+    if (!s->segments) {
         free(s);
         return NULL;
     }
     return s;
 }
 
+static void segment_free(struct account_segment *sg) {
+    if (!sg) return;
+    if (sg->hot) munmap(sg->hot, sg->hot_len);
+    if (sg->cold) munmap(sg->cold, COLD_BYTES);
+    free(sg);
+}
+
+static void release_contents(account_store_t *s, bool truncate_pages) {
+    for (uint32_t k = 0; k < s->striped_count; k++) free(s->striped[k].stripes);
+    for (uint64_t i = 0; i < s->dir_capacity; i++) {
+        segment_free(s->segments[i]);
+        s->segments[i] = NULL;
+    }
+    s->striped_count = 0;
+    s->snap.active = false;
+    s->next_id = 0;
+    s->count = 0;
+    s->total_cents = 0;
+    account_index_clear(s->index);
+    if (s->tier) {
+        s->tier->resident = 0;
+        s->tier->hand = 0;
+        s->tier->stats.resident_pages = 0;
+        /* Page states went with their segments, so stale file contents are
+         * never read back; truncating only returns the space. */
+        if (truncate_pages && ftruncate(s->tier->fd, 0) != 0) return;
+    }
+}
+
 void account_store_destroy(account_store_t *s) {
     if (!s) return;
-    free(s->slots);
+    /* The page file outlives the store; a page checkpoint may refer to it. */
+    release_contents(s, false);
+    post_pool_destroy(s->pool);
+    account_index_destroy(s->index);
+    free(s->snap.offset);
+    free(s->snap.done);
+    if (s->tier) {
+        close(s->tier->fd);
+        free(s->tier->clock);
+        free(s->tier->scratch_mem);
+        free(s->tier);
+    }
+    free(s->segments);
     free(s);
 }
 
-static ledger_err_t grow(account_store_t *s) {
-    if (s->capacity >= MAX_ACCOUNTS) return LEDGER_ERR_NOMEM;
-    uint32_t new_cap = s->capacity * 2;
-    if (new_cap > MAX_ACCOUNTS) new_cap = MAX_ACCOUNTS;
-    struct account_slot *n = realloc(s->slots, (size_t)new_cap * sizeof(struct account_slot));
+void account_store_clear(account_store_t *s) {
+    if (s) release_contents(s, true);
+}
+
+/* Anonymous mappings come back zeroed and page aligned. For huge pages the
+ * mapping is over-allocated and trimmed to a 2 MiB boundary. */
+static void *column_map(size_t *len, bool huge) {
+#if defined(LEDGER_HUGEPAGES) && defined(MADV_HUGEPAGE)
+    if (huge) {
+        size_t want = (*len + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+        uint8_t *raw = mmap(NULL, want + HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED) return NULL;
+        uint8_t *aligned = (uint8_t *)(((uintptr_t)raw + HUGE_PAGE - 1) & ~(uintptr_t)(HUGE_PAGE - 1));
+        if (aligned > raw) munmap(raw, (size_t)(aligned - raw));
+        if (raw + HUGE_PAGE > aligned) munmap(aligned + want, (size_t)(raw + HUGE_PAGE - aligned));
+        madvise(aligned, want, MADV_HUGEPAGE);
+        *len = want;
+        return aligned;
+    }
+#else
+    (void)huge;
+#endif
+    void *p = mmap(NULL, *len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+static struct account_segment *segment_create(void) {
+    struct account_segment *sg = calloc(1, sizeof(struct account_segment));
+    if (!sg) return NULL;
+    sg->hot_len = HOT_BYTES;
+    sg->hot = column_map(&sg->hot_len, true);
+    size_t cold_len = COLD_BYTES;
+    sg->cold = column_map(&cold_len, false);
+    if (!sg->hot || !sg->cold) {
+        segment_free(sg);
+        return NULL;
+    }
+    sg->balances = sg->hot;
+    sg->versions = (uint64_t *)((uint8_t *)(sg->balances + SEGMENT_SLOTS) + COLUMN_STAGGER);
+    sg->occupied = sg->versions + SEGMENT_SLOTS;
+    sg->striped = sg->occupied + BITMAP_WORDS;
+    sg->currencies = sg->cold;
+    sg->types = (uint8_t *)(sg->currencies + SEGMENT_SLOTS);
+    return sg;
+}
+
+static bool bit_test(const uint64_t *bits, uint32_t i) {
+    return (bits[i >> 6] >> (i & 63)) & 1;
+}
+
+static void bit_assign(uint64_t *bits, uint32_t i, bool on) {
+    if (on)
+        bits[i >> 6] |= 1ull << (i & 63);
+    else
+        bits[i >> 6] &= ~(1ull << (i & 63));
+}
+
+/* Only the segment directory is resized; it holds one pointer per
+ * SEGMENT_SLOTS accounts, so doubling it is cheap even at 10^8 accounts. */
+static ledger_err_t grow_directory(account_store_t *s, uint64_t seg) {
+    uint64_t new_cap = s->dir_capacity;
+    while (new_cap <= seg) new_cap *= 2;
+    struct account_segment **n = realloc(s->segments, (size_t)new_cap * sizeof(struct account_segment *));
     if (!n) return LEDGER_ERR_NOMEM;
-    memset(n + s->capacity, 0, (size_t)(new_cap - s->capacity) * sizeof(struct account_slot));
-    s->slots = n;
-    s->capacity = new_cap;
+    memset(n + s->dir_capacity, 0, (size_t)(new_cap - s->dir_capacity) * sizeof(struct account_segment *));
+    s->segments = n;
+    s->dir_capacity = new_cap;
+    return LEDGER_OK;
+}
+
+static struct account_segment *segment_alloc(account_store_t *s, uint64_t id) {
+    uint64_t seg = id >> SEGMENT_SHIFT;
+    if (seg >= s->dir_capacity && grow_directory(s, seg) != LEDGER_OK) return NULL;
+    if (!s->segments[seg]) s->segments[seg] = segment_create();
+    return s->segments[seg];
+}
+
+static struct account_segment *segment_lookup(const account_store_t *s, uint64_t id) {
+    uint64_t seg = id >> SEGMENT_SHIFT;
+    if (seg >= s->dir_capacity) return NULL;
+    struct account_segment *sg = s->segments[seg];
+    if (!sg || !bit_test(sg->occupied, (uint32_t)(id & SEGMENT_MASK))) return NULL;
+    return sg;
+}
+
+ledger_err_t account_store_enable_tiering(account_store_t *s, const char *page_path, uint64_t max_resident_accounts) {
+    if (!s || !page_path || s->tier || s->count > 0) return LEDGER_ERR_INVALID;
+    uint64_t pages = (max_resident_accounts + TIER_PAGE_SLOTS - 1) / TIER_PAGE_SLOTS;
+    if (pages < MIN_RESIDENT_PAGES) pages = MIN_RESIDENT_PAGES;
+    struct page_tier *t = calloc(1, sizeof(struct page_tier));
+    if (!t) return LEDGER_ERR_NOMEM;
+    t->clock = calloc((size_t)pages, sizeof(uint64_t));
+    t->scratch_mem = malloc(TIER_PAGE_BYTES);
+    if (!t->clock || !t->scratch_mem) {
+        free(t->clock);
+        free(t->scratch_mem);
+        free(t);
+        return LEDGER_ERR_NOMEM;
+    }
+    t->fd = open(page_path, O_RDWR | O_CREAT, 0600);
+    if (t->fd < 0) {
+        free(t->clock);
+        free(t->scratch_mem);
+        free(t);
+        return LEDGER_ERR_IO;
+    }
+    t->stats.max_resident_pages = pages;
+    t->scratch.balances = t->scratch_mem;
+    t->scratch.versions = (uint64_t *)(t->scratch.balances + TIER_PAGE_SLOTS);
+    t->scratch.currencies = (uint32_t *)(t->scratch.versions + TIER_PAGE_SLOTS);
+    t->scratch.types = (uint8_t *)(t->scratch.currencies + TIER_PAGE_SLOTS);
+    s->tier = t;
+    return LEDGER_OK;
+}
+
+static void page_slices(const struct account_segment *sg, uint32_t first, struct page_cols *c) {
+    c->balances = sg->balances + first;
+    c->versions = sg->versions + first;
+    c->currencies = sg->currencies + first;
+    c->types = sg->types + first;
+}
+
+/* File offset of the slot holding the page's latest image. */
+static off_t page_offset(uint64_t gpage, uint8_t st) {
+    return (off_t)((2 * gpage + ((st & PAGE_SLOT) ? 1 : 0)) * TIER_SLOT_BYTES);
+}
+
+/* A slot holds the page's slices back to back, then its occupancy bits,
+ * which are written with the page but only read back by a restore. */
+static ledger_err_t page_io(int fd, const struct page_cols *c, const uint64_t *occupied, off_t off, bool write) {
+    struct iovec iov[5] = {
+        { c->balances, TIER_PAGE_SLOTS * sizeof(int64_t) },
+        { c->versions, TIER_PAGE_SLOTS * sizeof(uint64_t) },
+        { c->currencies, TIER_PAGE_SLOTS * sizeof(uint32_t) },
+        { c->types, TIER_PAGE_SLOTS * sizeof(uint8_t) },
+        { (void *)occupied, TIER_OCCUPANCY_BYTES },
+    };
+    int cnt = write ? 5 : 4;
+    size_t want = TIER_PAGE_BYTES + (write ? TIER_OCCUPANCY_BYTES : 0);
+    ssize_t n = write ? pwritev(fd, iov, cnt, off) : preadv(fd, iov, cnt, off);
+    return n == (ssize_t)want ? LEDGER_OK : LEDGER_ERR_IO;
+}
+
+static struct account_segment *page_segment(const account_store_t *s, uint64_t gpage, uint32_t *first) {
+    *first = (uint32_t)(gpage % TIER_PAGES_PER_SEGMENT) * TIER_PAGE_SLOTS;
+    return s->segments[gpage / TIER_PAGES_PER_SEGMENT];
+}
+
+static ledger_err_t page_write_back(account_store_t *s, uint64_t gpage) {
+    uint32_t first;
+    struct account_segment *sg = page_segment(s, gpage, &first);
+    uint8_t *st = &sg->page_state[first >> TIER_PAGE_SHIFT];
+    if (!(*st & PAGE_DIRTY)) return LEDGER_OK;
+    /* Never overwrite the image the last page checkpoint refers to. */
+    uint8_t target = *st;
+    if (*st & PAGE_CKPT) target = (uint8_t)((*st & ~PAGE_SLOT) | ((*st & PAGE_CKPT_SLOT) ? 0 : PAGE_SLOT));
+    struct page_cols c;
+    page_slices(sg, first, &c);
+    ledger_err_t err = page_io(s->tier->fd, &c, sg->occupied + first / 64, page_offset(gpage, target), true);
+    if (err != LEDGER_OK) return err;
+    *st = (uint8_t)((target & ~PAGE_DIRTY) | PAGE_ON_DISK);
+    s->tier->stats.writebacks++;
+    return LEDGER_OK;
+}
+
+static ledger_err_t page_evict(account_store_t *s, uint64_t gpage) {
+    ledger_err_t err = page_write_back(s, gpage);
+    if (err != LEDGER_OK) return err;
+    uint32_t first;
+    struct account_segment *sg = page_segment(s, gpage, &first);
+    struct page_cols c;
+    page_slices(sg, first, &c);
+    madvise(c.balances, TIER_PAGE_SLOTS * sizeof(int64_t), MADV_DONTNEED);
+    madvise(c.versions, TIER_PAGE_SLOTS * sizeof(uint64_t), MADV_DONTNEED);
+    madvise(c.currencies, TIER_PAGE_SLOTS * sizeof(uint32_t), MADV_DONTNEED);
+    madvise(c.types, TIER_PAGE_SLOTS * sizeof(uint8_t), MADV_DONTNEED);
+    sg->page_state[first >> TIER_PAGE_SHIFT] &= (uint8_t)~(PAGE_RESIDENT | PAGE_REFERENCED);
+    s->tier->stats.evictions++;
+    return LEDGER_OK;
+}
+
+/* Makes a page resident, evicting with CLOCK when the resident set is full:
+ * referenced pages get a second chance, the first unreferenced one goes. A
+ * page that was never written back is all zeros and needs no read. */
+static ledger_err_t page_fault(account_store_t *s, struct account_segment *sg, uint64_t gpage) {
+    struct page_tier *t = s->tier;
+    uint32_t first = (uint32_t)(gpage % TIER_PAGES_PER_SEGMENT) * TIER_PAGE_SLOTS;
+    uint8_t *st = &sg->page_state[first >> TIER_PAGE_SHIFT];
+    uint64_t slot;
+    if (t->resident < t->stats.max_resident_pages) {
+        slot = t->resident++;
+    } else {
+        for (;;) {
+            uint32_t vfirst;
+            struct account_segment *vsg = page_segment(s, t->clock[t->hand], &vfirst);
+            uint8_t *vst = &vsg->page_state[vfirst >> TIER_PAGE_SHIFT];
+            if (*vst & PAGE_REFERENCED) {
+                *vst &= (uint8_t)~PAGE_REFERENCED;
+                t->hand = (t->hand + 1) % t->resident;
+                continue;
+            }
+            ledger_err_t err = page_evict(s, t->clock[t->hand]);
+            if (err != LEDGER_OK) return err;
+            slot = t->hand;
+            t->hand = (t->hand + 1) % t->resident;
+            break;
+        }
+    }
+    if (*st & PAGE_ON_DISK) {
+        struct page_cols c;
+        page_slices(sg, first, &c);
+        ledger_err_t err = page_io(t->fd, &c, NULL, page_offset(gpage, *st), false);
+        if (err != LEDGER_OK) {
+            /* Give the freed slot to the last resident page. */
+            t->clock[slot] = t->clock[--t->resident];
+            if (t->hand >= t->resident) t->hand = 0;
+            return err;
+        }
+    }
+    t->clock[slot] = gpage;
+    *st |= PAGE_RESIDENT;
+    t->stats.faults++;
+    t->stats.resident_pages = t->resident;
+    return LEDGER_OK;
+}
+
+/* Every access to an account's column slots goes through here first. */
+static ledger_err_t page_touch(account_store_t *s, struct account_segment *sg, uint64_t id, bool dirty) {
+    if (!s->tier) return LEDGER_OK;
+    uint8_t *st = &sg->page_state[(id & SEGMENT_MASK) >> TIER_PAGE_SHIFT];
+    if (!(*st & PAGE_RESIDENT)) {
+        ledger_err_t err = page_fault(s, sg, id >> TIER_PAGE_SHIFT);
+        if (err != LEDGER_OK) return err;
+    }
+    *st |= (uint8_t)(PAGE_REFERENCED | (dirty ? PAGE_DIRTY : 0));
     return LEDGER_OK;
 }
 
-ledger_err_t account_create_with_id(account_store_t *s, uint32_t id, account_type_t type, const char *currency) {
+/* Columns for a scan over `span` slots from `first`. Evicted pages are read
+ * into scratch instead of faulted in, so a scan does not flush the resident
+ * set. Returns LEDGER_ERR_NOTFOUND for a page that was never written. */
+static ledger_err_t page_view(const account_store_t *s, const struct account_segment *sg, uint64_t seg,
+                              uint32_t first, struct page_cols *c) {
+    uint8_t st = s->tier ? sg->page_state[first >> TIER_PAGE_SHIFT] : PAGE_RESIDENT;
+    if (st & PAGE_RESIDENT) {
+        page_slices(sg, first, c);
+        return LEDGER_OK;
+    }
+    if (!(st & PAGE_ON_DISK)) return LEDGER_ERR_NOTFOUND;
+    *c = s->tier->scratch;
+    return page_io(s->tier->fd, c, NULL, page_offset(seg * TIER_PAGES_PER_SEGMENT + (first >> TIER_PAGE_SHIFT), st),
+                   false);
+}
+
+ledger_err_t account_store_sync(account_store_t *s) {
     if (!s) return LEDGER_ERR_INVALID;
-    if (s->count >= s->capacity && grow(s) != LEDGER_OK) return LEDGER_ERR_NOMEM;
-    uint32_t idx = id % s->capacity;
-    while (s->slots[idx].in_use) {
-        idx = (idx + 1) % s->capacity;
-        if (idx == (id % s->capacity)) return LEDGER_ERR_NOMEM;
-    }
-    s->slots[idx].in_use = true;
-    s->slots[idx].account.id = id;
-    s->slots[idx].account.type = type;
-    s->slots[idx].account.balance_cents = 0;
-    s->slots[idx].account.version = 0;
-    memset(s->slots[idx].account.currency, 0, CURRENCY_LEN);
-    if (currency)
-        strncpy(s->slots[idx].account.currency, currency, CURRENCY_LEN - 1);
+    if (!s->tier) return LEDGER_OK;
+    for (uint64_t k = 0; k < s->tier->resident; k++) {
+        ledger_err_t err = page_write_back(s, s->tier->clock[k]);
+        if (err != LEDGER_OK) return err;
+    }
+    return LEDGER_OK;
+}
+
+ledger_err_t account_store_sync_some(account_store_t *s, uint64_t *cursor, uint64_t pages, bool *done) {
+    if (!s || !cursor || !done) return LEDGER_ERR_INVALID;
+    uint64_t resident = s->tier ? s->tier->resident : 0;
+    for (; *cursor < resident && pages > 0; (*cursor)++, pages--) {
+        ledger_err_t err = page_write_back(s, s->tier->clock[*cursor]);
+        if (err != LEDGER_OK) return err;
+    }
+    *done = *cursor >= resident;
+    return LEDGER_OK;
+}
+
+ledger_err_t account_prefetch(const account_store_t *s, const uint64_t *ids, size_t n) {
+    if (!s || (n > 0 && !ids)) return LEDGER_ERR_INVALID;
+    if (!s->tier) return LEDGER_OK;
+    uint64_t last = UINT64_MAX;
+    for (size_t j = 0; j < n; j++) {
+        uint64_t gpage = ids[j] >> TIER_PAGE_SHIFT, seg = ids[j] >> SEGMENT_SHIFT;
+        if (gpage == last || seg >= s->dir_capacity || !s->segments[seg]) continue;
+        last = gpage;
+        uint8_t st = s->segments[seg]->page_state[gpage % TIER_PAGES_PER_SEGMENT];
+        if ((st & PAGE_ON_DISK) && !(st & PAGE_RESIDENT))
+            posix_fadvise(s->tier->fd, page_offset(gpage, st), (off_t)TIER_PAGE_BYTES, POSIX_FADV_WILLNEED);
+    }
+    return LEDGER_OK;
+}
+
+void account_tier_stats(const account_store_t *s, account_tier_stats_t *out) {
+    if (!out) return;
+    memset(out, 0, sizeof(*out));
+    if (s && s->tier) *out = s->tier->stats;
+}
+
+/* Only consulted when the segment's striping bit is set. */
+static struct striped_account *striped_find(const account_store_t *s, uint64_t id) {
+    for (uint32_t k = 0; k < s->striped_count; k++)
+        if (s->striped[k].id == id) return (struct striped_account *)&s->striped[k];
+    return NULL;
+}
+
+/* Reads fold the stripes lazily; the result is exact once writers are
+ * quiescent (checkpoints, audits) and a consistent-enough view otherwise. */
+static void striped_fold(const struct striped_account *h, int64_t *balance, uint64_t *version) {
+    int64_t sum = 0;
+    uint64_t v = 0;
+    for (uint32_t k = 0; k < STRIPE_COUNT; k++) {
+        sum += __atomic_load_n(&h->stripes[k].balance_cents, __ATOMIC_RELAXED);
+        uint64_t sv = __atomic_load_n(&h->stripes[k].version, __ATOMIC_RELAXED);
+        if (sv > v) v = sv;
+    }
+    *balance = sum;
+    *version = v;
+}
+
+/* Moves up to `want` cents from sibling stripes into `mine`. No stripe ever
+ * goes negative, so the folded balance cannot either. */
+static int64_t stripe_reserve(struct striped_account *h, struct balance_stripe *mine, int64_t want) {
+    int64_t got = 0;
+    for (uint32_t k = 0; k < STRIPE_COUNT && got < want; k++) {
+        struct balance_stripe *other = &h->stripes[k];
+        if (other == mine) continue;
+        int64_t cur = __atomic_load_n(&other->balance_cents, __ATOMIC_RELAXED);
+        while (cur > 0) {
+            int64_t take = cur < want - got ? cur : want - got;
+            if (__atomic_compare_exchange_n(&other->balance_cents, &cur, cur - take, false,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+                __atomic_fetch_add(&mine->balance_cents, take, __ATOMIC_ACQ_REL);
+                got += take;
+                break;
+            }
+        }
+    }
+    return got;
+}
+
+static ledger_err_t striped_apply(struct striped_account *h, int64_t delta_cents, uint64_t version,
+                                  bool allow_negative, uint64_t *prev_version) {
+    struct balance_stripe *mine = &h->stripes[my_stripe()];
+    if (prev_version) *prev_version = __atomic_load_n(&mine->version, __ATOMIC_RELAXED);
+    if (delta_cents >= 0 || allow_negative) {
+        __atomic_fetch_add(&mine->balance_cents, delta_cents, __ATOMIC_RELAXED);
+    } else {
+        int64_t need = -delta_cents;
+        int64_t cur = __atomic_load_n(&mine->balance_cents, __ATOMIC_RELAXED);
+        for (;;) {
+            if (cur >= need) {
+                if (__atomic_compare_exchange_n(&mine->balance_cents, &cur, cur - need, false,
+                                                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+                    break;
+                continue;
+            }
+            /* Funds in flight between stripes may cause a conservative
+             * rejection, never an overdraft. */
+            if (stripe_reserve(h, mine, need - cur) == 0) return LEDGER_ERR_CONSTRAINT;
+            cur = __atomic_load_n(&mine->balance_cents, __ATOMIC_RELAXED);
+        }
+    }
+    __atomic_store_n(&mine->version, version, __ATOMIC_RELAXED);
+    return LEDGER_OK;
+}
+
+/* Sum of the folded balances of striped accounts, optionally filtered by
+ * type or currency. Their column entries are kept at zero. */
+static uint64_t striped_sum(const account_store_t *s, bool by_type, uint8_t type, bool by_currency, uint32_t currency) {
+    uint64_t sum = 0;
+    for (uint32_t k = 0; k < s->striped_count; k++) {
+        const struct striped_account *h = &s->striped[k];
+        if (by_type && h->type != type) continue;
+        if (by_currency && h->currency != currency) continue;
+        int64_t bal;
+        uint64_t v;
+        striped_fold(h, &bal, &v);
+        sum += (uint64_t)bal;
+    }
+    return sum;
+}
+
+/* Segments up to the highest id in use. */
+static uint64_t used_segments(const account_store_t *s) {
+    return s->next_id ? ((s->next_id - 1) >> SEGMENT_SHIFT) + 1 : 0;
+}
+
+static void put_entry(uint8_t *p, uint64_t id, uint8_t type, uint32_t currency, int64_t balance, uint64_t version) {
+    memset(p, 0, ACCOUNT_SNAPSHOT_ENTRY_SIZE);
+    memcpy(p, &id, 8);
+    memcpy(p + 8, &type, 1);
+    memcpy(p + 12, &currency, CURRENCY_LEN);
+    memcpy(p + 16, &balance, 8);
+    memcpy(p + 24, &version, 8);
+}
+
+static void snapshot_segment(account_store_t *s, uint64_t seg) {
+    struct snapshot *sn = &s->snap;
+    const struct account_segment *sg = s->segments[seg];
+    uint8_t *p = sn->buf + sn->offset[seg];
+    sn->done[seg] = 1;
+    if (!sg) return;
+    for (uint32_t w = 0; w < BITMAP_WORDS; w++) {
+        for (uint64_t bits = sg->occupied[w]; bits; bits &= bits - 1) {
+            uint32_t i = w * 64 + (uint32_t)__builtin_ctzll(bits);
+            uint64_t id = (seg << SEGMENT_SHIFT) | i;
+            int64_t balance = sg->balances[i];
+            uint64_t version = sg->versions[i];
+            if (sg->striped_count && bit_test(sg->striped, i)) {
+                for (uint32_t k = 0; k < sn->n_striped; k++) {
+                    if (sn->striped[k].id != id) continue;
+                    balance = sn->striped[k].balance;
+                    version = sn->striped[k].version;
+                }
+            }
+            put_entry(p, id, sg->types[i], sg->currencies[i], balance, version);
+            p += ACCOUNT_SNAPSHOT_ENTRY_SIZE;
+        }
+    }
+}
+
+/* Called before any change to a segment's columns or bitmaps. */
+static void snapshot_touch(account_store_t *s, uint64_t seg) {
+    if (s->snap.active && seg < s->snap.segs && !s->snap.done[seg]) snapshot_segment(s, seg);
+}
+
+ledger_err_t account_create_with_id(account_store_t *s, uint64_t id, account_type_t type, const char *currency) {
+    if (!s || id >= MAX_ACCOUNTS || id >= s->next_id + ACCOUNT_MAX_ID_GAP) return LEDGER_ERR_INVALID;
+    struct account_segment *sg = segment_alloc(s, id);
+    if (!sg) return LEDGER_ERR_NOMEM;
+    uint32_t i = (uint32_t)(id & SEGMENT_MASK);
+    if (bit_test(sg->occupied, i)) return LEDGER_ERR_INVALID;
+    ledger_err_t err = page_touch(s, sg, id, true);
+    if (err == LEDGER_OK && s->index) err = account_index_add(s->index, id, (uint8_t)type, currency_code(currency), 0);
+    if (err != LEDGER_OK) return err;
+    snapshot_touch(s, id >> SEGMENT_SHIFT);
+    bit_assign(sg->occupied, i, true);
+    bit_assign(sg->striped, i, false);
+    sg->versions[i] = 0;
+    sg->balances[i] = 0;
+    sg->types[i] = (uint8_t)type;
+    sg->currencies[i] = currency_code(currency);
+    sg->count++;
     s->count++;
     if (s->next_id <= id) s->next_id = id + 1;
     return LEDGER_OK;
 }
 
-ledger_err_t account_create(account_store_t *s, account_type_t type, const char *currency, uint32_t *out_id) {
+ledger_err_t account_create(account_store_t *s, account_type_t type, const char *currency, uint64_t *out_id) {
     if (!s || !out_id) return LEDGER_ERR_INVALID;
-    if (s->count >= s->capacity && grow(s) != LEDGER_OK) return LEDGER_ERR_NOMEM;
-    uint32_t id = s->next_id++;
-    uint32_t idx = id % s->capacity;
-    while (s->slots[idx].in_use) {
-        idx = (idx + 1) % s->capacity;
-        if (idx == (id % s->capacity)) return LEDGER_ERR_NOMEM;
-    }
-    s->slots[idx].in_use = true;
-    s->slots[idx].account.id = id;
-    s->slots[idx].account.type = type;
-    s->slots[idx].account.balance_cents = 0;
-    s->slots[idx].account.version = 0;
-    memset(s->slots[idx].account.currency, 0, CURRENCY_LEN);
-    if (currency)
-        strncpy(s->slots[idx].account.currency, currency, CURRENCY_LEN - 1);
-    s->count++;
+    if (s->next_id >= MAX_ACCOUNTS) return LEDGER_ERR_NOMEM;
+    uint64_t id = s->next_id;
+    ledger_err_t err = account_create_with_id(s, id, type, currency);
+    if (err != LEDGER_OK) return err;
     *out_id = id;
     return LEDGER_OK;
 }
 
-static int slot_index(const account_store_t *s, uint32_t id) {
-    uint32_t idx = id % s->capacity;
-    for (uint32_t n = 0; n < s->capacity; n++) {
-        if (!s->slots[idx].in_use) return -1;
-        if (s->slots[idx].account.id == id) return (int)idx;
-        idx = (idx + 1) % s->capacity;
+ledger_err_t account_get(account_store_t *s, uint64_t id, account_t *out) {
+    if (!s || !out) return LEDGER_ERR_INVALID;
+    struct account_segment *sg = segment_lookup(s, id);
+    if (!sg) return LEDGER_ERR_NOTFOUND;
+    ledger_err_t err = page_touch(s, sg, id, false);
+    if (err != LEDGER_OK) return err;
+    uint32_t i = (uint32_t)(id & SEGMENT_MASK);
+    out->id = id;
+    out->type = (account_type_t)sg->types[i];
+    out->balance_cents = sg->balances[i];
+    out->version = sg->versions[i];
+    if (sg->striped_count && bit_test(sg->striped, i)) striped_fold(striped_find(s, id), &out->balance_cents, &out->version);
+    memcpy(out->currency, &sg->currencies[i], CURRENCY_LEN);
+    return LEDGER_OK;
+}
+
+/* Lookups are resolved in groups: the first pass maps every id in the group
+ * to its segment and prefetches the occupancy and balance lines, the second
+ * pass reads them, so the group's cache misses overlap instead of queueing.
+ * With tiering, evicted pages are faulted in by the second pass. */
+#define LOOKUP_GROUP 32
+
+ledger_err_t account_balance_many(account_store_t *s, const uint64_t *ids, size_t n,
+                                  int64_t *out, ledger_err_t *errs) {
+    if (!s || (n > 0 && (!ids || !out))) return LEDGER_ERR_INVALID;
+    ledger_err_t result = LEDGER_OK;
+    struct account_segment *segs[LOOKUP_GROUP];
+    for (size_t base = 0; base < n; base += LOOKUP_GROUP) {
+        size_t m = n - base < LOOKUP_GROUP ? n - base : LOOKUP_GROUP;
+        for (size_t j = 0; j < m; j++) {
+            uint64_t id = ids[base + j];
+            uint64_t seg = id >> SEGMENT_SHIFT;
+            segs[j] = seg < s->dir_capacity ? s->segments[seg] : NULL;
+            if (segs[j]) {
+                __builtin_prefetch(&segs[j]->occupied[(id & SEGMENT_MASK) >> 6]);
+                __builtin_prefetch(&segs[j]->balances[id & SEGMENT_MASK]);
+            }
+        }
+        for (size_t j = 0; j < m; j++) {
+            uint64_t id = ids[base + j];
+            uint32_t i = (uint32_t)(id & SEGMENT_MASK);
+            ledger_err_t err = LEDGER_OK;
+            if (!segs[j] || !bit_test(segs[j]->occupied, i)) {
+                err = LEDGER_ERR_NOTFOUND;
+                out[base + j] = 0;
+            } else if (segs[j]->striped_count && bit_test(segs[j]->striped, i)) {
+                uint64_t version;
+                striped_fold(striped_find(s, id), &out[base + j], &version);
+            } else if ((err = page_touch(s, segs[j], id, false)) != LEDGER_OK) {
+                out[base + j] = 0;
+            } else {
+                out[base + j] = segs[j]->balances[i];
+            }
+            if (errs) errs[base + j] = err;
+            if (err != LEDGER_OK && result == LEDGER_OK) result = err;
+        }
     }
-    return -1;
+    return result;
 }
 
-ledger_err_t account_get(account_store_t *s, uint32_t id, account_t *out) {
-    if (!s || !out) return LEDGER_ERR_INVALID;
-    int idx = slot_index(s, id);
-    if (idx < 0) return LEDGER_ERR_NOTFOUND;
-    *out = s->slots[(uint32_t)idx].account;
+static ledger_err_t apply_delta(account_store_t *s, uint64_t id, int64_t delta_cents, uint64_t version,
+                                bool allow_negative, uint64_t *prev_version) {
+    if (!s) return LEDGER_ERR_INVALID;
+    struct account_segment *sg = segment_lookup(s, id);
+    if (!sg) return LEDGER_ERR_NOTFOUND;
+    uint32_t i = (uint32_t)(id & SEGMENT_MASK);
+    if (sg->striped_count && bit_test(sg->striped, i))
+        return striped_apply(striped_find(s, id), delta_cents, version, allow_negative, prev_version);
+    ledger_err_t err = page_touch(s, sg, id, true);
+    if (err != LEDGER_OK) return err;
+    int64_t new_bal = sg->balances[i] + delta_cents;
+    if (new_bal < 0 && !allow_negative) return LEDGER_ERR_CONSTRAINT;
+    snapshot_touch(s, id >> SEGMENT_SHIFT);
+    if (prev_version) *prev_version = sg->versions[i];
+    sg->balances[i] = new_bal;
+    sg->versions[i] = version;
+    s->total_cents += delta_cents;
+    if (s->index) account_index_set_balance(s->index, id, new_bal);
     return LEDGER_OK;
 }
 
-ledger_err_t account_apply_delta(account_store_t *s, uint32_t id, int64_t delta_cents, uint64_t version) {
+ledger_err_t account_apply_delta(account_store_t *s, uint64_t id, int64_t delta_cents, uint64_t version) {
+    return apply_delta(s, id, delta_cents, version, may_go_negative(id), NULL);
+}
+
+ledger_err_t account_apply_delta_prev(account_store_t *s, uint64_t id, int64_t delta_cents, uint64_t version,
+                                      uint64_t *prev_version) {
+    return apply_delta(s, id, delta_cents, version, may_go_negative(id), prev_version);
+}
+
+/* The reversed delta returns the balance to a value it already held, so the
+ * overdraft check is skipped. */
+ledger_err_t account_revert_delta(account_store_t *s, uint64_t id, int64_t delta_cents, uint64_t prev_version) {
+    return apply_delta(s, id, -delta_cents, prev_version, true, NULL);
+}
+
+ledger_err_t account_set_balance(account_store_t *s, uint64_t id, int64_t balance_cents, uint64_t version) {
     if (!s) return LEDGER_ERR_INVALID;
-    int idx = slot_index(s, id);
-    if (idx < 0) return LEDGER_ERR_NOTFOUND;
-    struct account_slot *slot = &s->slots[(uint32_t)idx];
-    int64_t new_bal = slot->account.balance_cents + delta_cents;
-    if (new_bal < 0 && id != 0) return LEDGER_ERR_CONSTRAINT;
-    slot->account.balance_cents = new_bal;
-    slot->account.version = version;
+    if (balance_cents < 0 && !may_go_negative(id)) return LEDGER_ERR_CONSTRAINT;
+    struct account_segment *sg = segment_lookup(s, id);
+    if (!sg) return LEDGER_ERR_NOTFOUND;
+    uint32_t i = (uint32_t)(id & SEGMENT_MASK);
+    if (bit_test(sg->striped, i)) {
+        struct balance_stripe *st = striped_find(s, id)->stripes;
+        for (uint32_t k = 0; k < STRIPE_COUNT; k++) {
+            st[k].balance_cents = k == 0 ? balance_cents : 0;
+            st[k].version = version;
+        }
+        return LEDGER_OK;
+    }
+    ledger_err_t err = page_touch(s, sg, id, true);
+    if (err != LEDGER_OK) return err;
+    snapshot_touch(s, id >> SEGMENT_SHIFT);
+    s->total_cents += balance_cents - sg->balances[i];
+    sg->balances[i] = balance_cents;
+    sg->versions[i] = version;
+    if (s->index) account_index_set_balance(s->index, id, balance_cents);
     return LEDGER_OK;
 }
 
-ledger_err_t account_set_balance(account_store_t *s, uint32_t id, int64_t balance_cents, uint64_t version) {
+uint64_t account_count(const account_store_t *s) {
+    return s ? s->count : 0;
+}
+
+int64_t account_total_balance(const account_store_t *s) {
+    if (!s) return 0;
+    return s->total_cents + (int64_t)striped_sum(s, false, 0, false, 0);
+}
+
+ledger_err_t account_set_striped(account_store_t *s, uint64_t id, bool striped) {
     if (!s) return LEDGER_ERR_INVALID;
-    if (balance_cents < 0) return LEDGER_ERR_CONSTRAINT;
-    int idx = slot_index(s, id);
-    if (idx < 0) return LEDGER_ERR_NOTFOUND;
-    s->slots[(uint32_t)idx].account.balance_cents = balance_cents;
-    s->slots[(uint32_t)idx].account.version = version;
+    struct account_segment *sg = segment_lookup(s, id);
+    if (!sg) return LEDGER_ERR_NOTFOUND;
+    uint32_t i = (uint32_t)(id & SEGMENT_MASK);
+    if (striped == bit_test(sg->striped, i)) return LEDGER_OK;
+    ledger_err_t err = page_touch(s, sg, id, true);
+    if (err != LEDGER_OK) return err;
+    snapshot_touch(s, id >> SEGMENT_SHIFT);
+    if (striped) {
+        if (s->striped_count >= MAX_STRIPED) return LEDGER_ERR_NOMEM;
+        void *mem;
+        if (posix_memalign(&mem, CACHE_LINE, STRIPE_COUNT * sizeof(struct balance_stripe)) != 0)
+            return LEDGER_ERR_NOMEM;
+        struct striped_account *h = &s->striped[s->striped_count];
+        h->id = id;
+        h->type = sg->types[i];
+        h->currency = sg->currencies[i];
+        h->stripes = mem;
+        memset(h->stripes, 0, STRIPE_COUNT * sizeof(struct balance_stripe));
+        h->stripes[0].balance_cents = sg->balances[i];
+        h->stripes[0].version = sg->versions[i];
+        s->total_cents -= sg->balances[i];
+        sg->balances[i] = 0;
+        s->striped_count++;
+        sg->striped_count++;
+        bit_assign(sg->striped, i, true);
+        account_index_detach(s->index, id);
+        return LEDGER_OK;
+    }
+    struct striped_account *h = striped_find(s, id);
+    striped_fold(h, &sg->balances[i], &sg->versions[i]);
+    s->total_cents += sg->balances[i];
+    if (s->index) account_index_set_balance(s->index, id, sg->balances[i]);
+    free(h->stripes);
+    bit_assign(sg->striped, i, false);
+    sg->striped_count--;
+    *h = s->striped[--s->striped_count];
     return LEDGER_OK;
 }
 
-uint32_t account_count(const account_store_t *s) {
-    return s ? s->count : 0;
+/* Column reductions. Sums accumulate in uint64_t so intermediate wraparound
+ * is well defined; the final cast recovers the signed total. The SSE2 paths
+ * turn each key comparison into a 64-bit lane mask and AND it with the
+ * balances, so filtered sums stay branch-free. Callers pass whole segment
+ * or tier page columns, so n is always a multiple of 16 and no scalar tail
+ * is needed. */
+static uint64_t column_sum(const int64_t *bal, size_t n) {
+#if defined(__SSE2__)
+    __m128i acc0 = _mm_setzero_si128(), acc1 = _mm_setzero_si128();
+    for (size_t i = 0; i < n; i += 4) {
+        acc0 = _mm_add_epi64(acc0, _mm_loadu_si128((const __m128i *)(bal + i)));
+        acc1 = _mm_add_epi64(acc1, _mm_loadu_si128((const __m128i *)(bal + i + 2)));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, _mm_add_epi64(acc0, acc1));
+    return lanes[0] + lanes[1];
+#else
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; i++) sum += (uint64_t)bal[i];
+    return sum;
+#endif
+}
+
+static uint64_t column_sum_where_u8(const int64_t *bal, const uint8_t *keys, uint8_t key, size_t n) {
+#if defined(__SSE2__)
+    const __m128i want = _mm_set1_epi8((char)key);
+    __m128i acc = _mm_setzero_si128();
+    for (size_t i = 0; i < n; i += 16) {
+        __m128i m8 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(keys + i)), want);
+        __m128i m16[2] = { _mm_unpacklo_epi8(m8, m8), _mm_unpackhi_epi8(m8, m8) };
+        for (int h = 0; h < 2; h++) {
+            __m128i m32[2] = { _mm_unpacklo_epi16(m16[h], m16[h]), _mm_unpackhi_epi16(m16[h], m16[h]) };
+            for (int q = 0; q < 2; q++) {
+                const int64_t *b = bal + i + h * 8 + q * 4;
+                __m128i lo = _mm_unpacklo_epi32(m32[q], m32[q]);
+                __m128i hi = _mm_unpackhi_epi32(m32[q], m32[q]);
+                acc = _mm_add_epi64(acc, _mm_and_si128(lo, _mm_loadu_si128((const __m128i *)b)));
+                acc = _mm_add_epi64(acc, _mm_and_si128(hi, _mm_loadu_si128((const __m128i *)(b + 2))));
+            }
+        }
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    return lanes[0] + lanes[1];
+#else
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; i++) sum += (uint64_t)bal[i] & (0 - (uint64_t)(keys[i] == key));
+    return sum;
+#endif
+}
+
+static uint64_t column_sum_where_u32(const int64_t *bal, const uint32_t *keys, uint32_t key, size_t n) {
+#if defined(__SSE2__)
+    const __m128i want = _mm_set1_epi32((int)key);
+    __m128i acc = _mm_setzero_si128();
+    for (size_t i = 0; i < n; i += 4) {
+        __m128i m32 = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(keys + i)), want);
+        __m128i lo = _mm_unpacklo_epi32(m32, m32);
+        __m128i hi = _mm_unpackhi_epi32(m32, m32);
+        acc = _mm_add_epi64(acc, _mm_and_si128(lo, _mm_loadu_si128((const __m128i *)(bal + i))));
+        acc = _mm_add_epi64(acc, _mm_and_si128(hi, _mm_loadu_si128((const __m128i *)(bal + i + 2))));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    return lanes[0] + lanes[1];
+#else
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; i++) sum += (uint64_t)bal[i] & (0 - (uint64_t)(keys[i] == key));
+    return sum;
+#endif
+}
+
+enum scan_filter { SCAN_ALL, SCAN_TYPE, SCAN_CURRENCY };
+
+/* Untiered stores reduce whole segment columns; tiered ones go page by
+ * page so evicted pages can be read from the page file. */
+static ledger_err_t scan_sum(const account_store_t *s, enum scan_filter f, uint32_t key, uint64_t *out) {
+    uint32_t span = s->tier ? TIER_PAGE_SLOTS : SEGMENT_SLOTS;
+    uint64_t sum = 0;
+    for (uint64_t seg = 0; seg < s->dir_capacity; seg++) {
+        const struct account_segment *sg = s->segments[seg];
+        if (!sg) continue;
+        for (uint32_t first = 0; first < SEGMENT_SLOTS; first += span) {
+            struct page_cols c;
+            ledger_err_t err = page_view(s, sg, seg, first, &c);
+            if (err == LEDGER_ERR_NOTFOUND) continue;
+            if (err != LEDGER_OK) return err;
+            if (f == SCAN_TYPE)
+                sum += column_sum_where_u8(c.balances, c.types, (uint8_t)key, span);
+            else if (f == SCAN_CURRENCY)
+                sum += column_sum_where_u32(c.balances, c.currencies, key, span);
+            else
+                sum += column_sum(c.balances, span);
+        }
+    }
+    *out = sum;
+    return LEDGER_OK;
+}
+
+ledger_err_t account_sum_balances(const account_store_t *s, int64_t *out) {
+    if (!s || !out) return LEDGER_ERR_INVALID;
+    uint64_t sum;
+    ledger_err_t err = scan_sum(s, SCAN_ALL, 0, &sum);
+    if (err != LEDGER_OK) return err;
+    *out = (int64_t)(sum + striped_sum(s, false, 0, false, 0));
+    return LEDGER_OK;
+}
+
+ledger_err_t account_sum_by_type(const account_store_t *s, account_type_t type, int64_t *out) {
+    if (!s || !out) return LEDGER_ERR_INVALID;
+    uint64_t sum;
+    ledger_err_t err = scan_sum(s, SCAN_TYPE, (uint8_t)type, &sum);
+    if (err != LEDGER_OK) return err;
+    *out = (int64_t)(sum + striped_sum(s, true, (uint8_t)type, false, 0));
+    return LEDGER_OK;
+}
+
+ledger_err_t account_sum_by_currency(const account_store_t *s, const char *currency, int64_t *out) {
+    if (!s || !currency || !out) return LEDGER_ERR_INVALID;
+    uint32_t code = currency_code(currency);
+    uint64_t sum;
+    ledger_err_t err = scan_sum(s, SCAN_CURRENCY, code, &sum);
+    if (err != LEDGER_OK) return err;
+    *out = (int64_t)(sum + striped_sum(s, false, 0, true, code));
+    return LEDGER_OK;
+}
+
+/* Adds every account to the index, walking through page_view() so evicted
+ * pages are read without faulting. */
+static ledger_err_t index_accounts(account_store_t *s) {
+    uint32_t span = s->tier ? TIER_PAGE_SLOTS : SEGMENT_SLOTS;
+    for (uint64_t seg = 0; seg < s->dir_capacity; seg++) {
+        const struct account_segment *sg = s->segments[seg];
+        if (!sg) continue;
+        for (uint32_t first = 0; first < SEGMENT_SLOTS; first += span) {
+            struct page_cols c;
+            ledger_err_t err = page_view(s, sg, seg, first, &c);
+            if (err == LEDGER_ERR_NOTFOUND) continue;
+            if (err != LEDGER_OK) return err;
+            for (uint32_t w = first / 64; w < (first + span) / 64; w++) {
+                for (uint64_t bits = sg->occupied[w]; bits; bits &= bits - 1) {
+                    uint32_t i = w * 64 + (uint32_t)__builtin_ctzll(bits), k = i - first;
+                    uint64_t id = (seg << SEGMENT_SHIFT) | i;
+                    err = account_index_add(s->index, id, c.types[k], c.currencies[k], c.balances[k]);
+                    if (err != LEDGER_OK) return err;
+                    if (bit_test(sg->striped, i)) account_index_detach(s->index, id);
+                }
+            }
+        }
+    }
+    return LEDGER_OK;
+}
+
+ledger_err_t account_store_enable_index(account_store_t *s, unsigned kinds) {
+    if (!s || s->index || !(kinds & (INDEX_ATTRS | INDEX_BALANCE))) return LEDGER_ERR_INVALID;
+    s->index = account_index_create(kinds & (INDEX_ATTRS | INDEX_BALANCE));
+    if (!s->index) return LEDGER_ERR_NOMEM;
+    ledger_err_t err = index_accounts(s);
+    if (err != LEDGER_OK) {
+        account_index_destroy(s->index);
+        s->index = NULL;
+    }
+    return err;
+}
+
+ledger_err_t account_iter_attrs(account_store_t *s, account_iter_t *it, int type, const char *currency) {
+    if (!s || !it || !(account_index_kinds(s->index) & INDEX_ATTRS)) return LEDGER_ERR_INVALID;
+    memset(it, 0, sizeof(*it));
+    it->store = s;
+    index_cursor_attrs(&it->cursor, s->index, type, currency != NULL, currency ? currency_code(currency) : 0);
+    return LEDGER_OK;
+}
+
+static int striped_order(const void *a, const void *b) {
+    const struct account_iter_striped *x = a, *y = b;
+    if (x->balance != y->balance) return x->balance < y->balance ? -1 : 1;
+    return x->id < y->id ? -1 : x->id > y->id;
+}
+
+ledger_err_t account_iter_balances(account_store_t *s, account_iter_t *it, int64_t min, int64_t max,
+                                   bool descending) {
+    if (!s || !it || !(account_index_kinds(s->index) & INDEX_BALANCE)) return LEDGER_ERR_INVALID;
+    memset(it, 0, sizeof(*it));
+    it->store = s;
+    it->by_balance = true;
+    it->descending = descending;
+    index_cursor_balances(&it->cursor, s->index, min, max, descending);
+    for (uint32_t k = 0; k < s->striped_count; k++) {
+        int64_t bal;
+        uint64_t v;
+        striped_fold(&s->striped[k], &bal, &v);
+        if (bal < min || bal > max) continue;
+        it->striped[it->n_striped].id = s->striped[k].id;
+        it->striped[it->n_striped].balance = bal;
+        it->n_striped++;
+    }
+    qsort(it->striped, it->n_striped, sizeof(it->striped[0]), striped_order);
+    return LEDGER_OK;
+}
+
+bool account_iter_next(account_iter_t *it, uint64_t *id, int64_t *balance) {
+    if (!it || !id) return false;
+    if (!it->by_balance) {
+        if (!index_cursor_next(&it->cursor, id, NULL)) return false;
+        if (balance) account_balance_many(it->store, id, 1, balance, NULL);
+        return true;
+    }
+    if (!it->pending) it->pending = index_cursor_next(&it->cursor, &it->pending_id, &it->pending_balance);
+    bool have_striped = it->next_striped < it->n_striped;
+    if (!it->pending && !have_striped) return false;
+    bool take_striped = have_striped;
+    if (it->pending && have_striped) {
+        uint32_t k = it->descending ? it->n_striped - 1 - it->next_striped : it->next_striped;
+        int64_t sb = it->striped[k].balance;
+        uint64_t sid = it->striped[k].id;
+        bool striped_first = sb < it->pending_balance || (sb == it->pending_balance && sid < it->pending_id);
+        take_striped = it->descending ? !striped_first : striped_first;
+    }
+    if (take_striped) {
+        uint32_t k = it->descending ? it->n_striped - 1 - it->next_striped : it->next_striped;
+        *id = it->striped[k].id;
+        if (balance) *balance = it->striped[k].balance;
+        it->next_striped++;
+    } else {
+        *id = it->pending_id;
+        if (balance) *balance = it->pending_balance;
+        it->pending = false;
+    }
+    return true;
+}
+
+/* Periodic postings run as one branch-free pass over the columns: each
+ * slot's rate is the sum of the rate entries its (type, currency) matches,
+ * and unused or striped slots hold a zero balance so they post nothing.
+ * SSE2 has no 64-bit multiply, so the pass is left to the compiler and the
+ * parallelism comes from splitting segments across threads. A tiered store
+ * runs in the caller, page by page, since faults are not thread safe. */
+#define POST_MAX_THREADS 8
+#define PPM 1000000
+
+struct rate_key {
+    uint32_t currency;
+    uint8_t type;
+    int64_t rate;
+};
+
+struct post_job {
+    account_store_t *s;
+    uint64_t seg_begin;
+    uint64_t seg_end;
+    const struct rate_key *rk;
+    size_t nr;
+    uint64_t version;
+    bool apply;
+    account_index_t *ix; /* balance index to update in the pass (tiered stores only) */
+    uint64_t total;
+    ledger_err_t err;
+};
+
+/* Workers kept for the store's lifetime. Worker k runs jobs[k + 1] of each
+ * round it takes part in; the caller runs jobs[0]. */
+struct post_pool {
+    pthread_mutex_t mu;
+    pthread_cond_t go;   /* workers: a round started, or stop */
+    pthread_cond_t idle; /* caller: the round's workers are done */
+    pthread_t th[POST_MAX_THREADS - 1];
+    uint32_t n_workers;
+    struct post_job *jobs;
+    uint32_t n_jobs;
+    uint32_t pending;
+    uint64_t round;
+    bool stop;
+};
+
+struct post_worker {
+    struct post_pool *pool;
+    uint32_t k;
+};
+
+static ledger_err_t rate_keys(const account_rate_t *rates, size_t n, struct rate_key *rk) {
+    if ((n > 0 && !rates) || n > ACCOUNT_MAX_RATES) return LEDGER_ERR_INVALID;
+    for (size_t k = 0; k < n; k++) {
+        if (rates[k].rate_ppm > ACCOUNT_RATE_PPM_MAX || rates[k].rate_ppm < -ACCOUNT_RATE_PPM_MAX)
+            return LEDGER_ERR_INVALID;
+        rk[k].currency = currency_code(rates[k].currency);
+        rk[k].type = (uint8_t)rates[k].type;
+        rk[k].rate = rates[k].rate_ppm;
+        for (size_t j = 0; j < k; j++)
+            if (rk[j].type == rk[k].type && rk[j].currency == rk[k].currency) return LEDGER_ERR_INVALID;
+    }
+    return LEDGER_OK;
+}
+
+/* Split so the product cannot overflow; |rate| <= PPM keeps |result| <= |balance|. */
+static int64_t posting_amount(int64_t balance, int64_t rate) {
+    return (balance / PPM) * rate + (balance % PPM) * rate / PPM;
+}
+
+static int64_t rate_for(const struct rate_key *rk, size_t nr, uint8_t type, uint32_t currency) {
+    int64_t rate = 0;
+    for (size_t k = 0; k < nr; k++)
+        rate += rk[k].rate & -(int64_t)(rk[k].type == type && rk[k].currency == currency);
+    return rate;
+}
+
+/* ix, when set, is the balance index to move each posted account in; base
+ * is the id of the first slot. */
+static uint64_t post_columns(const struct page_cols *c, size_t n, const struct rate_key *rk, size_t nr,
+                             uint64_t version, bool apply, account_index_t *ix, uint64_t base) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < n; i++) {
+        int64_t amt = posting_amount(c->balances[i], rate_for(rk, nr, c->types[i], c->currencies[i]));
+        total += (uint64_t)amt;
+        if (apply) {
+            c->balances[i] += amt;
+            c->versions[i] = amt ? version : c->versions[i];
+            if (ix && amt) account_index_set_balance(ix, base + i, c->balances[i]);
+        }
+    }
+    return total;
+}
+
+static void *post_job_run(void *arg) {
+    struct post_job *j = arg;
+    account_store_t *s = j->s;
+    uint32_t span = s->tier ? TIER_PAGE_SLOTS : SEGMENT_SLOTS;
+    for (uint64_t seg = j->seg_begin; seg < j->seg_end; seg++) {
+        struct account_segment *sg = s->segments[seg];
+        if (!sg) continue;
+        for (uint32_t first = 0; first < SEGMENT_SLOTS; first += span) {
+            struct page_cols c;
+            ledger_err_t err;
+            if (j->apply) {
+                if (s->tier && !(sg->page_state[first >> TIER_PAGE_SHIFT] & (PAGE_RESIDENT | PAGE_ON_DISK))) continue;
+                err = page_touch(s, sg, (seg << SEGMENT_SHIFT) | first, true);
+                page_slices(sg, first, &c);
+            } else {
+                err = page_view(s, sg, seg, first, &c);
+                if (err == LEDGER_ERR_NOTFOUND) continue;
+            }
+            if (err != LEDGER_OK) {
+                j->err = err;
+                return NULL;
+            }
+            j->total += post_columns(&c, span, j->rk, j->nr, j->version, j->apply, j->ix, (seg << SEGMENT_SHIFT) | first);
+        }
+    }
+    return NULL;
+}
+
+static void *post_worker_run(void *arg) {
+    struct post_pool *p = ((struct post_worker *)arg)->pool;
+    uint32_t k = ((struct post_worker *)arg)->k;
+    free(arg);
+    uint64_t seen = 0;
+    pthread_mutex_lock(&p->mu);
+    for (;;) {
+        while (!p->stop && p->round == seen) pthread_cond_wait(&p->go, &p->mu);
+        if (p->stop) break;
+        seen = p->round;
+        if (k + 1 >= p->n_jobs) continue;
+        struct post_job *j = &p->jobs[k + 1];
+        pthread_mutex_unlock(&p->mu);
+        post_job_run(j);
+        pthread_mutex_lock(&p->mu);
+        if (--p->pending == 0) pthread_cond_signal(&p->idle);
+    }
+    pthread_mutex_unlock(&p->mu);
+    return NULL;
+}
+
+static void post_pool_destroy(struct post_pool *p) {
+    if (!p) return;
+    pthread_mutex_lock(&p->mu);
+    p->stop = true;
+    pthread_cond_broadcast(&p->go);
+    pthread_mutex_unlock(&p->mu);
+    for (uint32_t k = 0; k < p->n_workers; k++) pthread_join(p->th[k], NULL);
+    pthread_cond_destroy(&p->idle);
+    pthread_cond_destroy(&p->go);
+    pthread_mutex_destroy(&p->mu);
+    free(p);
 }
 
-#define SNAPSHOT_ENTRY_SIZE (sizeof(uint32_t) + sizeof(uint8_t) + sizeof(int64_t) + sizeof(uint64_t) + CURRENCY_LEN)
+/* Starts up to `workers` threads; the pool may end up with fewer (or be
+ * NULL), in which case the caller runs the remaining jobs itself. */
+static struct post_pool *post_pool_create(uint32_t workers) {
+    struct post_pool *p = calloc(1, sizeof(*p));
+    if (!p) return NULL;
+    pthread_mutex_init(&p->mu, NULL);
+    pthread_cond_init(&p->go, NULL);
+    pthread_cond_init(&p->idle, NULL);
+    for (; p->n_workers < workers; p->n_workers++) {
+        struct post_worker *w = malloc(sizeof(*w));
+        if (!w) break;
+        *w = (struct post_worker){ p, p->n_workers };
+        if (pthread_create(&p->th[p->n_workers], NULL, post_worker_run, w) != 0) {
+            free(w);
+            break;
+        }
+    }
+    return p;
+}
+
+/* Runs jobs[0, nt) with jobs[0] on the calling thread. */
+static void post_pool_run(account_store_t *s, struct post_job *jobs, uint32_t nt) {
+    if (nt > 1 && !s->pool) s->pool = post_pool_create(POST_MAX_THREADS - 1);
+    struct post_pool *p = s->pool;
+    uint32_t pooled = p && nt > 1 ? (nt - 1 < p->n_workers ? nt - 1 : p->n_workers) : 0;
+    if (pooled) {
+        pthread_mutex_lock(&p->mu);
+        p->jobs = jobs;
+        p->n_jobs = pooled + 1;
+        p->pending = pooled;
+        p->round++;
+        pthread_cond_broadcast(&p->go);
+        pthread_mutex_unlock(&p->mu);
+    }
+    post_job_run(&jobs[0]);
+    for (uint32_t t = pooled + 1; t < nt; t++) post_job_run(&jobs[t]);
+    if (pooled) {
+        pthread_mutex_lock(&p->mu);
+        while (p->pending) pthread_cond_wait(&p->idle, &p->mu);
+        pthread_mutex_unlock(&p->mu);
+    }
+}
+
+/* Moves the accounts a resident pass over [lo, hi) posted (those now at
+ * `version`) to their new place in the balance index. The skip list takes
+ * one writer, so this runs after the parallel pass rather than inside it. */
+static void index_postings(account_store_t *s, uint64_t version, uint64_t lo, uint64_t hi) {
+    for (uint64_t seg = lo; seg < hi; seg++) {
+        const struct account_segment *sg = s->segments[seg];
+        if (!sg || !sg->count) continue;
+        for (uint32_t w = 0; w < SEGMENT_SLOTS / 64; w++)
+            for (uint64_t bits = sg->occupied[w]; bits; bits &= bits - 1) {
+                uint32_t i = w * 64 + (uint32_t)__builtin_ctzll(bits);
+                if (sg->versions[i] == version)
+                    account_index_set_balance(s->index, (seg << SEGMENT_SHIFT) | i, sg->balances[i]);
+            }
+    }
+}
+
+/* Runs over segments [lo, hi). */
+static ledger_err_t post_pass(account_store_t *s, const struct rate_key *rk, size_t nr, uint64_t version,
+                              bool apply, uint64_t lo, uint64_t hi, uint64_t *out) {
+    uint64_t used = used_segments(s);
+    if (hi > used) hi = used;
+    uint64_t span = hi > lo ? hi - lo : 0;
+    if (apply)
+        for (uint64_t seg = lo; seg < hi; seg++) snapshot_touch(s, seg);
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    account_index_t *ix = apply && (account_index_kinds(s->index) & INDEX_BALANCE) ? s->index : NULL;
+    uint64_t nt = s->tier || cpus < 1 ? 1 : (uint64_t)cpus;
+    if (nt > POST_MAX_THREADS) nt = POST_MAX_THREADS;
+    if (nt > span) nt = span ? span : 1;
+    struct post_job jobs[POST_MAX_THREADS];
+    for (uint64_t t = 0; t < nt; t++)
+        jobs[t] = (struct post_job){ .s = s, .seg_begin = lo + span * t / nt, .seg_end = lo + span * (t + 1) / nt,
+                                     .rk = rk, .nr = nr, .version = version, .apply = apply,
+                                     .ix = s->tier ? ix : NULL };
+    post_pool_run(s, jobs, (uint32_t)nt);
+    ledger_err_t err = LEDGER_OK;
+    uint64_t total = 0;
+    for (uint64_t t = 0; t < nt; t++) {
+        total += jobs[t].total;
+        if (jobs[t].err != LEDGER_OK && err == LEDGER_OK) err = jobs[t].err;
+    }
+    if (ix && !s->tier) index_postings(s, version, lo, hi < lo ? lo : hi);
+    *out = total;
+    return err;
+}
+
+/* Column slot of an account the pass must leave alone, if it has one. */
+static struct account_segment *excluded_slot(account_store_t *s, uint64_t id, bool dirty, ledger_err_t *err) {
+    struct account_segment *sg = segment_lookup(s, id);
+    *err = LEDGER_OK;
+    if (!sg || (sg->striped_count && bit_test(sg->striped, (uint32_t)(id & SEGMENT_MASK)))) return NULL;
+    *err = page_touch(s, sg, id, dirty);
+    if (dirty) snapshot_touch(s, id >> SEGMENT_SHIFT);
+    return *err == LEDGER_OK ? sg : NULL;
+}
+
+static bool in_segments(uint64_t id, uint64_t lo, uint64_t hi) {
+    return (id >> SEGMENT_SHIFT) >= lo && (id >> SEGMENT_SHIFT) < hi;
+}
+
+static uint64_t striped_postings(account_store_t *s, const struct rate_key *rk, size_t nr, uint64_t contra_id,
+                                 uint64_t version, bool apply, uint64_t lo, uint64_t hi) {
+    uint64_t total = 0;
+    for (uint32_t k = 0; k < s->striped_count; k++) {
+        struct striped_account *h = &s->striped[k];
+        if (h->id == contra_id || may_go_negative(h->id) || !in_segments(h->id, lo, hi)) continue;
+        int64_t bal;
+        uint64_t v;
+        striped_fold(h, &bal, &v);
+        int64_t amt = posting_amount(bal, rate_for(rk, nr, h->type, h->currency));
+        if (apply && amt) striped_apply(h, amt, version, true, NULL);
+        total += (uint64_t)amt;
+    }
+    return total;
+}
+
+static ledger_err_t check_contra(account_store_t *s, uint64_t contra_id, int64_t total) {
+    account_t a;
+    ledger_err_t err = account_get(s, contra_id, &a);
+    if (err != LEDGER_OK) return err;
+    if (a.balance_cents - total < 0 && !may_go_negative(contra_id)) return LEDGER_ERR_CONSTRAINT;
+    return LEDGER_OK;
+}
+
+/* Both run over the accounts in segments [lo, hi). */
+static ledger_err_t sum_postings(account_store_t *s, const account_rate_t *rates, size_t n_rates, uint64_t contra_id,
+                                 uint64_t lo, uint64_t hi, int64_t *out_total) {
+    if (!s || !out_total) return LEDGER_ERR_INVALID;
+    struct rate_key rk[ACCOUNT_MAX_RATES];
+    ledger_err_t err = rate_keys(rates, n_rates, rk);
+    if (err != LEDGER_OK) return err;
+    uint64_t total;
+    err = post_pass(s, rk, n_rates, 0, false, lo, hi, &total);
+    if (err != LEDGER_OK) return err;
+    uint64_t excluded[2] = { contra_id, 0 };
+    for (int e = 0; e < (contra_id == 0 ? 1 : 2); e++) {
+        if (!in_segments(excluded[e], lo, hi)) continue;
+        struct account_segment *sg = excluded_slot(s, excluded[e], false, &err);
+        if (err != LEDGER_OK) return err;
+        if (!sg) continue;
+        uint32_t i = (uint32_t)(excluded[e] & SEGMENT_MASK);
+        total -= (uint64_t)posting_amount(sg->balances[i], rate_for(rk, n_rates, sg->types[i], sg->currencies[i]));
+    }
+    total += striped_postings(s, rk, n_rates, contra_id, 0, false, lo, hi);
+    err = check_contra(s, contra_id, (int64_t)total);
+    if (err != LEDGER_OK) return err;
+    *out_total = (int64_t)total;
+    return LEDGER_OK;
+}
+
+static ledger_err_t apply_postings(account_store_t *s, const account_rate_t *rates, size_t n_rates, uint64_t contra_id,
+                                   uint64_t lo, uint64_t hi, uint64_t version, int64_t total) {
+    if (!s) return LEDGER_ERR_INVALID;
+    struct rate_key rk[ACCOUNT_MAX_RATES];
+    ledger_err_t err = rate_keys(rates, n_rates, rk);
+    if (err == LEDGER_OK) err = check_contra(s, contra_id, total);
+    if (err != LEDGER_OK) return err;
+    /* The pass posts the excluded accounts too; remember them to undo it. */
+    uint64_t excluded[2] = { contra_id, 0 };
+    int n_excluded = contra_id == 0 ? 1 : 2;
+    int64_t saved_bal[2] = { 0, 0 };
+    uint64_t saved_ver[2] = { 0, 0 };
+    bool saved[2] = { false, false };
+    for (int e = 0; e < n_excluded; e++) {
+        if (!in_segments(excluded[e], lo, hi)) continue;
+        struct account_segment *sg = excluded_slot(s, excluded[e], true, &err);
+        if (err != LEDGER_OK) return err;
+        if (!sg) continue;
+        uint32_t i = (uint32_t)(excluded[e] & SEGMENT_MASK);
+        saved_bal[e] = sg->balances[i];
+        saved_ver[e] = sg->versions[i];
+        saved[e] = true;
+    }
+    uint64_t column_total;
+    err = post_pass(s, rk, n_rates, version, true, lo, hi, &column_total);
+    for (int e = 0; e < n_excluded; e++) {
+        ledger_err_t rerr;
+        struct account_segment *sg = saved[e] ? excluded_slot(s, excluded[e], true, &rerr) : NULL;
+        if (!sg) continue;
+        uint32_t i = (uint32_t)(excluded[e] & SEGMENT_MASK);
+        column_total -= (uint64_t)(sg->balances[i] - saved_bal[e]);
+        sg->balances[i] = saved_bal[e];
+        sg->versions[i] = saved_ver[e];
+        if (s->index) account_index_set_balance(s->index, excluded[e], saved_bal[e]);
+    }
+    s->total_cents += (int64_t)column_total;
+    int64_t applied = (int64_t)(column_total + striped_postings(s, rk, n_rates, contra_id, version, true, lo, hi));
+    /* Keep the books balanced whatever happened, then report a mismatch. */
+    ledger_err_t cerr = applied ? account_apply_delta(s, contra_id, -applied, version) : LEDGER_OK;
+    if (err != LEDGER_OK) return err;
+    if (cerr != LEDGER_OK) return cerr;
+    return applied == total ? LEDGER_OK : LEDGER_ERR_IO;
+}
+
+ledger_err_t account_sum_postings(account_store_t *s, const account_rate_t *rates, size_t n_rates,
+                                  uint64_t contra_id, int64_t *out_total) {
+    return sum_postings(s, rates, n_rates, contra_id, 0, UINT64_MAX, out_total);
+}
+
+ledger_err_t account_apply_postings(account_store_t *s, const account_rate_t *rates, size_t n_rates,
+                                    uint64_t contra_id, uint64_t version, int64_t total) {
+    return apply_postings(s, rates, n_rates, contra_id, 0, UINT64_MAX, version, total);
+}
 
-ledger_err_t account_serialize(const account_store_t *s, uint32_t next_tx_id, void *buf, size_t cap, size_t *out_len) {
+#if ACCOUNT_POSTING_SLICE != SEGMENT_SLOTS
+#error "a posting slice is one segment"
+#endif
+
+uint64_t account_posting_slices(const account_store_t *s) {
+    return s ? used_segments(s) : 0;
+}
+
+ledger_err_t account_sum_postings_slice(account_store_t *s, const account_rate_t *rates, size_t n_rates,
+                                        uint64_t contra_id, uint64_t slice, int64_t *out_total) {
+    if (slice >= MAX_ACCOUNTS >> SEGMENT_SHIFT) return LEDGER_ERR_INVALID;
+    return sum_postings(s, rates, n_rates, contra_id, slice, slice + 1, out_total);
+}
+
+ledger_err_t account_apply_postings_slice(account_store_t *s, const account_rate_t *rates, size_t n_rates,
+                                          uint64_t contra_id, uint64_t slice, uint64_t version, int64_t total) {
+    if (slice >= MAX_ACCOUNTS >> SEGMENT_SHIFT) return LEDGER_ERR_INVALID;
+    return apply_postings(s, rates, n_rates, contra_id, slice, slice + 1, version, total);
+}
+
+ledger_err_t account_serialize(const account_store_t *s, uint64_t next_tx_id, void *buf, size_t cap, size_t *out_len) {
     if (!s || !buf || !out_len) return LEDGER_ERR_INVALID;
-    if (cap < 8) return LEDGER_ERR_INVALID;
+    if (cap < ACCOUNT_SNAPSHOT_HEADER_SIZE) return LEDGER_ERR_INVALID;
     uint8_t *p = (uint8_t *)buf;
-    uint32_t count = account_count(s);
-    memcpy(p, &next_tx_id, 4);
-    memcpy(p + 4, &count, 4);
-    p += 8;
-    size_t used = 8;
-    for (uint32_t i = 0; i < s->capacity && count > 0; i++) {
-        if (!s->slots[i].in_use) continue;
-        if (used + SNAPSHOT_ENTRY_SIZE > cap) return LEDGER_ERR_INVALID;
-        account_t *a = &s->slots[i].account;
-        memcpy(p, &a->id, 4);
-        memcpy(p + 4, &a->type, 1);
-        memcpy(p + 8, &a->balance_cents, 8);
-        memcpy(p + 16, &a->version, 8);
-        memcpy(p + 24, a->currency, CURRENCY_LEN);
-        p += SNAPSHOT_ENTRY_SIZE;
-        used += SNAPSHOT_ENTRY_SIZE;
-        count--;
+    uint64_t count = account_count(s);
+    memcpy(p, &next_tx_id, 8);
+    memcpy(p + 8, &count, 8);
+    p += ACCOUNT_SNAPSHOT_HEADER_SIZE;
+    size_t used = ACCOUNT_SNAPSHOT_HEADER_SIZE;
+    uint32_t span = s->tier ? TIER_PAGE_SLOTS : SEGMENT_SLOTS;
+    for (uint64_t seg = 0; seg < s->dir_capacity && count > 0; seg++) {
+        const struct account_segment *sg = s->segments[seg];
+        if (!sg) continue;
+        for (uint32_t first = 0; first < SEGMENT_SLOTS && count > 0; first += span) {
+            struct page_cols c;
+            ledger_err_t err = page_view(s, sg, seg, first, &c);
+            if (err == LEDGER_ERR_NOTFOUND) continue;
+            if (err != LEDGER_OK) return err;
+            for (uint32_t w = first / 64; w < (first + span) / 64 && count > 0; w++) {
+                for (uint64_t bits = sg->occupied[w]; bits && count > 0; bits &= bits - 1) {
+                    uint32_t i = w * 64 + (uint32_t)__builtin_ctzll(bits), k = i - first;
+                    if (used + ACCOUNT_SNAPSHOT_ENTRY_SIZE > cap) return LEDGER_ERR_INVALID;
+                    uint64_t id = (seg << SEGMENT_SHIFT) | i;
+                    int64_t balance = c.balances[k];
+                    uint64_t version = c.versions[k];
+                    if (bit_test(sg->striped, i)) striped_fold(striped_find(s, id), &balance, &version);
+                    put_entry(p, id, c.types[k], c.currencies[k], balance, version);
+                    p += ACCOUNT_SNAPSHOT_ENTRY_SIZE;
+                    used += ACCOUNT_SNAPSHOT_ENTRY_SIZE;
+                    count--;
+                }
+            }
+        }
     }
     *out_len = used;
     return LEDGER_OK;
 }
+
+ledger_err_t account_snapshot_begin(account_store_t *s, uint64_t next_tx_id, void *buf, size_t cap, size_t *out_len) {
+    if (!s || s->tier || s->snap.active || !buf || !out_len) return LEDGER_ERR_INVALID;
+    struct snapshot *sn = &s->snap;
+    uint64_t segs = used_segments(s);
+    if (segs + 1 > sn->cap) {
+        size_t *offset = realloc(sn->offset, (size_t)(segs + 1) * sizeof(size_t));
+        if (offset) sn->offset = offset;
+        uint8_t *done = realloc(sn->done, (size_t)(segs + 1));
+        if (done) sn->done = done;
+        if (!offset || !done) return LEDGER_ERR_NOMEM;
+        sn->cap = segs + 1;
+    }
+    size_t len = ACCOUNT_SNAPSHOT_HEADER_SIZE + (size_t)s->count * ACCOUNT_SNAPSHOT_ENTRY_SIZE;
+    if (cap < len) return LEDGER_ERR_INVALID;
+    uint8_t *p = (uint8_t *)buf;
+    memcpy(p, &next_tx_id, 8);
+    memcpy(p + 8, &s->count, 8);
+    sn->offset[0] = ACCOUNT_SNAPSHOT_HEADER_SIZE;
+    for (uint64_t seg = 0; seg < segs; seg++) {
+        const struct account_segment *sg = s->segments[seg];
+        sn->offset[seg + 1] = sn->offset[seg] + (sg ? (size_t)sg->count * ACCOUNT_SNAPSHOT_ENTRY_SIZE : 0);
+    }
+    memset(sn->done, 0, (size_t)segs);
+    for (uint32_t k = 0; k < s->striped_count; k++) {
+        sn->striped[k].id = s->striped[k].id;
+        striped_fold(&s->striped[k], &sn->striped[k].balance, &sn->striped[k].version);
+    }
+    sn->n_striped = s->striped_count;
+    sn->buf = p;
+    sn->len = len;
+    sn->segs = segs;
+    sn->next = 0;
+    sn->active = true;
+    *out_len = len;
+    return LEDGER_OK;
+}
+
+/* Serializes segments in id order until one with accounts is done; those
+ * already copied on write are skipped. */
+ledger_err_t account_snapshot_step(account_store_t *s, size_t *ready) {
+    if (!s || !ready || !s->snap.active) return LEDGER_ERR_INVALID;
+    struct snapshot *sn = &s->snap;
+    while (sn->next < sn->segs) {
+        uint64_t seg = sn->next++;
+        if (sn->done[seg]) continue;
+        snapshot_segment(s, seg);
+        if (sn->offset[seg + 1] > sn->offset[seg]) break;
+    }
+    while (sn->next < sn->segs && sn->done[sn->next]) sn->next++;
+    *ready = sn->next < sn->segs ? sn->offset[sn->next] : sn->len;
+    return LEDGER_OK;
+}
+
+void account_snapshot_end(account_store_t *s) {
+    if (s) s->snap.active = false;
+}
+
+size_t account_page_checkpoint_size(const account_store_t *s) {
+    if (!s) return 0;
+    return ACCOUNT_PAGE_CHECKPOINT_HEADER_SIZE + (size_t)s->dir_capacity * TIER_PAGES_PER_SEGMENT +
+           (size_t)s->striped_count * ACCOUNT_PAGE_CHECKPOINT_STRIPED_SIZE;
+}
+
+ledger_err_t account_page_checkpoint(account_store_t *s, uint64_t next_tx_id, void *buf, size_t cap, size_t *out_len) {
+    if (!s || !s->tier || !buf || !out_len) return LEDGER_ERR_INVALID;
+    size_t len = account_page_checkpoint_size(s);
+    if (cap < len) return LEDGER_ERR_INVALID;
+    ledger_err_t err = account_store_sync(s);
+    if (err != LEDGER_OK) return err;
+    if (fdatasync(s->tier->fd) != 0) return LEDGER_ERR_IO;
+    uint64_t n_pages = s->dir_capacity * TIER_PAGES_PER_SEGMENT, n_striped = s->striped_count;
+    uint64_t hdr[6] = { next_tx_id, s->count, s->next_id, (uint64_t)s->total_cents, n_pages, n_striped };
+    uint8_t *p = (uint8_t *)buf;
+    memcpy(p, hdr, sizeof(hdr));
+    p += ACCOUNT_PAGE_CHECKPOINT_HEADER_SIZE;
+    for (uint64_t seg = 0; seg < s->dir_capacity; seg++) {
+        const struct account_segment *sg = s->segments[seg];
+        for (uint32_t k = 0; k < TIER_PAGES_PER_SEGMENT; k++) {
+            uint8_t st = sg ? sg->page_state[k] : 0;
+            *p++ = (uint8_t)(((st & PAGE_ON_DISK) ? 1 : 0) | ((st & PAGE_SLOT) ? 2 : 0));
+        }
+    }
+    for (uint32_t k = 0; k < s->striped_count; k++) {
+        int64_t balance;
+        uint64_t version;
+        striped_fold(&s->striped[k], &balance, &version);
+        memcpy(p, &s->striped[k].id, 8);
+        memcpy(p + 8, &balance, 8);
+        memcpy(p + 16, &version, 8);
+        p += ACCOUNT_PAGE_CHECKPOINT_STRIPED_SIZE;
+    }
+    *out_len = len;
+    return LEDGER_OK;
+}
+
+void account_page_checkpoint_commit(account_store_t *s) {
+    if (!s || !s->tier) return;
+    for (uint64_t seg = 0; seg < s->dir_capacity; seg++) {
+        struct account_segment *sg = s->segments[seg];
+        if (!sg) continue;
+        for (uint32_t k = 0; k < TIER_PAGES_PER_SEGMENT; k++) {
+            uint8_t st = sg->page_state[k];
+            if (!(st & PAGE_ON_DISK)) continue;
+            st = (uint8_t)((st & ~PAGE_CKPT_SLOT) | PAGE_CKPT | ((st & PAGE_SLOT) ? PAGE_CKPT_SLOT : 0));
+            sg->page_state[k] = st;
+        }
+    }
+}
+
+/* Rebuilds the directory and occupancy from the page file without reading
+ * any column data; pages fault in on first access. */
+ledger_err_t account_page_restore(account_store_t *s, const void *buf, size_t len, uint64_t *next_tx_id) {
+    if (!s || !s->tier || !buf || !next_tx_id) return LEDGER_ERR_INVALID;
+    if (len < ACCOUNT_PAGE_CHECKPOINT_HEADER_SIZE) return LEDGER_ERR_IO;
+    uint64_t hdr[6];
+    memcpy(hdr, buf, sizeof(hdr));
+    uint64_t n_pages = hdr[4], n_striped = hdr[5];
+    if (n_pages > (MAX_ACCOUNTS >> TIER_PAGE_SHIFT) || n_striped > MAX_STRIPED ||
+        len != ACCOUNT_PAGE_CHECKPOINT_HEADER_SIZE + n_pages + n_striped * ACCOUNT_PAGE_CHECKPOINT_STRIPED_SIZE)
+        return LEDGER_ERR_IO;
+    release_contents(s, false);
+    const uint8_t *pages = (const uint8_t *)buf + ACCOUNT_PAGE_CHECKPOINT_HEADER_SIZE;
+    uint64_t count = 0;
+    for (uint64_t g = 0; g < n_pages; g++) {
+        if (!(pages[g] & 1)) continue;
+        struct account_segment *sg = segment_alloc(s, (g / TIER_PAGES_PER_SEGMENT) << SEGMENT_SHIFT);
+        if (!sg) return LEDGER_ERR_NOMEM;
+        uint32_t k = (uint32_t)(g % TIER_PAGES_PER_SEGMENT);
+        uint8_t st = (uint8_t)(PAGE_ON_DISK | PAGE_CKPT | ((pages[g] & 2) ? PAGE_SLOT | PAGE_CKPT_SLOT : 0));
+        uint64_t *occ = sg->occupied + k * (TIER_PAGE_SLOTS / 64);
+        if (pread(s->tier->fd, occ, TIER_OCCUPANCY_BYTES, page_offset(g, st) + (off_t)TIER_PAGE_BYTES) !=
+            (ssize_t)TIER_OCCUPANCY_BYTES)
+            return LEDGER_ERR_IO;
+        sg->page_state[k] = st;
+        uint32_t n = 0;
+        for (uint32_t w = 0; w < TIER_PAGE_SLOTS / 64; w++) n += (uint32_t)__builtin_popcountll(occ[w]);
+        sg->count += n;
+        count += n;
+    }
+    /* A page file that does not match the log shows up here. */
+    if (count != hdr[1]) return LEDGER_ERR_IO;
+    s->count = count;
+    s->next_id = hdr[2];
+    s->total_cents = (int64_t)hdr[3];
+    /* Striped accounts come back unstriped, their folded balance in the column. */
+    const uint8_t *p = pages + n_pages;
+    for (uint64_t k = 0; k < n_striped; k++, p += ACCOUNT_PAGE_CHECKPOINT_STRIPED_SIZE) {
+        uint64_t id, version;
+        int64_t balance;
+        memcpy(&id, p, 8);
+        memcpy(&balance, p + 8, 8);
+        memcpy(&version, p + 16, 8);
+        if (account_set_balance(s, id, balance, version) != LEDGER_OK) return LEDGER_ERR_IO;
+    }
+    *next_tx_id = hdr[0];
+    return s->index ? index_accounts(s) : LEDGER_OK;
+}
@@ -0,0 +1,334 @@
+#include "index.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Both indexes are split into segments of 65536 ids, like the store. Each
+ * class bitmap segment keeps a summary bit per non-empty word, so iteration
+ * skips empty stretches 4096 ids at a time. */
+#define IX_SEG_SHIFT 16
+#define IX_SEG_SLOTS (1u << IX_SEG_SHIFT)
+#define IX_SEG_MASK  (IX_SEG_SLOTS - 1)
+#define IX_WORDS     (IX_SEG_SLOTS / 64)
+#define IX_SUMMARY   (IX_WORDS / 64)
+#define IX_INITIAL_SEGS 16
+#define SKIP_MAX_LEVEL 24
+
+struct class_segment {
+    uint64_t summary[IX_SUMMARY];
+    uint64_t words[IX_WORDS];
+};
+
+struct attr_class {
+    uint8_t type;
+    uint32_t currency;
+    struct class_segment **segs;
+};
+
+/* Skip list node; one per account, allocated when the account is indexed and
+ * relinked in place afterwards. */
+struct bal_node {
+    uint64_t id;
+    int64_t balance;
+    struct bal_node *prev;
+    uint8_t level;
+    bool linked;
+    struct bal_node *next[];
+};
+
+struct account_index {
+    unsigned kinds;
+    uint64_t seg_cap;
+    struct attr_class classes[INDEX_MAX_CLASSES];
+    uint32_t n_classes;
+    struct bal_node ***nodes; /* per segment, per slot */
+    struct bal_node *head;
+    uint8_t level;
+    uint64_t rng;
+};
+
+account_index_t *account_index_create(unsigned kinds) {
+    account_index_t *ix = calloc(1, sizeof(account_index_t));
+    if (!ix) return NULL;
+    ix->kinds = kinds;
+    ix->seg_cap = IX_INITIAL_SEGS;
+    ix->rng = 0x2545F4914F6CDD1Dull;
+    ix->level = 1;
+    ix->nodes = calloc((size_t)ix->seg_cap, sizeof(struct bal_node **));
+    ix->head = calloc(1, sizeof(struct bal_node) + SKIP_MAX_LEVEL * sizeof(struct bal_node *));
+    if (!ix->nodes || !ix->head) {
+        free(ix->nodes);
+        free(ix->head);
+        free(ix);
+        return NULL;
+    }
+    ix->head->level = SKIP_MAX_LEVEL;
+    return ix;
+}
+
+void account_index_clear(account_index_t *ix) {
+    if (!ix) return;
+    for (uint32_t k = 0; k < ix->n_classes; k++) {
+        for (uint64_t seg = 0; seg < ix->seg_cap; seg++) free(ix->classes[k].segs[seg]);
+        free(ix->classes[k].segs);
+    }
+    ix->n_classes = 0;
+    for (uint64_t seg = 0; seg < ix->seg_cap; seg++) {
+        if (!ix->nodes[seg]) continue;
+        for (uint32_t i = 0; i < IX_SEG_SLOTS; i++) free(ix->nodes[seg][i]);
+        free(ix->nodes[seg]);
+        ix->nodes[seg] = NULL;
+    }
+    memset(ix->head->next, 0, SKIP_MAX_LEVEL * sizeof(struct bal_node *));
+    ix->level = 1;
+}
+
+void account_index_destroy(account_index_t *ix) {
+    if (!ix) return;
+    account_index_clear(ix);
+    free(ix->nodes);
+    free(ix->head);
+    free(ix);
+}
+
+unsigned account_index_kinds(const account_index_t *ix) {
+    return ix ? ix->kinds : 0;
+}
+
+static ledger_err_t grow_segments(account_index_t *ix, uint64_t seg) {
+    if (seg < ix->seg_cap) return LEDGER_OK;
+    uint64_t cap = ix->seg_cap;
+    while (cap <= seg) cap *= 2;
+    size_t old = (size_t)ix->seg_cap, add = (size_t)(cap - ix->seg_cap);
+    struct bal_node ***n = realloc(ix->nodes, (size_t)cap * sizeof(*n));
+    if (!n) return LEDGER_ERR_NOMEM;
+    memset(n + old, 0, add * sizeof(*n));
+    ix->nodes = n;
+    for (uint32_t k = 0; k < ix->n_classes; k++) {
+        struct class_segment **c = realloc(ix->classes[k].segs, (size_t)cap * sizeof(*c));
+        if (!c) return LEDGER_ERR_NOMEM;
+        memset(c + old, 0, add * sizeof(*c));
+        ix->classes[k].segs = c;
+    }
+    ix->seg_cap = cap;
+    return LEDGER_OK;
+}
+
+static struct attr_class *find_class(account_index_t *ix, uint8_t type, uint32_t currency, bool create) {
+    for (uint32_t k = 0; k < ix->n_classes; k++)
+        if (ix->classes[k].type == type && ix->classes[k].currency == currency) return &ix->classes[k];
+    if (!create || ix->n_classes >= INDEX_MAX_CLASSES) return NULL;
+    struct attr_class *c = &ix->classes[ix->n_classes];
+    c->segs = calloc((size_t)ix->seg_cap, sizeof(struct class_segment *));
+    if (!c->segs) return NULL;
+    c->type = type;
+    c->currency = currency;
+    ix->n_classes++;
+    return c;
+}
+
+/* (balance, id) order. */
+static bool key_less(int64_t b1, uint64_t id1, int64_t b2, uint64_t id2) {
+    return b1 < b2 || (b1 == b2 && id1 < id2);
+}
+
+static uint8_t random_level(account_index_t *ix) {
+    uint64_t x = ix->rng;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    ix->rng = x;
+    uint8_t level = 1;
+    while (level < SKIP_MAX_LEVEL && (x & 3) == 0) {
+        level++;
+        x >>= 2;
+    }
+    return level;
+}
+
+static struct bal_node *node_of(const account_index_t *ix, uint64_t id) {
+    uint64_t seg = id >> IX_SEG_SHIFT;
+    if (seg >= ix->seg_cap || !ix->nodes[seg]) return NULL;
+    return ix->nodes[seg][id & IX_SEG_MASK];
+}
+
+/* Fills update[] with the last node before (balance, id) on every level. */
+static void find_preds(const account_index_t *ix, int64_t balance, uint64_t id, struct bal_node **update) {
+    struct bal_node *x = ix->head;
+    for (int lvl = ix->level - 1; lvl >= 0; lvl--) {
+        while (x->next[lvl] && key_less(x->next[lvl]->balance, x->next[lvl]->id, balance, id)) x = x->next[lvl];
+        update[lvl] = x;
+    }
+}
+
+static void skip_link(account_index_t *ix, struct bal_node *n) {
+    struct bal_node *update[SKIP_MAX_LEVEL];
+    if (n->level > ix->level) {
+        for (uint8_t lvl = ix->level; lvl < n->level; lvl++) ix->head->next[lvl] = NULL;
+        ix->level = n->level;
+    }
+    find_preds(ix, n->balance, n->id, update);
+    for (uint8_t lvl = 0; lvl < n->level; lvl++) {
+        n->next[lvl] = update[lvl]->next[lvl];
+        update[lvl]->next[lvl] = n;
+    }
+    n->prev = update[0] == ix->head ? NULL : update[0];
+    if (n->next[0]) n->next[0]->prev = n;
+    n->linked = true;
+}
+
+static void skip_unlink(account_index_t *ix, struct bal_node *n) {
+    struct bal_node *update[SKIP_MAX_LEVEL];
+    find_preds(ix, n->balance, n->id, update);
+    for (uint8_t lvl = 0; lvl < n->level && lvl < ix->level; lvl++)
+        if (update[lvl]->next[lvl] == n) update[lvl]->next[lvl] = n->next[lvl];
+    if (n->next[0]) n->next[0]->prev = n->prev;
+    n->linked = false;
+}
+
+ledger_err_t account_index_add(account_index_t *ix, uint64_t id, uint8_t type, uint32_t currency, int64_t balance) {
+    if (!ix) return LEDGER_ERR_INVALID;
+    uint64_t seg = id >> IX_SEG_SHIFT;
+    uint32_t i = (uint32_t)(id & IX_SEG_MASK);
+    if (grow_segments(ix, seg) != LEDGER_OK) return LEDGER_ERR_NOMEM;
+    /* Everything that can fail happens before either index changes. */
+    struct bal_node *n = NULL;
+    if (ix->kinds & INDEX_BALANCE) {
+        if (!ix->nodes[seg] && !(ix->nodes[seg] = calloc(IX_SEG_SLOTS, sizeof(struct bal_node *))))
+            return LEDGER_ERR_NOMEM;
+        if (ix->nodes[seg][i]) return LEDGER_ERR_INVALID;
+        uint8_t level = random_level(ix);
+        n = malloc(sizeof(struct bal_node) + level * sizeof(struct bal_node *));
+        if (!n) return LEDGER_ERR_NOMEM;
+        n->id = id;
+        n->balance = balance;
+        n->level = level;
+    }
+    if (ix->kinds & INDEX_ATTRS) {
+        struct attr_class *c = find_class(ix, type, currency, true);
+        if (c && !c->segs[seg]) c->segs[seg] = calloc(1, sizeof(struct class_segment));
+        if (!c || !c->segs[seg]) {
+            free(n);
+            return LEDGER_ERR_NOMEM;
+        }
+        struct class_segment *cs = c->segs[seg];
+        cs->words[i >> 6] |= 1ull << (i & 63);
+        cs->summary[i >> 12] |= 1ull << ((i >> 6) & 63);
+    }
+    if (n) {
+        skip_link(ix, n);
+        ix->nodes[seg][i] = n;
+    }
+    return LEDGER_OK;
+}
+
+/* A node whose new key still falls between its level-0 neighbours also
+ * stays between its neighbours on every higher level, so small balance
+ * changes are updated in place without touching the list. */
+void account_index_set_balance(account_index_t *ix, uint64_t id, int64_t balance) {
+    struct bal_node *n = ix ? node_of(ix, id) : NULL;
+    if (!n) return;
+    if (n->linked) {
+        if (n->balance == balance) return;
+        bool after_prev = !n->prev || key_less(n->prev->balance, n->prev->id, balance, id);
+        bool before_next = !n->next[0] || key_less(balance, id, n->next[0]->balance, n->next[0]->id);
+        if (after_prev && before_next) {
+            n->balance = balance;
+            return;
+        }
+        skip_unlink(ix, n);
+    }
+    n->balance = balance;
+    skip_link(ix, n);
+}
+
+void account_index_detach(account_index_t *ix, uint64_t id) {
+    struct bal_node *n = ix ? node_of(ix, id) : NULL;
+    if (n && n->linked) skip_unlink(ix, n);
+}
+
+enum { CURSOR_DONE, CURSOR_ATTRS, CURSOR_BALANCE };
+
+void index_cursor_attrs(index_cursor_t *c, const account_index_t *ix, int type, bool match_currency, uint32_t currency) {
+    memset(c, 0, sizeof(*c));
+    c->ix = ix;
+    c->kind = ix && (ix->kinds & INDEX_ATTRS) ? CURSOR_ATTRS : CURSOR_DONE;
+    c->sum_idx = -1;
+    if (c->kind == CURSOR_DONE) return;
+    for (uint32_t k = 0; k < ix->n_classes; k++) {
+        const struct attr_class *cl = &ix->classes[k];
+        if ((type < 0 || cl->type == (uint8_t)type) && (!match_currency || cl->currency == currency))
+            c->classes[k >> 6] |= 1ull << (k & 63);
+    }
+}
+
+void index_cursor_balances(index_cursor_t *c, const account_index_t *ix, int64_t min, int64_t max, bool descending) {
+    memset(c, 0, sizeof(*c));
+    c->ix = ix;
+    c->kind = ix && (ix->kinds & INDEX_BALANCE) && min <= max ? CURSOR_BALANCE : CURSOR_DONE;
+    if (c->kind == CURSOR_DONE) return;
+    c->min = min;
+    c->max = max;
+    c->descending = descending;
+    struct bal_node *update[SKIP_MAX_LEVEL];
+    if (descending) {
+        /* Last node with key <= (max, UINT64_MAX). */
+        struct bal_node *x = ix->head;
+        for (int lvl = ix->level - 1; lvl >= 0; lvl--)
+            while (x->next[lvl] && !key_less(max, UINT64_MAX, x->next[lvl]->balance, x->next[lvl]->id)) x = x->next[lvl];
+        c->node = x == ix->head ? NULL : x;
+    } else {
+        find_preds(ix, min, 0, update);
+        c->node = update[0]->next[0];
+    }
+}
+
+static uint64_t class_or(const index_cursor_t *c, bool summary, uint32_t w) {
+    const account_index_t *ix = c->ix;
+    uint64_t bits = 0;
+    for (uint32_t k = 0; k < ix->n_classes; k++) {
+        if (!((c->classes[k >> 6] >> (k & 63)) & 1)) continue;
+        const struct class_segment *cs = ix->classes[k].segs[c->seg];
+        if (cs) bits |= summary ? cs->summary[w] : cs->words[w];
+    }
+    return bits;
+}
+
+bool index_cursor_next(index_cursor_t *c, uint64_t *id, int64_t *balance) {
+    if (c->kind == CURSOR_BALANCE) {
+        const struct bal_node *n = c->node;
+        if (!n || (c->descending ? n->balance < c->min : n->balance > c->max)) {
+            c->kind = CURSOR_DONE;
+            return false;
+        }
+        c->node = c->descending ? n->prev : n->next[0];
+        *id = n->id;
+        if (balance) *balance = n->balance;
+        return true;
+    }
+    if (c->kind != CURSOR_ATTRS) return false;
+    for (;;) {
+        if (c->bits) {
+            uint32_t b = (uint32_t)__builtin_ctzll(c->bits);
+            c->bits &= c->bits - 1;
+            *id = (c->seg << IX_SEG_SHIFT) | ((uint64_t)c->word << 6) | b;
+            return true;
+        }
+        if (c->sum_bits) {
+            c->word = (uint32_t)c->sum_idx * 64 + (uint32_t)__builtin_ctzll(c->sum_bits);
+            c->sum_bits &= c->sum_bits - 1;
+            c->bits = class_or(c, false, c->word);
+            continue;
+        }
+        if (c->sum_idx + 1 < (int32_t)IX_SUMMARY) {
+            c->sum_idx++;
+            c->sum_bits = class_or(c, true, (uint32_t)c->sum_idx);
+            continue;
+        }
+        if (c->seg + 1 >= c->ix->seg_cap) {
+            c->kind = CURSOR_DONE;
+            return false;
+        }
+        c->seg++;
+        c->sum_idx = -1;
+    }
+}
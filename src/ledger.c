@@ -4,75 +4,191 @@
 #include <stdlib.h>
 #include <string.h>
 
-#define CHECKPOINT_INTERVAL 100
-#define SNAPSHOT_ENTRY_SIZE (sizeof(uint32_t) + sizeof(uint8_t) + sizeof(int64_t) + sizeof(uint64_t) + CURRENCY_LEN)
 #define CASH_ACCOUNT_ID 0u
+/* Bulk posting body: per rate, type(4) currency(4) rate_ppm(4), then for
+ * one slice of a sliced run the slice(8). */
+#define RATE_ENTRY_SIZE 12
+#define SLICE_SIZE 8
+#define ALL_SLICES UINT64_MAX
+/* Resident pages a tiered ledger writes back per checkpoint step. */
+#define CHECKPOINT_SYNC_PAGES 16
+
+struct replay_ctx {
+    account_store_t **store_ptr;
+    uint64_t *next_tx_id;
+    transaction_t *pending; /* reused for every replayed transaction */
+    bool pending_active;
+    uint64_t pending_tx_id;
+    uint64_t skipped_postings;
+    uint64_t records; /* replayed since the restored checkpoint */
+    uint64_t ops;     /* of them, those that count toward the checkpoint interval */
+};
 
 struct ledger {
     account_store_t *store;
     wal_t *wal;
     uint64_t next_tx_id;
     uint64_t ops_since_checkpoint;
+    bool read_only;
+    bool failed; /* read-only after a write failure, never a follower */
+    bool tiered;
+    struct replay_ctx follow; /* follower: staged transaction carried across polls */
+    transaction_t *tx;        /* reused by every transfer */
+    uint8_t *checkpoint_buf;  /* grows with the store, reused by every checkpoint */
+    size_t checkpoint_cap;
+    /* Sliced checkpoints: run by ledger_checkpoint_step(), never inline. */
+    bool sliced;
+    bool checkpointing; /* one is under way */
+    uint64_t checkpoint_lsn; /* where the log stood when it began */
+    size_t checkpoint_len;
+    size_t checkpoint_logged; /* bytes of the snapshot already in the log */
+    uint64_t sync_cursor;     /* tiered: next resident page to write back */
+    uint64_t skipped_postings; /* bulk frames replay could not reproduce */
+    uint64_t replayed_records; /* by the last recovery, after its checkpoint */
+    /* Legs committed by the open group commit, to reverse if its flush
+     * fails; NULL outside ledger_transfer_batch(). */
+    journal_entry_t *group_legs;
+    size_t group_n;
+    journal_entry_t *legs_buf;
+    size_t legs_cap;
 };
 
-struct replay_ctx {
-    account_store_t **store_ptr;
-    uint64_t *next_tx_id;
-};
+/* Memory and log may disagree after a failed write; stop taking writes so
+ * nothing more is built on that state. Reopening recovers from the log. */
+static void fail_stop(ledger_t *l) {
+    l->read_only = true;
+    l->failed = true;
+}
+
+/* Returns *slot re-armed for tx_id, allocating it only the first time. */
+static transaction_t *reuse_tx(transaction_t **slot, account_store_t *store, uint64_t tx_id) {
+    if (!*slot) return *slot = transaction_begin(store, tx_id);
+    return transaction_reset(*slot, store, tx_id) == LEDGER_OK ? *slot : NULL;
+}
+
+static size_t encode_rates(const account_rate_t *rates, size_t n, uint64_t slice, uint8_t *buf) {
+    for (size_t k = 0; k < n; k++) {
+        uint32_t type = (uint32_t)rates[k].type;
+        memcpy(buf + k * RATE_ENTRY_SIZE, &type, 4);
+        memcpy(buf + k * RATE_ENTRY_SIZE + 4, rates[k].currency, CURRENCY_LEN);
+        memcpy(buf + k * RATE_ENTRY_SIZE + 8, &rates[k].rate_ppm, 4);
+    }
+    if (slice == ALL_SLICES) return n * RATE_ENTRY_SIZE;
+    memcpy(buf + n * RATE_ENTRY_SIZE, &slice, SLICE_SIZE);
+    return n * RATE_ENTRY_SIZE + SLICE_SIZE;
+}
+
+static size_t decode_rates(const uint8_t *buf, size_t len, account_rate_t *rates, uint64_t *slice) {
+    *slice = ALL_SLICES;
+    if (len % RATE_ENTRY_SIZE == SLICE_SIZE) {
+        len -= SLICE_SIZE;
+        memcpy(slice, buf + len, SLICE_SIZE);
+    }
+    size_t n = len / RATE_ENTRY_SIZE;
+    if (n > ACCOUNT_MAX_RATES) n = ACCOUNT_MAX_RATES;
+    for (size_t k = 0; k < n; k++) {
+        uint32_t type;
+        memcpy(&type, buf + k * RATE_ENTRY_SIZE, 4);
+        rates[k].type = (account_type_t)type;
+        memcpy(rates[k].currency, buf + k * RATE_ENTRY_SIZE + 4, CURRENCY_LEN);
+        memcpy(&rates[k].rate_ppm, buf + k * RATE_ENTRY_SIZE + 8, 4);
+    }
+    return n;
+}
+
+static ledger_err_t sum_postings(account_store_t *s, const account_rate_t *rates, size_t n, uint64_t contra_id,
+                                 uint64_t slice, int64_t *total) {
+    if (slice == ALL_SLICES) return account_sum_postings(s, rates, n, contra_id, total);
+    return account_sum_postings_slice(s, rates, n, contra_id, slice, total);
+}
+
+static ledger_err_t apply_postings(account_store_t *s, const account_rate_t *rates, size_t n, uint64_t contra_id,
+                                   uint64_t slice, uint64_t version, int64_t total) {
+    if (slice == ALL_SLICES) return account_apply_postings(s, rates, n, contra_id, version, total);
+    return account_apply_postings_slice(s, rates, n, contra_id, slice, version, total);
+}
 
-static int replay_cb(wal_op_t op, uint64_t tx_id, uint32_t account_id, int64_t amount,
-                     account_type_t acct_type, const char *currency, void *ctx) {
+static int replay_cb(const wal_entry_t *e, void *ctx) {
     struct replay_ctx *rctx = (struct replay_ctx *)ctx;
     account_store_t *s = *rctx->store_ptr;
-    switch (op) {
+    rctx->records++;
+    if (e->op == WAL_COMMIT || e->op == WAL_ABORT || e->op == WAL_CREATE_ACCOUNT || e->op == WAL_BULK_POSTING)
+        rctx->ops++;
+    switch (e->op) {
         case WAL_BEGIN_TX:
-            if (*rctx->next_tx_id <= tx_id) *rctx->next_tx_id = tx_id + 1;
+            if (*rctx->next_tx_id <= e->tx_id) *rctx->next_tx_id = e->tx_id + 1;
+            rctx->pending_active = reuse_tx(&rctx->pending, s, e->tx_id) != NULL;
+            rctx->pending_tx_id = e->tx_id;
+            if (!rctx->pending_active) return LEDGER_ERR_NOMEM;
             break;
-        case WAL_CREATE_ACCOUNT: {
-            uint32_t id;
-            if (account_create(s, (account_type_t)acct_type, currency ? currency : "USD", &id) != LEDGER_OK)
+        case WAL_CREATE_ACCOUNT:
+            if (account_create_with_id(s, e->account_id, e->acct_type, e->currency ? e->currency : "USD") != LEDGER_OK)
                 return LEDGER_ERR_IO;
             break;
-        }
+        /* Legs are staged until COMMIT so aborted or torn transactions leave
+         * the store untouched, exactly as they did at runtime. */
         case WAL_DEBIT:
-            account_apply_delta(s, account_id, -amount, tx_id);
+            if (rctx->pending_active) transaction_credit(rctx->pending, e->account_id, e->amount);
             break;
         case WAL_CREDIT:
-            account_apply_delta(s, account_id, amount, tx_id);
+            if (rctx->pending_active) transaction_debit(rctx->pending, e->account_id, e->amount);
             break;
         case WAL_COMMIT:
+            if (rctx->pending_active) transaction_commit(rctx->pending);
+            /* fall through */
         case WAL_ABORT:
+            rctx->pending_active = false;
+            break;
+        /* The frame is its own commit. Postings are re-derived from the rate
+         * table against the replayed balances. The writer checked the total
+         * before logging it, so a frame that no longer reproduces it (an
+         * edited log, a changed posting rule) is skipped and counted rather
+         * than applied or allowed to stop recovery. */
+        case WAL_BULK_POSTING: {
+            account_rate_t rates[ACCOUNT_MAX_RATES];
+            uint64_t slice;
+            size_t n = decode_rates(e->payload, e->payload_len, rates, &slice);
+            int64_t total;
+            if (*rctx->next_tx_id <= e->tx_id) *rctx->next_tx_id = e->tx_id + 1;
+            if (sum_postings(s, rates, n, e->account_id, slice, &total) != LEDGER_OK || total != e->amount) {
+                rctx->skipped_postings++;
+                break;
+            }
+            if (apply_postings(s, rates, n, e->account_id, slice, e->tx_id, e->amount) != LEDGER_OK)
+                return LEDGER_ERR_IO;
             break;
+        }
         default:
             break;
     }
     return 0;
 }
 
-static int checkpoint_restore_cb(const void *snapshot, size_t len, void *ctx) {
+static int checkpoint_restore_cb(const void *snapshot, size_t len, bool external, void *ctx) {
     struct replay_ctx *rctx = (struct replay_ctx *)ctx;
-    account_store_destroy(*rctx->store_ptr);
-    *rctx->store_ptr = account_store_create();
-    if (!*rctx->store_ptr) return LEDGER_ERR_NOMEM;
     account_store_t *s = *rctx->store_ptr;
+    rctx->records = 0;
+    rctx->ops = 0;
+    if (external) return account_page_restore(s, snapshot, len, rctx->next_tx_id);
+    account_store_clear(s);
     const uint8_t *p = (const uint8_t *)snapshot;
-    uint32_t next_id, count;
-    if (len < 8) return LEDGER_ERR_IO;
-    memcpy(&next_id, p, 4);
-    memcpy(&count, p + 4, 4);
-    p += 8;
-    for (uint32_t i = 0; i < count && (size_t)(p - (const uint8_t *)snapshot) + SNAPSHOT_ENTRY_SIZE <= len; i++) {
-        uint32_t id;
+    uint64_t next_id, count;
+    if (len < ACCOUNT_SNAPSHOT_HEADER_SIZE) return LEDGER_ERR_IO;
+    memcpy(&next_id, p, 8);
+    memcpy(&count, p + 8, 8);
+    p += ACCOUNT_SNAPSHOT_HEADER_SIZE;
+    for (uint64_t i = 0; i < count && (size_t)(p - (const uint8_t *)snapshot) + ACCOUNT_SNAPSHOT_ENTRY_SIZE <= len; i++) {
+        uint64_t id;
         uint8_t type;
         int64_t balance;
         uint64_t version;
         char currency[CURRENCY_LEN];
-        memcpy(&id, p, 4);
-        memcpy(&type, p + 4, 1);
-        memcpy(&balance, p + 8, 8);
-        memcpy(&version, p + 16, 8);
-        memcpy(currency, p + 24, CURRENCY_LEN);
-        p += SNAPSHOT_ENTRY_SIZE;
+        memcpy(&id, p, 8);
+        memcpy(&type, p + 8, 1);
+        memcpy(currency, p + 12, CURRENCY_LEN);
+        memcpy(&balance, p + 16, 8);
+        memcpy(&version, p + 24, 8);
+        p += ACCOUNT_SNAPSHOT_ENTRY_SIZE;
         if (account_create_with_id(s, id, (account_type_t)type, currency) != LEDGER_OK) return LEDGER_ERR_IO;
         account_set_balance(s, id, balance, version);
     }
@@ -80,54 +196,178 @@ static int checkpoint_restore_cb(const void *snapshot, size_t len, void *ctx) {
     return 0;
 }
 
-static ledger_err_t maybe_checkpoint(ledger_t *l) {
-    l->ops_since_checkpoint++;
-    if (l->ops_since_checkpoint < CHECKPOINT_INTERVAL) return LEDGER_OK;
-    size_t cap = 8 + (size_t)account_count(l->store) * SNAPSHOT_ENTRY_SIZE;
-    void *buf = malloc(cap);
-    if (!buf) return LEDGER_OK;
+static bool reserve_checkpoint(ledger_t *l, size_t cap) {
+    if (cap <= l->checkpoint_cap) return true;
+    size_t new_cap = l->checkpoint_cap ? l->checkpoint_cap : 4096;
+    while (new_cap < cap) new_cap *= 2;
+    uint8_t *n = realloc(l->checkpoint_buf, new_cap);
+    if (!n) return false;
+    l->checkpoint_buf = n;
+    l->checkpoint_cap = new_cap;
+    return true;
+}
+
+/* A tiered store is not snapshotted into the WAL, since that would read
+ * every evicted page back each interval. Its checkpoint syncs the page file
+ * and logs a page checkpoint naming the slot of every page; only once that
+ * is synced to disk does the store stop preserving the previous slots. */
+static ledger_err_t page_checkpoint(ledger_t *l) {
+    size_t len;
+    if (!reserve_checkpoint(l, account_page_checkpoint_size(l->store))) return LEDGER_OK;
+    ledger_err_t err = account_page_checkpoint(l->store, l->next_tx_id, l->checkpoint_buf, l->checkpoint_cap, &len);
+    if (err == LEDGER_OK) err = wal_checkpoint_external(l->wal, l->checkpoint_buf, len);
+    if (err == LEDGER_OK) account_page_checkpoint_commit(l->store);
+    return err;
+}
+
+static ledger_err_t checkpoint_if_due(ledger_t *l) {
+    /* Inside a group commit the checkpoint waits for the group's flush: its
+     * own flush would expose half a batch, and its snapshot would hold
+     * transfers that may yet be reversed. */
+    if (l->ops_since_checkpoint < LEDGER_CHECKPOINT_INTERVAL || l->group_legs || l->sliced) return LEDGER_OK;
+    l->ops_since_checkpoint = 0;
     size_t len;
-    if (account_serialize(l->store, (uint32_t)l->next_tx_id, buf, cap, &len) == LEDGER_OK && len > 0)
-        wal_checkpoint(l->wal, buf, len);
-    free(buf);
+    if (l->tiered) return page_checkpoint(l);
+    if (!reserve_checkpoint(l, ACCOUNT_SNAPSHOT_HEADER_SIZE + (size_t)account_count(l->store) * ACCOUNT_SNAPSHOT_ENTRY_SIZE))
+        return LEDGER_OK;
+    if (account_serialize(l->store, l->next_tx_id, l->checkpoint_buf, l->checkpoint_cap, &len) == LEDGER_OK && len > 0)
+        wal_checkpoint(l->wal, l->checkpoint_buf, len);
+    return LEDGER_OK;
+}
+
+/* Begins a sliced checkpoint. The snapshot is of the state at the current
+ * end of the log, which is where recovery replays from. */
+static ledger_err_t checkpoint_begin(ledger_t *l) {
+    l->sync_cursor = 0;
+    if (!l->tiered) {
+        size_t cap = ACCOUNT_SNAPSHOT_HEADER_SIZE + (size_t)account_count(l->store) * ACCOUNT_SNAPSHOT_ENTRY_SIZE;
+        if (!reserve_checkpoint(l, cap)) return LEDGER_ERR_NOMEM;
+        ledger_err_t err = account_snapshot_begin(l->store, l->next_tx_id, l->checkpoint_buf, l->checkpoint_cap,
+                                                  &l->checkpoint_len);
+        if (err != LEDGER_OK) return err;
+        l->checkpoint_lsn = wal_end_lsn(l->wal);
+        l->checkpoint_logged = 0;
+    }
     l->ops_since_checkpoint = 0;
+    l->checkpointing = true;
     return LEDGER_OK;
 }
 
+/* Logs what the snapshot has ready, then the end frame once all of it is. */
+static ledger_err_t checkpoint_slice(ledger_t *l) {
+    size_t ready;
+    ledger_err_t err = account_snapshot_step(l->store, &ready);
+    if (err == LEDGER_OK && ready > l->checkpoint_logged) {
+        err = wal_checkpoint_part(l->wal, l->checkpoint_buf + l->checkpoint_logged, ready - l->checkpoint_logged);
+        if (err == LEDGER_OK) l->checkpoint_logged = ready;
+    }
+    if (err == LEDGER_OK && l->checkpoint_logged == l->checkpoint_len) {
+        err = wal_checkpoint_end(l->wal, l->checkpoint_lsn, l->checkpoint_len);
+        account_snapshot_end(l->store);
+        l->checkpointing = false;
+    }
+    return err;
+}
+
+void ledger_set_sliced_checkpoints(ledger_t *l, bool on) {
+    if (!l) return;
+    if (!on && l->checkpointing) {
+        /* Parts already logged without an end frame are never restored. */
+        account_snapshot_end(l->store);
+        l->checkpointing = false;
+    }
+    l->sliced = on;
+}
+
+ledger_err_t ledger_checkpoint_step(ledger_t *l, bool *more) {
+    if (!l || !more) return LEDGER_ERR_INVALID;
+    *more = false;
+    if (!l->sliced || l->read_only || l->group_legs) return LEDGER_ERR_INVALID;
+    ledger_err_t err = LEDGER_OK;
+    if (!l->checkpointing) {
+        if (l->ops_since_checkpoint >= LEDGER_CHECKPOINT_INTERVAL) err = checkpoint_begin(l);
+    } else if (l->tiered) {
+        bool swept;
+        err = account_store_sync_some(l->store, &l->sync_cursor, CHECKPOINT_SYNC_PAGES, &swept);
+        if (err != LEDGER_OK || swept) l->checkpointing = false;
+        if (err == LEDGER_OK && swept) err = page_checkpoint(l);
+    } else if ((err = checkpoint_slice(l)) != LEDGER_OK) {
+        /* A part or end frame cut short would leave damage mid-log. */
+        account_snapshot_end(l->store);
+        l->checkpointing = false;
+        fail_stop(l);
+        err = LEDGER_ERR_IO;
+    }
+    *more = l->checkpointing || l->ops_since_checkpoint >= LEDGER_CHECKPOINT_INTERVAL;
+    return err;
+}
+
+static ledger_err_t maybe_checkpoint(ledger_t *l) {
+    l->ops_since_checkpoint++;
+    return checkpoint_if_due(l);
+}
+
 static ledger_err_t ensure_cash_account(ledger_t *l) {
     account_t a;
     if (account_get(l->store, CASH_ACCOUNT_ID, &a) == LEDGER_OK) return LEDGER_OK;
     ledger_err_t err = account_create_with_id(l->store, CASH_ACCOUNT_ID, ACCT_CHECKING, "USD");
     if (err != LEDGER_OK) return err;
-    wal_append(l->wal, WAL_CREATE_ACCOUNT, 0, 0, 0, ACCT_CHECKING, "USD");
+    if (wal_append(l->wal, WAL_CREATE_ACCOUNT, 0, CASH_ACCOUNT_ID, 0, ACCT_CHECKING, "USD") != LEDGER_OK) {
+        fail_stop(l);
+        return LEDGER_ERR_IO;
+    }
     return LEDGER_OK;
 }
 
-static ledger_err_t do_transfer(ledger_t *l, uint32_t from_id, uint32_t to_id, int64_t amount_cents) {
-    if (amount_cents <= 0) return LEDGER_ERR_INVALID;
+/* Reverses committed legs, newest first, restoring the versions they
+ * replaced. */
+static void revert_legs(account_store_t *s, const journal_entry_t *legs, size_t n) {
+    while (n-- > 0) {
+        int64_t applied = legs[n].is_debit ? legs[n].amount_cents : -(int64_t)legs[n].amount_cents;
+        account_revert_delta(s, legs[n].account_id, applied, legs[n].prev_version);
+    }
+}
+
+static ledger_err_t do_transfer(ledger_t *l, uint64_t from_id, uint64_t to_id, int64_t amount_cents) {
+    if (amount_cents <= 0 || l->read_only) return LEDGER_ERR_INVALID;
     uint64_t tx_id = l->next_tx_id++;
-    wal_begin_tx(l->wal, tx_id);
-    wal_append(l->wal, WAL_DEBIT, tx_id, from_id, amount_cents, ACCT_CHECKING, NULL);
-    wal_append(l->wal, WAL_CREDIT, tx_id, to_id, amount_cents, ACCT_CHECKING, NULL);
-    transaction_t *tx = transaction_begin(l->store, tx_id);
+    if (wal_begin_tx(l->wal, tx_id) != LEDGER_OK ||
+        wal_append(l->wal, WAL_DEBIT, tx_id, from_id, amount_cents, ACCT_CHECKING, NULL) != LEDGER_OK ||
+        wal_append(l->wal, WAL_CREDIT, tx_id, to_id, amount_cents, ACCT_CHECKING, NULL) != LEDGER_OK) {
+        fail_stop(l);
+        return LEDGER_ERR_IO;
+    }
+    transaction_t *tx = reuse_tx(&l->tx, l->store, tx_id);
     if (!tx) {
         wal_abort(l->wal, tx_id);
+        maybe_checkpoint(l);
         return LEDGER_ERR_NOMEM;
     }
     transaction_credit(tx, from_id, amount_cents);
     transaction_debit(tx, to_id, amount_cents);
     ledger_err_t err = transaction_commit(tx);
-    transaction_destroy(tx);
     if (err != LEDGER_OK) {
+        /* Refused transfers are logged too and count toward the interval. */
         wal_abort(l->wal, tx_id);
+        maybe_checkpoint(l);
         return err;
     }
-    wal_commit(l->wal, tx_id);
+    size_t n_legs;
+    const journal_entry_t *legs = transaction_entries(tx, &n_legs);
+    if (wal_commit(l->wal, tx_id) != LEDGER_OK) {
+        revert_legs(l->store, legs, n_legs);
+        fail_stop(l);
+        return LEDGER_ERR_IO;
+    }
+    if (l->group_legs) {
+        memcpy(l->group_legs + l->group_n, legs, n_legs * sizeof(journal_entry_t));
+        l->group_n += n_legs;
+    }
     maybe_checkpoint(l);
     return LEDGER_OK;
 }
 
-ledger_t *ledger_open(const char *wal_path) {
+static ledger_t *open_primary(const char *wal_path, const char *page_path, uint64_t max_resident_accounts) {
     if (!wal_path) return NULL;
     ledger_t *l = calloc(1, sizeof(ledger_t));
     if (!l) return NULL;
@@ -136,83 +376,366 @@ ledger_t *ledger_open(const char *wal_path) {
         free(l);
         return NULL;
     }
+    if (page_path) {
+        if (account_store_enable_tiering(l->store, page_path, max_resident_accounts) != LEDGER_OK) {
+            account_store_destroy(l->store);
+            free(l);
+            return NULL;
+        }
+        l->tiered = true;
+    }
     l->wal = wal_open(wal_path);
     if (!l->wal) {
         account_store_destroy(l->store);
         free(l);
         return NULL;
     }
-    struct replay_ctx rctx = { .store_ptr = &l->store, .next_tx_id = &l->next_tx_id };
+    if (l->tiered) wal_use_external_checkpoints(l->wal);
+    struct replay_ctx rctx = { .store_ptr = &l->store, .next_tx_id = &l->next_tx_id, .pending = NULL };
     ledger_err_t err = wal_replay(l->wal, replay_cb, checkpoint_restore_cb, &rctx);
+    l->tx = rctx.pending;
+    l->skipped_postings = rctx.skipped_postings;
+    l->replayed_records = rctx.records;
+    /* Resume the interval where the log left it, so repeated reopens cannot
+     * let the log grow past the checkpoint without bound. */
+    l->ops_since_checkpoint = rctx.ops;
     if (err != LEDGER_OK) {
-        wal_close(l->wal);
-        account_store_destroy(l->store);
-        free(l);
+        ledger_close(l);
         return NULL;
     }
     err = ensure_cash_account(l);
+    if (err == LEDGER_OK) err = account_set_striped(l->store, CASH_ACCOUNT_ID, true);
     if (err != LEDGER_OK) {
-        wal_close(l->wal);
+        ledger_close(l);
+        return NULL;
+    }
+    return l;
+}
+
+ledger_t *ledger_open(const char *wal_path) {
+    return open_primary(wal_path, NULL, 0);
+}
+
+ledger_t *ledger_open_tiered(const char *wal_path, const char *page_path, uint64_t max_resident_accounts) {
+    if (!page_path) return NULL;
+    return open_primary(wal_path, page_path, max_resident_accounts);
+}
+
+ledger_t *ledger_open_follower(const char *wal_path) {
+    if (!wal_path) return NULL;
+    ledger_t *l = calloc(1, sizeof(ledger_t));
+    if (!l) return NULL;
+    l->store = account_store_create();
+    l->wal = l->store ? wal_open_follower(wal_path) : NULL;
+    if (!l->wal) {
         account_store_destroy(l->store);
         free(l);
         return NULL;
     }
+    l->read_only = true;
+    l->follow = (struct replay_ctx){ .store_ptr = &l->store, .next_tx_id = &l->next_tx_id, .pending = NULL };
+    if (ledger_follower_poll(l, NULL) != LEDGER_OK) {
+        ledger_close(l);
+        return NULL;
+    }
     return l;
 }
 
+/* The follower reads the log from the start, so inline checkpoints carry
+ * nothing it has not already applied and their payloads are skipped. */
+ledger_err_t ledger_follower_poll(ledger_t *l, uint64_t *applied_lsn) {
+    if (!l || !l->read_only || l->failed) return LEDGER_ERR_INVALID;
+    ledger_err_t err = wal_tail(l->wal, replay_cb, NULL, &l->follow);
+    if (applied_lsn) *applied_lsn = wal_read_lsn(l->wal);
+    return err;
+}
+
+ledger_err_t ledger_replication_lag(ledger_t *l, uint64_t *lag_lsn) {
+    if (!l || !lag_lsn || !l->read_only || l->failed) return LEDGER_ERR_INVALID;
+    uint64_t end = wal_end_lsn(l->wal), applied = wal_read_lsn(l->wal);
+    *lag_lsn = end > applied ? end - applied : 0;
+    return LEDGER_OK;
+}
+
+ledger_err_t ledger_promote(ledger_t *l) {
+    if (!l || !l->read_only || l->failed) return LEDGER_ERR_INVALID;
+    ledger_err_t err = ledger_follower_poll(l, NULL);
+    if (err != LEDGER_OK) return err;
+    err = wal_promote(l->wal);
+    if (err != LEDGER_OK) return err;
+    l->read_only = false;
+    if (l->follow.pending_active) {
+        l->follow.pending_active = false;
+        if (wal_abort(l->wal, l->follow.pending_tx_id) != LEDGER_OK) {
+            fail_stop(l);
+            return LEDGER_ERR_IO;
+        }
+    }
+    err = ensure_cash_account(l);
+    if (err == LEDGER_OK) err = account_set_striped(l->store, CASH_ACCOUNT_ID, true);
+    return err;
+}
+
 void ledger_close(ledger_t *l) {
     if (!l) return;
+    transaction_destroy(l->follow.pending);
+    transaction_destroy(l->tx);
+    free(l->checkpoint_buf);
+    free(l->legs_buf);
     wal_close(l->wal);
     account_store_destroy(l->store);
     free(l);
 }
 
-ledger_err_t ledger_create_account(ledger_t *l, account_type_t type, const char *currency, uint32_t *out_id) {
-    if (!l || !out_id) return LEDGER_ERR_INVALID;
+ledger_err_t ledger_create_account(ledger_t *l, account_type_t type, const char *currency, uint64_t *out_id) {
+    if (!l || !out_id || l->read_only) return LEDGER_ERR_INVALID;
     ledger_err_t err = account_create(l->store, type, currency ? currency : "USD", out_id);
     if (err != LEDGER_OK) return err;
-    wal_append(l->wal, WAL_CREATE_ACCOUNT, 0, 0, 0, type, currency ? currency : "USD");
+    /* As with a transfer, the account must not outlive a failed log write. */
+    if (wal_append(l->wal, WAL_CREATE_ACCOUNT, 0, *out_id, 0, type, currency ? currency : "USD") != LEDGER_OK) {
+        fail_stop(l);
+        return LEDGER_ERR_IO;
+    }
     maybe_checkpoint(l);
     return LEDGER_OK;
 }
 
-ledger_err_t ledger_deposit(ledger_t *l, uint32_t account_id, int64_t amount_cents) {
-    if (!l || amount_cents <= 0) return LEDGER_ERR_INVALID;
+ledger_err_t ledger_deposit(ledger_t *l, uint64_t account_id, int64_t amount_cents) {
+    if (!l || amount_cents <= 0 || l->read_only) return LEDGER_ERR_INVALID;
     ledger_err_t err = ensure_cash_account(l);
     if (err != LEDGER_OK) return err;
     return do_transfer(l, CASH_ACCOUNT_ID, account_id, amount_cents);
 }
 
-ledger_err_t ledger_withdraw(ledger_t *l, uint32_t account_id, int64_t amount_cents) {
-    if (!l || amount_cents <= 0) return LEDGER_ERR_INVALID;
+ledger_err_t ledger_withdraw(ledger_t *l, uint64_t account_id, int64_t amount_cents) {
+    if (!l || amount_cents <= 0 || l->read_only) return LEDGER_ERR_INVALID;
     ledger_err_t err = ensure_cash_account(l);
     if (err != LEDGER_OK) return err;
     return do_transfer(l, account_id, CASH_ACCOUNT_ID, amount_cents);
 }
 
-ledger_err_t ledger_transfer(ledger_t *l, uint32_t from_id, uint32_t to_id, int64_t amount_cents) {
+ledger_err_t ledger_transfer(ledger_t *l, uint64_t from_id, uint64_t to_id, int64_t amount_cents) {
     if (!l) return LEDGER_ERR_INVALID;
     return do_transfer(l, from_id, to_id, amount_cents);
 }
 
-ledger_err_t ledger_balance(ledger_t *l, uint32_t account_id, int64_t *balance_cents) {
+ledger_err_t ledger_transfer_batch(ledger_t *l, const ledger_transfer_t *xfers, size_t n, ledger_err_t *results) {
+    if (!l || !results || (n > 0 && !xfers)) return LEDGER_ERR_INVALID;
+    ledger_err_t err = l->read_only ? LEDGER_ERR_INVALID : ensure_cash_account(l);
+    if (err != LEDGER_OK) {
+        for (size_t i = 0; i < n; i++) results[i] = err;
+        return err;
+    }
+    /* Two legs per transfer; the buffer is kept, so steady state does not allocate. */
+    if (2 * n > l->legs_cap) {
+        journal_entry_t *legs = realloc(l->legs_buf, 2 * n * sizeof(journal_entry_t));
+        if (!legs) {
+            for (size_t i = 0; i < n; i++) results[i] = LEDGER_ERR_NOMEM;
+            return LEDGER_ERR_NOMEM;
+        }
+        l->legs_buf = legs;
+        l->legs_cap = 2 * n;
+    }
+    l->group_legs = l->legs_buf;
+    l->group_n = 0;
+    wal_group_begin(l->wal);
+    for (size_t i = 0; i < n; i++) results[i] = do_transfer(l, xfers[i].from_id, xfers[i].to_id, xfers[i].amount_cents);
+    err = wal_group_end(l->wal);
+    l->group_legs = NULL;
+    /* Some of the group may have reached the log before the failure, so
+     * neither memory nor the log is known to be right: reverse the batch in
+     * memory so nothing unflushed is served, and stop taking writes. */
+    if (err != LEDGER_OK || l->failed) {
+        revert_legs(l->store, l->legs_buf, l->group_n);
+        fail_stop(l);
+        err = LEDGER_ERR_IO;
+        for (size_t i = 0; i < n; i++)
+            if (results[i] == LEDGER_OK) results[i] = err;
+        return err;
+    }
+    checkpoint_if_due(l);
+    return LEDGER_OK;
+}
+
+ledger_err_t ledger_balance(ledger_t *l, uint64_t account_id, int64_t *balance_cents) {
     if (!l || !balance_cents) return LEDGER_ERR_INVALID;
+    /* The batched path reads only the hot columns, unlike account_get(). */
+    return account_balance_many(l->store, &account_id, 1, balance_cents, NULL);
+}
+
+ledger_err_t ledger_balance_many(ledger_t *l, const uint64_t *ids, size_t n, int64_t *out, ledger_err_t *errs) {
+    if (!l) return LEDGER_ERR_INVALID;
+    return account_balance_many(l->store, ids, n, out, errs);
+}
+
+static ledger_err_t post_periodic(ledger_t *l, const account_rate_t *rates, size_t n_rates, uint64_t contra_id,
+                                  uint64_t slice, int64_t *out_total_cents) {
+    if (!l || l->read_only || n_rates > ACCOUNT_MAX_RATES) return LEDGER_ERR_INVALID;
+    int64_t total;
+    ledger_err_t err = sum_postings(l->store, rates, n_rates, contra_id, slice, &total);
+    if (err != LEDGER_OK) return err;
+    if (out_total_cents) *out_total_cents = total;
+    if (total == 0) return LEDGER_OK;
+    uint8_t body[ACCOUNT_MAX_RATES * RATE_ENTRY_SIZE + SLICE_SIZE];
+    uint64_t tx_id = l->next_tx_id++;
+    /* Everything that can be refused was checked by the sum; the frame is
+     * written only then. The apply cannot fail except on page-file I/O. */
+    err = wal_bulk_posting(l->wal, tx_id, contra_id, total, body, encode_rates(rates, n_rates, slice, body));
+    if (err == LEDGER_OK) err = apply_postings(l->store, rates, n_rates, contra_id, slice, tx_id, total);
+    if (err != LEDGER_OK) {
+        fail_stop(l);
+        return err;
+    }
+    maybe_checkpoint(l);
+    return LEDGER_OK;
+}
+
+ledger_err_t ledger_post_periodic(ledger_t *l, const account_rate_t *rates, size_t n_rates, uint64_t contra_id,
+                                  int64_t *out_total_cents) {
+    return post_periodic(l, rates, n_rates, contra_id, ALL_SLICES, out_total_cents);
+}
+
+ledger_err_t ledger_post_periodic_slice(ledger_t *l, const account_rate_t *rates, size_t n_rates, uint64_t contra_id,
+                                        uint64_t slice, int64_t *out_total_cents) {
+    if (slice == ALL_SLICES) return LEDGER_ERR_INVALID;
+    return post_periodic(l, rates, n_rates, contra_id, slice, out_total_cents);
+}
+
+uint64_t ledger_posting_slices(ledger_t *l) {
+    return l ? account_posting_slices(l->store) : 0;
+}
+
+ledger_err_t ledger_prefetch(ledger_t *l, const uint64_t *ids, size_t n) {
+    if (!l) return LEDGER_ERR_INVALID;
+    return account_prefetch(l->store, ids, n);
+}
+
+ledger_err_t ledger_tier_stats(ledger_t *l, account_tier_stats_t *out) {
+    if (!l || !out) return LEDGER_ERR_INVALID;
+    account_tier_stats(l->store, out);
+    return LEDGER_OK;
+}
+
+ledger_err_t ledger_enable_indexes(ledger_t *l, unsigned kinds) {
+    if (!l) return LEDGER_ERR_INVALID;
+    return account_store_enable_index(l->store, kinds);
+}
+
+ledger_err_t ledger_query_attrs(ledger_t *l, account_iter_t *it, int type, const char *currency) {
+    if (!l) return LEDGER_ERR_INVALID;
+    return account_iter_attrs(l->store, it, type, currency);
+}
+
+ledger_err_t ledger_query_balances(ledger_t *l, account_iter_t *it, int64_t min_cents, int64_t max_cents,
+                                   bool descending) {
+    if (!l) return LEDGER_ERR_INVALID;
+    return account_iter_balances(l->store, it, min_cents, max_cents, descending);
+}
+
+struct history {
+    uint64_t account_id;
+    uint64_t tx_id;
+    int64_t credits, debits;
+    size_t count;
+    int64_t tx_credits, tx_debits; /* the open transaction's legs */
+    size_t tx_count;
+};
+
+/* Legs count once their transaction commits, as in replay. */
+static int history_cb(const wal_entry_t *e, void *ctx) {
+    struct history *h = ctx;
+    switch (e->op) {
+        case WAL_BEGIN_TX:
+            h->tx_id = e->tx_id;
+            h->tx_credits = h->tx_debits = 0;
+            h->tx_count = 0;
+            break;
+        case WAL_DEBIT:
+        case WAL_CREDIT:
+            if (e->tx_id != h->tx_id || e->account_id != h->account_id) break;
+            if (e->op == WAL_DEBIT)
+                h->tx_debits += e->amount;
+            else
+                h->tx_credits += e->amount;
+            h->tx_count++;
+            break;
+        case WAL_COMMIT:
+            if (e->tx_id != h->tx_id) break;
+            h->credits += h->tx_credits;
+            h->debits += h->tx_debits;
+            h->count += h->tx_count;
+            /* fall through */
+        case WAL_ABORT:
+            h->tx_credits = h->tx_debits = 0;
+            h->tx_count = 0;
+            break;
+        case WAL_BULK_POSTING:
+            if (e->account_id != h->account_id) break;
+            if (e->amount > 0)
+                h->debits += e->amount;
+            else
+                h->credits -= e->amount;
+            h->count++;
+            break;
+        default:
+            break;
+    }
+    return 0;
+}
+
+ledger_err_t ledger_history(ledger_t *l, uint64_t account_id, int64_t *out_credits, int64_t *out_debits, size_t *count) {
+    if (!l) return LEDGER_ERR_INVALID;
     account_t a;
     ledger_err_t err = account_get(l->store, account_id, &a);
     if (err != LEDGER_OK) return err;
-    *balance_cents = a.balance_cents;
+    struct history h = { .account_id = account_id, .tx_id = UINT64_MAX };
+    err = wal_scan(l->wal, history_cb, &h);
+    if (err != LEDGER_OK) return err;
+    if (out_credits) *out_credits = h.credits;
+    if (out_debits) *out_debits = h.debits;
+    if (count) *count = h.count;
     return LEDGER_OK;
 }
 
-ledger_err_t ledger_history(ledger_t *l, uint32_t account_id, int64_t *out_credits, int64_t *out_debits, size_t *count) {
-    (void)l;
-    (void)account_id;
-    (void)out_credits;
-    (void)out_debits;
-    if (count) *count = 0;
-    return LEDGER_OK;
+uint64_t ledger_skipped_postings(ledger_t *l) {
+    return l ? l->skipped_postings : 0;
+}
+
+uint64_t ledger_replayed_records(ledger_t *l) {
+    return l ? l->replayed_records : 0;
 }
 
 uint64_t ledger_next_tx_id(ledger_t *l) {
     return l ? l->next_tx_id : 0;
 }
+
+ledger_err_t ledger_set_hot_account(ledger_t *l, uint64_t account_id, bool striped) {
+    if (!l) return LEDGER_ERR_INVALID;
+    return account_set_striped(l->store, account_id, striped);
+}
+
+ledger_err_t ledger_sum_by_currency(ledger_t *l, const char *currency, int64_t *out_cents) {
+    if (!l || !currency || !out_cents) return LEDGER_ERR_INVALID;
+    return account_sum_by_currency(l->store, currency, out_cents);
+}
+
+ledger_err_t ledger_sum_by_type(ledger_t *l, account_type_t type, int64_t *out_cents) {
+    if (!l || !out_cents) return LEDGER_ERR_INVALID;
+    return account_sum_by_type(l->store, type, out_cents);
+}
+
+ledger_err_t ledger_trial_balance(ledger_t *l, bool full_audit, int64_t *out_net_cents) {
+    if (!l) return LEDGER_ERR_INVALID;
+    int64_t net = account_total_balance(l->store);
+    if (full_audit) {
+        int64_t scanned;
+        ledger_err_t err = account_sum_balances(l->store, &scanned);
+        if (err != LEDGER_OK) return err;
+        if (scanned != net) {
+            if (out_net_cents) *out_net_cents = scanned;
+            return LEDGER_ERR_CONSTRAINT;
+        }
+    }
+    if (out_net_cents) *out_net_cents = net;
+    return net == 0 ? LEDGER_OK : LEDGER_ERR_CONSTRAINT;
+}
@@ -13,6 +13,8 @@ static void print_help(void) {
     puts("  withdraw <id> <cents>     - Withdraw from account");
     puts("  transfer <from> <to> <cents>");
     puts("  balance <id>              - Query balance");
+    puts("  history <id>              - Committed credits and debits from the log");
+    puts("  lag                       - Replication lag in bytes of log (follower)");
     puts("  quit                      - Exit");
 }
 
@@ -24,8 +26,9 @@ static account_type_t parse_type(const char *s) {
 }
 
 int main(int argc, char **argv) {
-    const char *wal = argc > 1 ? argv[1] : WAL_PATH;
-    ledger_t *l = ledger_open(wal);
+    bool follow = argc > 1 && strcmp(argv[1], "--follow") == 0;
+    const char *wal = argc > 1 + follow ? argv[1 + follow] : WAL_PATH;
+    ledger_t *l = follow ? ledger_open_follower(wal) : ledger_open(wal);
     if (!l) {
         fprintf(stderr, "Failed to open ledger at %s\n", wal);
         return 1;
@@ -39,35 +42,44 @@ int main(int argc, char **argv) {
         if (n < 1) continue;
         if (strcmp(cmd, "quit") == 0 || strcmp(cmd, "exit") == 0 || strcmp(cmd, "q") == 0) break;
         if (strcmp(cmd, "help") == 0 || strcmp(cmd, "?") == 0) { print_help(); continue; }
+        if (follow && ledger_follower_poll(l, NULL) != LEDGER_OK) puts("Warning: failed to apply primary log");
 
+        if (strcmp(cmd, "lag") == 0) {
+            uint64_t lag;
+            ledger_err_t err = ledger_replication_lag(l, &lag);
+            if (err != LEDGER_OK) printf("Error %d\n", err);
+            else printf("Lag: %llu bytes\n", (unsigned long long)lag);
+            continue;
+        }
         if (strcmp(cmd, "create") == 0) {
             char type[32] = "checking", currency[8] = "USD";
             sscanf(buf + 7, "%31s %7s", type, currency);
-            uint32_t id;
+            uint64_t id;
             ledger_err_t err = ledger_create_account(l, parse_type(type), currency, &id);
             if (err != LEDGER_OK) printf("Error %d\n", err);
-            else printf("Created account %u\n", id);
+            else printf("Created account %llu\n", (unsigned long long)id);
             continue;
         }
         if (strcmp(cmd, "deposit") == 0) {
-            uint32_t id; int64_t cents;
-            if (sscanf(buf + 8, "%u %lld", &id, (long long *)&cents) < 2) { puts("Usage: deposit <id> <cents>"); continue; }
+            uint64_t id; int64_t cents;
+            if (sscanf(buf + 8, "%llu %lld", (unsigned long long *)&id, (long long *)&cents) < 2) { puts("Usage: deposit <id> <cents>"); continue; }
             ledger_err_t err = ledger_deposit(l, id, cents);
             if (err != LEDGER_OK) printf("Error %d\n", err);
             else printf("Deposited %lld cents\n", (long long)cents);
             continue;
         }
         if (strcmp(cmd, "withdraw") == 0) {
-            uint32_t id; int64_t cents;
-            if (sscanf(buf + 9, "%u %lld", &id, (long long *)&cents) < 2) { puts("Usage: withdraw <id> <cents>"); continue; }
+            uint64_t id; int64_t cents;
+            if (sscanf(buf + 9, "%llu %lld", (unsigned long long *)&id, (long long *)&cents) < 2) { puts("Usage: withdraw <id> <cents>"); continue; }
             ledger_err_t err = ledger_withdraw(l, id, cents);
             if (err != LEDGER_OK) printf("Error %d\n", err);
             else printf("Withdrew %lld cents\n", (long long)cents);
             continue;
         }
         if (strcmp(cmd, "transfer") == 0) {
-            uint32_t from, to; int64_t cents;
-            if (sscanf(buf + 9, "%u %u %lld", &from, &to, (long long *)&cents) < 3) {
+            uint64_t from, to; int64_t cents;
+            if (sscanf(buf + 9, "%llu %llu %lld", (unsigned long long *)&from, (unsigned long long *)&to,
+                       (long long *)&cents) < 3) {
                 puts("Usage: transfer <from> <to> <cents>");
                 continue;
             }
@@ -77,12 +89,20 @@ int main(int argc, char **argv) {
             continue;
         }
         if (strcmp(cmd, "balance") == 0) {
-            uint32_t id;
-            if (sscanf(buf + 8, "%u", &id) < 1) { puts("Usage: balance <id>"); continue; }
+            uint64_t id;
+            if (sscanf(buf + 8, "%llu", (unsigned long long *)&id) < 1) { puts("Usage: balance <id>"); continue; }
             int64_t bal;
             ledger_err_t err = ledger_balance(l, id, &bal);
             if (err != LEDGER_OK) printf("Error %d\n", err);
             else printf("Balance: %lld cents\n", (long long)bal);
+        } else if (strcmp(cmd, "history") == 0) {
+            uint64_t id;
+            if (sscanf(buf + 8, "%llu", (unsigned long long *)&id) < 1) { puts("Usage: history <id>"); continue; }
+            int64_t credits, debits;
+            size_t legs;
+            ledger_err_t err = ledger_history(l, id, &credits, &debits, &legs);
+            if (err != LEDGER_OK) printf("Error %d\n", err);
+            else printf("Credits: %lld cents, debits: %lld cents, %zu legs\n", (long long)credits, (long long)debits, legs);
         } else
             printf("Unknown command: %s\n", cmd);
     }
@@ -0,0 +1,343 @@
+#define _POSIX_C_SOURCE 200809L
+#include "scheduler.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Bounded FIFO of caller-owned requests. */
+struct lane {
+    sched_request_t **ring;
+    uint32_t head;
+    uint32_t count;
+    sched_lane_stats_t st;
+};
+
+struct scheduler {
+    ledger_t *ledger;
+    scheduler_config_t cfg;
+    struct lane lanes[SCHED_LANES];
+    pthread_mutex_t mu;
+    pthread_cond_t work; /* dispatcher: something to do */
+    pthread_cond_t done; /* clients: a dispatch completed */
+    pthread_t thread;
+    bool stop;
+    bool paused;
+    uint64_t batches;
+    /* Background work, run a slice at a time between batches: the periodic
+     * posting under way, if any, and the ledger's sliced checkpoints. */
+    sched_request_t *posting;
+    int posting_lane;
+    uint64_t posting_slice;
+    bool checkpointing;
+    /* Dispatcher scratch, sized for the largest max_batch. */
+    sched_request_t **batch;
+    ledger_transfer_t *xfers;
+    ledger_err_t *results;
+    uint64_t *ids;
+    int64_t *balances;
+};
+
+uint64_t scheduler_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void scheduler_default_config(scheduler_config_t *cfg) {
+    if (!cfg) return;
+    *cfg = (scheduler_config_t){
+        .capacity = { 1024, 4096, 16384 },
+        .max_batch = { 32, 64, 64 },
+        .budget_ns = { 200000ull, 5000000ull, 500000000ull },
+    };
+}
+
+static uint32_t queued(const scheduler_t *s) {
+    uint32_t n = 0;
+    for (int k = 0; k < SCHED_LANES; k++) n += s->lanes[k].count;
+    return n;
+}
+
+static sched_request_t *lane_peek(const struct lane *ln) {
+    return ln->ring[ln->head];
+}
+
+static sched_request_t *lane_pop(scheduler_t *s, int k) {
+    struct lane *ln = &s->lanes[k];
+    sched_request_t *r = ln->ring[ln->head];
+    ln->head = (ln->head + 1) % s->cfg.capacity[k];
+    ln->count--;
+    return r;
+}
+
+/* The lane whose head is due first; ties go to the higher priority lane. A
+ * posting waits for the one under way. -1 if no lane can go. */
+static int pick_lane(const scheduler_t *s) {
+    int best = -1;
+    uint64_t due = 0;
+    for (int k = 0; k < SCHED_LANES; k++) {
+        const struct lane *ln = &s->lanes[k];
+        if (ln->count == 0 || (s->posting && lane_peek(ln)->op == SCHED_POST_PERIODIC)) continue;
+        uint64_t d = lane_peek(ln)->due_ns;
+        if (best < 0 || d < due) {
+            best = k;
+            due = d;
+        }
+    }
+    return best;
+}
+
+static void record_wait(sched_lane_stats_t *st, uint64_t wait) {
+    st->wait_total_ns += wait;
+    if (wait > st->wait_max_ns) st->wait_max_ns = wait;
+    uint64_t us = wait / 1000;
+    int b = 0;
+    while (b < SCHED_WAIT_BUCKETS - 1 && us >= (1ull << b)) b++;
+    st->wait_hist[b]++;
+}
+
+/* Pops the lane's leading run of requests with the same op, up to max_batch
+ * (periodic postings run alone). Requests past their deadline complete with
+ * LEDGER_ERR_TIMEOUT instead of joining the batch. Called with mu held. */
+static size_t take_batch(scheduler_t *s, int k, uint64_t now, bool *expired) {
+    struct lane *ln = &s->lanes[k];
+    sched_op_t op = lane_peek(ln)->op;
+    uint32_t max = op == SCHED_POST_PERIODIC ? 1 : s->cfg.max_batch[k];
+    size_t n = 0;
+    *expired = false;
+    while (ln->count > 0 && n < max && lane_peek(ln)->op == op) {
+        sched_request_t *r = lane_pop(s, k);
+        record_wait(&ln->st, now - r->enqueued_ns);
+        if (r->deadline_ns && now >= r->deadline_ns) {
+            r->result = LEDGER_ERR_TIMEOUT;
+            r->done = true;
+            ln->st.expired++;
+            *expired = true;
+            continue;
+        }
+        s->batch[n++] = r;
+    }
+    return n;
+}
+
+/* Runs a batch against the ledger; called without mu. A posting only
+ * starts here and goes on in run_background(). */
+static void run_batch(scheduler_t *s, size_t n) {
+    sched_request_t **b = s->batch;
+    switch (b[0]->op) {
+        case SCHED_TRANSFER:
+            for (size_t i = 0; i < n; i++)
+                s->xfers[i] = (ledger_transfer_t){ b[i]->from_id, b[i]->to_id, b[i]->amount_cents };
+            ledger_transfer_batch(s->ledger, s->xfers, n, s->results);
+            for (size_t i = 0; i < n; i++) b[i]->result = s->results[i];
+            break;
+        case SCHED_BALANCE:
+            for (size_t i = 0; i < n; i++) s->ids[i] = b[i]->account_id;
+            ledger_balance_many(s->ledger, s->ids, n, s->balances, s->results);
+            for (size_t i = 0; i < n; i++) {
+                b[i]->result = s->results[i];
+                b[i]->balance_cents = s->balances[i];
+            }
+            break;
+        case SCHED_POST_PERIODIC:
+            b[0]->balance_cents = 0;
+            b[0]->result = LEDGER_OK;
+            break;
+    }
+}
+
+/* One slice of the posting under way, then one checkpoint step, so a
+ * request that arrives meanwhile waits for at most that much. Called
+ * without mu; returns the posting once its last slice has run. */
+static sched_request_t *run_background(scheduler_t *s) {
+    sched_request_t *done = NULL, *p = s->posting;
+    if (p) {
+        int64_t total = 0;
+        if (s->posting_slice < ledger_posting_slices(s->ledger)) {
+            p->result = ledger_post_periodic_slice(s->ledger, p->rates, p->n_rates, p->contra_id, s->posting_slice++,
+                                                   &total);
+            if (p->result == LEDGER_OK) p->balance_cents += total;
+        }
+        if (p->result != LEDGER_OK || s->posting_slice >= ledger_posting_slices(s->ledger)) done = p;
+    }
+    if (ledger_checkpoint_step(s->ledger, &s->checkpointing) != LEDGER_OK) s->checkpointing = false;
+    return done;
+}
+
+static void *dispatch_run(void *arg) {
+    scheduler_t *s = (scheduler_t *)arg;
+    pthread_mutex_lock(&s->mu);
+    for (;;) {
+        while (!s->stop && (s->paused || (queued(s) == 0 && !s->posting && !s->checkpointing)))
+            pthread_cond_wait(&s->work, &s->mu);
+        if (queued(s) == 0 && !s->posting && !s->checkpointing) break; /* stopping and drained */
+        int k = pick_lane(s);
+        bool expired = false;
+        size_t n = k >= 0 ? take_batch(s, k, scheduler_now_ns(), &expired) : 0;
+        if (n > 0) {
+            uint64_t batch = ++s->batches;
+            pthread_mutex_unlock(&s->mu);
+            run_batch(s, n);
+            pthread_mutex_lock(&s->mu);
+            s->lanes[k].st.batches++;
+            if (s->batch[0]->op == SCHED_POST_PERIODIC) {
+                s->batch[0]->batch = batch;
+                s->posting = s->batch[0];
+                s->posting_lane = k;
+                s->posting_slice = 0;
+                n = 0;
+            }
+            for (size_t i = 0; i < n; i++) {
+                s->batch[i]->batch = batch;
+                s->batch[i]->done = true;
+            }
+            s->lanes[k].st.completed += n;
+        }
+        pthread_mutex_unlock(&s->mu);
+        sched_request_t *posted = run_background(s);
+        pthread_mutex_lock(&s->mu);
+        if (posted) {
+            posted->done = true;
+            s->lanes[s->posting_lane].st.completed++;
+            s->posting = NULL;
+        }
+        if (n > 0 || expired || posted) pthread_cond_broadcast(&s->done);
+    }
+    pthread_mutex_unlock(&s->mu);
+    return NULL;
+}
+
+static void scheduler_free(scheduler_t *s) {
+    for (int k = 0; k < SCHED_LANES; k++) free(s->lanes[k].ring);
+    free(s->batch);
+    free(s->xfers);
+    free(s->results);
+    free(s->ids);
+    free(s->balances);
+    free(s);
+}
+
+scheduler_t *scheduler_create(ledger_t *l, const scheduler_config_t *cfg) {
+    if (!l) return NULL;
+    scheduler_t *s = calloc(1, sizeof(scheduler_t));
+    if (!s) return NULL;
+    s->ledger = l;
+    if (cfg) s->cfg = *cfg;
+    else scheduler_default_config(&s->cfg);
+    uint32_t max_batch = 0;
+    bool ok = true;
+    for (int k = 0; k < SCHED_LANES; k++) {
+        if (s->cfg.capacity[k] == 0 || s->cfg.max_batch[k] == 0) ok = false;
+        if (s->cfg.max_batch[k] > max_batch) max_batch = s->cfg.max_batch[k];
+        s->lanes[k].ring = calloc(s->cfg.capacity[k] ? s->cfg.capacity[k] : 1, sizeof(sched_request_t *));
+        s->lanes[k].st.capacity = s->cfg.capacity[k];
+        if (!s->lanes[k].ring) ok = false;
+    }
+    s->batch = calloc(max_batch ? max_batch : 1, sizeof(*s->batch));
+    s->xfers = calloc(max_batch ? max_batch : 1, sizeof(*s->xfers));
+    s->results = calloc(max_batch ? max_batch : 1, sizeof(*s->results));
+    s->ids = calloc(max_batch ? max_batch : 1, sizeof(*s->ids));
+    s->balances = calloc(max_batch ? max_batch : 1, sizeof(*s->balances));
+    if (!ok || !s->batch || !s->xfers || !s->results || !s->ids || !s->balances) {
+        scheduler_free(s);
+        return NULL;
+    }
+    pthread_mutex_init(&s->mu, NULL);
+    pthread_cond_init(&s->work, NULL);
+    pthread_cond_init(&s->done, NULL);
+    ledger_set_sliced_checkpoints(l, true);
+    if (pthread_create(&s->thread, NULL, dispatch_run, s) != 0) {
+        ledger_set_sliced_checkpoints(l, false);
+        pthread_cond_destroy(&s->done);
+        pthread_cond_destroy(&s->work);
+        pthread_mutex_destroy(&s->mu);
+        scheduler_free(s);
+        return NULL;
+    }
+    return s;
+}
+
+void scheduler_destroy(scheduler_t *s) {
+    if (!s) return;
+    pthread_mutex_lock(&s->mu);
+    s->stop = true;
+    pthread_cond_signal(&s->work);
+    pthread_mutex_unlock(&s->mu);
+    pthread_join(s->thread, NULL);
+    ledger_set_sliced_checkpoints(s->ledger, false);
+    pthread_cond_destroy(&s->done);
+    pthread_cond_destroy(&s->work);
+    pthread_mutex_destroy(&s->mu);
+    scheduler_free(s);
+}
+
+ledger_err_t scheduler_submit(scheduler_t *s, sched_lane_t lane, sched_request_t *req) {
+    if (!s || !req || lane < 0 || lane >= SCHED_LANES || req->op > SCHED_POST_PERIODIC) return LEDGER_ERR_INVALID;
+    uint64_t now = scheduler_now_ns();
+    req->enqueued_ns = now;
+    req->due_ns = now + s->cfg.budget_ns[lane];
+    if (req->deadline_ns && req->deadline_ns < req->due_ns) req->due_ns = req->deadline_ns;
+    req->batch = 0;
+    req->done = false;
+    pthread_mutex_lock(&s->mu);
+    struct lane *ln = &s->lanes[lane];
+    if (s->stop || ln->count == s->cfg.capacity[lane]) {
+        ln->st.rejected++;
+        pthread_mutex_unlock(&s->mu);
+        req->result = LEDGER_ERR_BUSY;
+        req->done = true;
+        return LEDGER_ERR_BUSY;
+    }
+    ln->ring[(ln->head + ln->count) % s->cfg.capacity[lane]] = req;
+    ln->count++;
+    ln->st.submitted++;
+    if (ln->count > ln->st.max_depth) ln->st.max_depth = ln->count;
+    pthread_cond_signal(&s->work);
+    pthread_mutex_unlock(&s->mu);
+    return LEDGER_OK;
+}
+
+ledger_err_t scheduler_wait(scheduler_t *s, sched_request_t *req) {
+    if (!s || !req) return LEDGER_ERR_INVALID;
+    pthread_mutex_lock(&s->mu);
+    while (!req->done) pthread_cond_wait(&s->done, &s->mu);
+    pthread_mutex_unlock(&s->mu);
+    return req->result;
+}
+
+void scheduler_pause(scheduler_t *s) {
+    if (!s) return;
+    pthread_mutex_lock(&s->mu);
+    s->paused = true;
+    pthread_mutex_unlock(&s->mu);
+}
+
+void scheduler_resume(scheduler_t *s) {
+    if (!s) return;
+    pthread_mutex_lock(&s->mu);
+    s->paused = false;
+    pthread_cond_signal(&s->work);
+    pthread_mutex_unlock(&s->mu);
+}
+
+ledger_err_t scheduler_lane_stats(scheduler_t *s, sched_lane_t lane, sched_lane_stats_t *out) {
+    if (!s || !out || lane < 0 || lane >= SCHED_LANES) return LEDGER_ERR_INVALID;
+    pthread_mutex_lock(&s->mu);
+    *out = s->lanes[lane].st;
+    out->depth = s->lanes[lane].count;
+    pthread_mutex_unlock(&s->mu);
+    return LEDGER_OK;
+}
+
+uint64_t sched_wait_quantile_ns(const sched_lane_stats_t *st, double q) {
+    if (!st) return 0;
+    uint64_t total = 0;
+    for (int b = 0; b < SCHED_WAIT_BUCKETS; b++) total += st->wait_hist[b];
+    if (total == 0) return 0;
+    uint64_t rank = (uint64_t)(q * (double)total), seen = 0;
+    for (int b = 0; b < SCHED_WAIT_BUCKETS; b++) {
+        seen += st->wait_hist[b];
+        if (seen > rank || b == SCHED_WAIT_BUCKETS - 1) return (1ull << b) * 1000;
+    }
+    return 0;
+}
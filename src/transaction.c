@@ -2,19 +2,22 @@
 #include <stdlib.h>
 #include <string.h>
 
-struct journal_entry_node {
-    journal_entry_t entry;
-    struct journal_entry_node *next;
-};
+/* Legs are kept in a contiguous array: inline storage covers ordinary
+ * transfers, larger journals spill to a heap array that is kept across
+ * transaction_reset() so a reused transaction stops allocating. */
+#define TX_INLINE_ENTRIES 4
 
 struct transaction {
     account_store_t *store;
     uint64_t tx_id;
-    struct journal_entry_node *entries;
+    journal_entry_t *entries;
+    size_t count;
+    size_t capacity;
     int64_t total_debits;
     int64_t total_credits;
     bool committed;
     bool aborted;
+    journal_entry_t inline_entries[TX_INLINE_ENTRIES];
 };
 
 transaction_t *transaction_begin(account_store_t *store, uint64_t tx_id) {
@@ -23,25 +26,48 @@ transaction_t *transaction_begin(account_store_t *store, uint64_t tx_id) {
     if (!tx) return NULL;
     tx->store = store;
     tx->tx_id = tx_id;
+    tx->entries = tx->inline_entries;
+    tx->capacity = TX_INLINE_ENTRIES;
     return tx;
 }
 
-static void free_entries(struct journal_entry_node *n) {
-    while (n) {
-        struct journal_entry_node *next = n->next;
-        free(n);
-        n = next;
-    }
+ledger_err_t transaction_reset(transaction_t *tx, account_store_t *store, uint64_t tx_id) {
+    if (!tx || !store) return LEDGER_ERR_INVALID;
+    tx->store = store;
+    tx->tx_id = tx_id;
+    tx->count = 0;
+    tx->total_debits = 0;
+    tx->total_credits = 0;
+    tx->committed = false;
+    tx->aborted = false;
+    return LEDGER_OK;
 }
 
-static ledger_err_t append_entry(transaction_t *tx, uint32_t account_id, int64_t amount_cents, bool is_debit) {
-    struct journal_entry_node *n = calloc(1, sizeof(struct journal_entry_node));
+static ledger_err_t reserve_entries(transaction_t *tx) {
+    if (tx->count < tx->capacity) return LEDGER_OK;
+    if (tx->capacity >= MAX_TX_ENTRIES) return LEDGER_ERR_NOMEM;
+    size_t new_cap = tx->capacity * 2;
+    if (new_cap > MAX_TX_ENTRIES) new_cap = MAX_TX_ENTRIES;
+    journal_entry_t *n;
+    if (tx->entries == tx->inline_entries) {
+        n = malloc(new_cap * sizeof(journal_entry_t));
+        if (n) memcpy(n, tx->inline_entries, tx->count * sizeof(journal_entry_t));
+    } else {
+        n = realloc(tx->entries, new_cap * sizeof(journal_entry_t));
+    }
     if (!n) return LEDGER_ERR_NOMEM;
-    n->entry.account_id = account_id;
-    n->entry.amount_cents = amount_cents;
-    n->entry.is_debit = is_debit;
-    n->next = tx->entries;
     tx->entries = n;
+    tx->capacity = new_cap;
+    return LEDGER_OK;
+}
+
+static ledger_err_t append_entry(transaction_t *tx, uint64_t account_id, int64_t amount_cents, bool is_debit) {
+    ledger_err_t err = reserve_entries(tx);
+    if (err != LEDGER_OK) return err;
+    journal_entry_t *e = &tx->entries[tx->count++];
+    e->account_id = account_id;
+    e->amount_cents = amount_cents;
+    e->is_debit = is_debit;
     if (is_debit)
         tx->total_debits += amount_cents;
     else
@@ -49,13 +75,13 @@ static ledger_err_t append_entry(transaction_t *tx, uint32_t account_id, int64_t
     return LEDGER_OK;
 }
 
-ledger_err_t transaction_debit(transaction_t *tx, uint32_t account_id, int64_t amount_cents) {
+ledger_err_t transaction_debit(transaction_t *tx, uint64_t account_id, int64_t amount_cents) {
     if (!tx || tx->committed || tx->aborted) return LEDGER_ERR_INVALID;
     if (amount_cents <= 0) return LEDGER_ERR_INVALID;
     return append_entry(tx, account_id, amount_cents, true);
 }
 
-ledger_err_t transaction_credit(transaction_t *tx, uint32_t account_id, int64_t amount_cents) {
+ledger_err_t transaction_credit(transaction_t *tx, uint64_t account_id, int64_t amount_cents) {
     if (!tx || tx->committed || tx->aborted) return LEDGER_ERR_INVALID;
     if (amount_cents <= 0) return LEDGER_ERR_INVALID;
     return append_entry(tx, account_id, amount_cents, false);
@@ -64,10 +90,20 @@ ledger_err_t transaction_credit(transaction_t *tx, uint32_t account_id, int64_t
 ledger_err_t transaction_commit(transaction_t *tx) {
     if (!tx || tx->committed || tx->aborted) return LEDGER_ERR_INVALID;
     if (tx->total_debits != tx->total_credits) return LEDGER_ERR_CONSTRAINT;
-    for (struct journal_entry_node *n = tx->entries; n; n = n->next) {
-        int64_t delta = n->entry.is_debit ? n->entry.amount_cents : -(int64_t)n->entry.amount_cents;
-        ledger_err_t err = account_apply_delta(tx->store, n->entry.account_id, delta, tx->tx_id);
-        if (err != LEDGER_OK) return err;
+    for (size_t i = 0; i < tx->count; i++) {
+        journal_entry_t *e = &tx->entries[i];
+        int64_t delta = e->is_debit ? e->amount_cents : -(int64_t)e->amount_cents;
+        ledger_err_t err = account_apply_delta_prev(tx->store, e->account_id, delta, tx->tx_id, &e->prev_version);
+        if (err != LEDGER_OK) {
+            /* Undo the legs already applied, versions included, so a failed
+             * commit leaves no trace. */
+            while (i-- > 0) {
+                const journal_entry_t *u = &tx->entries[i];
+                int64_t applied = u->is_debit ? u->amount_cents : -(int64_t)u->amount_cents;
+                account_revert_delta(tx->store, u->account_id, applied, u->prev_version);
+            }
+            return err;
+        }
     }
     tx->committed = true;
     return LEDGER_OK;
@@ -80,7 +116,7 @@ void transaction_abort(transaction_t *tx) {
 
 void transaction_destroy(transaction_t *tx) {
     if (!tx) return;
-    free_entries(tx->entries);
+    if (tx->entries != tx->inline_entries) free(tx->entries);
     free(tx);
 }
 
@@ -88,6 +124,11 @@ bool transaction_is_committed(const transaction_t *tx) {
     return tx && tx->committed;
 }
 
+const journal_entry_t *transaction_entries(const transaction_t *tx, size_t *count) {
+    if (count) *count = tx ? tx->count : 0;
+    return tx ? tx->entries : NULL;
+}
+
 bool transaction_is_aborted(const transaction_t *tx) {
     return tx && tx->aborted;
 }
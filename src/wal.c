@@ -1,31 +1,45 @@
+#define _POSIX_C_SOURCE 200809L
 #include "wal.h"
 #include "common.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
 
-#define WAL_RECORD_PAYLOAD_SIZE 32
+#define WAL_RECORD_PAYLOAD_SIZE 40
 #define WAL_RECORD_SIZE         (WAL_RECORD_PAYLOAD_SIZE + 4)
+#define WAL_HEADER_SIZE         8
+#define WAL_MAX_FRAME_BODY      4096
 
 #pragma pack(push, 1)
 typedef struct {
     uint8_t op;
     uint8_t pad1[3];
+    uint32_t acct_type;
     uint64_t tx_id;
-    uint32_t account_id;
+    uint64_t account_id;
     int64_t amount;
-    uint32_t acct_type;
     char currency[CURRENCY_LEN];
-    uint8_t pad2[4];
+    uint32_t body_crc; /* checkpoint, bulk posting: CRC32 of the body that follows */
 } wal_record_t;
 #pragma pack(pop)
 
 struct wal {
     FILE *fp;
     char path[WAL_PATH_MAX];
+    bool read_only;
+    bool grouped; /* inside wal_group_begin/end: defer flushes */
+    bool external_checkpoints; /* replay may restore from external checkpoints */
+    uint64_t sliced_end; /* replay: the sliced checkpoint's end frame to restore, or 0 */
+    uint64_t read_lsn; /* follower: offset just past the last complete record */
+    uint8_t body[WAL_MAX_FRAME_BODY];
 };
 
-static void encode_record(uint8_t *buf, wal_op_t op, uint64_t tx_id, uint32_t account_id,
+static void encode_record(uint8_t *buf, wal_op_t op, uint64_t tx_id, uint64_t account_id,
                           int64_t amount, account_type_t acct_type, const char *currency) {
     wal_record_t *r = (wal_record_t *)buf;
     memset(r, 0, WAL_RECORD_PAYLOAD_SIZE);
@@ -37,6 +51,23 @@ static void encode_record(uint8_t *buf, wal_op_t op, uint64_t tx_id, uint32_t ac
     if (currency) memcpy(r->currency, currency, CURRENCY_LEN);
 }
 
+static ledger_err_t write_header(FILE *fp) {
+    uint32_t hdr[2] = { WAL_MAGIC, WAL_VERSION };
+    if (fwrite(hdr, 1, WAL_HEADER_SIZE, fp) != WAL_HEADER_SIZE) return LEDGER_ERR_IO;
+    if (fflush(fp) != 0) return LEDGER_ERR_IO;
+    return LEDGER_OK;
+}
+
+/* LEDGER_ERR_NOTFOUND: the file is empty or its header was torn while the
+ * log was being created, so there is no log yet. */
+static ledger_err_t check_header(FILE *fp) {
+    uint32_t hdr[2];
+    size_t n = fread(hdr, 1, WAL_HEADER_SIZE, fp);
+    if (n < WAL_HEADER_SIZE && feof(fp)) return LEDGER_ERR_NOTFOUND;
+    if (n != WAL_HEADER_SIZE || hdr[0] != WAL_MAGIC || hdr[1] != WAL_VERSION) return LEDGER_ERR_IO;
+    return LEDGER_OK;
+}
+
 wal_t *wal_open(const char *path) {
     if (!path || strlen(path) >= WAL_PATH_MAX) return NULL;
     wal_t *w = calloc(1, sizeof(wal_t));
@@ -47,6 +78,25 @@ wal_t *wal_open(const char *path) {
         free(w);
         return NULL;
     }
+    if (fseek(w->fp, 0, SEEK_END) != 0 || (ftell(w->fp) == 0 && write_header(w->fp) != LEDGER_OK)) {
+        fclose(w->fp);
+        free(w);
+        return NULL;
+    }
+    return w;
+}
+
+wal_t *wal_open_follower(const char *path) {
+    if (!path || strlen(path) >= WAL_PATH_MAX) return NULL;
+    wal_t *w = calloc(1, sizeof(wal_t));
+    if (!w) return NULL;
+    strncpy(w->path, path, WAL_PATH_MAX - 1);
+    w->fp = fopen(path, "rb");
+    if (!w->fp) {
+        free(w);
+        return NULL;
+    }
+    w->read_only = true;
     return w;
 }
 
@@ -62,13 +112,13 @@ static ledger_err_t append_record(wal_t *w, const uint8_t *payload) {
     if (fwrite(payload, 1, WAL_RECORD_PAYLOAD_SIZE, w->fp) != WAL_RECORD_PAYLOAD_SIZE)
         return LEDGER_ERR_IO;
     if (fwrite(&crc, 1, 4, w->fp) != 4) return LEDGER_ERR_IO;
-    if (fflush(w->fp) != 0) return LEDGER_ERR_IO;
+    if (!w->grouped && fflush(w->fp) != 0) return LEDGER_ERR_IO;
     return LEDGER_OK;
 }
 
-ledger_err_t wal_append(wal_t *w, wal_op_t op, uint64_t tx_id, uint32_t account_id, int64_t amount,
+ledger_err_t wal_append(wal_t *w, wal_op_t op, uint64_t tx_id, uint64_t account_id, int64_t amount,
                         account_type_t acct_type, const char *currency) {
-    if (!w || !w->fp) return LEDGER_ERR_INVALID;
+    if (!w || !w->fp || w->read_only) return LEDGER_ERR_INVALID;
     uint8_t buf[WAL_RECORD_PAYLOAD_SIZE];
     encode_record(buf, op, tx_id, account_id, amount, acct_type, currency);
     return append_record(w, buf);
@@ -86,16 +136,72 @@ ledger_err_t wal_abort(wal_t *w, uint64_t tx_id) {
     return wal_append(w, WAL_ABORT, tx_id, 0, 0, ACCT_CHECKING, NULL);
 }
 
-ledger_err_t wal_checkpoint(wal_t *w, const void *snapshot, size_t len) {
-    if (!w || !w->fp) return LEDGER_ERR_INVALID;
+/* Checkpoint records keep the body length in tx_id and their kind in
+ * acct_type. A sliced checkpoint's end frame holds begin_lsn(8) len(8). */
+enum { CKPT_INLINE, CKPT_EXTERNAL, CKPT_PART, CKPT_END };
+#define CKPT_END_BODY 16
+
+static ledger_err_t write_checkpoint(wal_t *w, const void *snapshot, size_t len, uint32_t kind) {
+    if (!w || !w->fp || w->read_only) return LEDGER_ERR_INVALID;
     uint8_t buf[WAL_RECORD_PAYLOAD_SIZE];
     memset(buf, 0, sizeof(buf));
     ((wal_record_t *)buf)->op = (uint8_t)WAL_CHECKPOINT;
+    ((wal_record_t *)buf)->acct_type = kind;
     ((wal_record_t *)buf)->tx_id = (uint64_t)len;
+    ((wal_record_t *)buf)->body_crc = crc32(snapshot, len);
     ledger_err_t err = append_record(w, buf);
     if (err != LEDGER_OK) return err;
     if (snapshot && len > 0 && fwrite(snapshot, 1, len, w->fp) != len) return LEDGER_ERR_IO;
     if (fflush(w->fp) != 0) return LEDGER_ERR_IO;
+    if (kind == CKPT_EXTERNAL && fdatasync(fileno(w->fp)) != 0) return LEDGER_ERR_IO;
+    return LEDGER_OK;
+}
+
+ledger_err_t wal_checkpoint(wal_t *w, const void *snapshot, size_t len) {
+    return write_checkpoint(w, snapshot, len, CKPT_INLINE);
+}
+
+ledger_err_t wal_checkpoint_external(wal_t *w, const void *body, size_t len) {
+    return write_checkpoint(w, body, len, CKPT_EXTERNAL);
+}
+
+ledger_err_t wal_checkpoint_part(wal_t *w, const void *body, size_t len) {
+    if (!body || len == 0) return LEDGER_ERR_INVALID;
+    return write_checkpoint(w, body, len, CKPT_PART);
+}
+
+ledger_err_t wal_checkpoint_end(wal_t *w, uint64_t begin_lsn, uint64_t len) {
+    uint64_t body[2] = { begin_lsn, len };
+    return write_checkpoint(w, body, CKPT_END_BODY, CKPT_END);
+}
+
+void wal_use_external_checkpoints(wal_t *w) {
+    if (w) w->external_checkpoints = true;
+}
+
+void wal_group_begin(wal_t *w) {
+    if (w) w->grouped = true;
+}
+
+ledger_err_t wal_group_end(wal_t *w) {
+    if (!w || !w->fp) return LEDGER_ERR_INVALID;
+    w->grouped = false;
+    return fflush(w->fp) == 0 ? LEDGER_OK : LEDGER_ERR_IO;
+}
+
+ledger_err_t wal_bulk_posting(wal_t *w, uint64_t tx_id, uint64_t contra_id, int64_t total,
+                              const void *body, size_t len) {
+    if (!w || !w->fp || w->read_only || len > WAL_MAX_FRAME_BODY || (len > 0 && !body)) return LEDGER_ERR_INVALID;
+    uint8_t buf[WAL_RECORD_PAYLOAD_SIZE];
+    encode_record(buf, WAL_BULK_POSTING, tx_id, contra_id, total, ACCT_CHECKING, NULL);
+    ((wal_record_t *)buf)->acct_type = (uint32_t)len;
+    ((wal_record_t *)buf)->body_crc = crc32(body, len);
+    uint32_t crc = crc32(buf, WAL_RECORD_PAYLOAD_SIZE);
+    /* Header, body and CRC go out in one flush; the CRC covers the header. */
+    if (fwrite(buf, 1, WAL_RECORD_PAYLOAD_SIZE, w->fp) != WAL_RECORD_PAYLOAD_SIZE) return LEDGER_ERR_IO;
+    if (fwrite(&crc, 1, 4, w->fp) != 4) return LEDGER_ERR_IO;
+    if (len > 0 && fwrite(body, 1, len, w->fp) != len) return LEDGER_ERR_IO;
+    if (fflush(w->fp) != 0) return LEDGER_ERR_IO;
     return LEDGER_OK;
 }
 
@@ -103,46 +209,400 @@ static ledger_err_t read_record(FILE *fp, uint8_t *payload, uint32_t *crc_out) {
     if (fread(payload, 1, WAL_RECORD_PAYLOAD_SIZE, fp) != WAL_RECORD_PAYLOAD_SIZE)
         return feof(fp) ? LEDGER_ERR_NOTFOUND : LEDGER_ERR_IO;
     uint32_t stored;
-    if (fread(&stored, 1, 4, fp) != 4) return LEDGER_ERR_IO;
+    if (fread(&stored, 1, 4, fp) != 4) return feof(fp) ? LEDGER_ERR_NOTFOUND : LEDGER_ERR_IO;
     uint32_t computed = crc32(payload, WAL_RECORD_PAYLOAD_SIZE);
     if (stored != computed) return LEDGER_ERR_IO;
     if (crc_out) *crc_out = stored;
     return LEDGER_OK;
 }
 
-ledger_err_t wal_replay(wal_t *w, wal_replay_cb_t cb, wal_checkpoint_restore_cb_t checkpoint_cb, void *ctx) {
-    if (!w || !cb) return LEDGER_ERR_INVALID;
-    if (fclose(w->fp) != 0) return LEDGER_ERR_IO;
-    w->fp = fopen(w->path, "rb");
-    if (!w->fp) return LEDGER_ERR_IO;
+/* Frames that carry a body after the record: a checkpoint's snapshot or a
+ * bulk posting's rate table. */
+static size_t body_len(const wal_record_t *r) {
+    if (r->op == WAL_CHECKPOINT) return (size_t)r->tx_id;
+    if (r->op == WAL_BULK_POSTING) return r->acct_type;
+    return 0;
+}
+
+/* Decodes a checksummed record; the caller attaches any body. */
+static void decode_entry(const wal_record_t *r, uint64_t lsn, wal_entry_t *e) {
+    bool framed = r->op == WAL_CHECKPOINT || r->op == WAL_BULK_POSTING;
+    *e = (wal_entry_t){
+        .op = (wal_op_t)r->op,
+        .tx_id = r->op == WAL_CHECKPOINT ? 0 : r->tx_id,
+        .account_id = r->account_id,
+        .amount = r->amount,
+        .acct_type = framed ? ACCT_CHECKING : (account_type_t)r->acct_type,
+        .currency = r->currency,
+        .lsn = lsn,
+    };
+}
+
+static uint64_t file_size(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (uint64_t)st.st_size : 0;
+}
+
+/* How far past a damaged record recovery looks for whole records. A crash
+ * tears at most what was written since the last flush, so this bounds the
+ * cost of classifying damage rather than scanning the rest of a large log. */
+#define WAL_TORN_SCAN (1u << 16)
+
+/* Whether a checksummed record starts at any byte offset of buf. All-zero
+ * windows, which no record encodes to, are skipped in one step. */
+static bool record_in(const uint8_t *buf, size_t n) {
+    size_t nz = 0;
+    for (size_t i = 0; i + WAL_RECORD_SIZE <= n; i++) {
+        if (nz < i) nz = i;
+        while (nz < n && buf[nz] == 0) nz++;
+        if (nz >= i + WAL_RECORD_SIZE) {
+            i = nz - WAL_RECORD_SIZE;
+            continue;
+        }
+        const wal_record_t *r = (const wal_record_t *)(buf + i);
+        if (r->op > WAL_BULK_POSTING || r->pad1[0] || r->pad1[1] || r->pad1[2]) continue;
+        uint32_t stored;
+        memcpy(&stored, buf + i + WAL_RECORD_PAYLOAD_SIZE, 4);
+        if (stored == crc32(buf + i, WAL_RECORD_PAYLOAD_SIZE)) return true;
+    }
+    return false;
+}
+
+/* record_in() over [from, end) of the file, looking at most WAL_TORN_SCAN
+ * bytes ahead. */
+static ledger_err_t record_follows(wal_t *w, uint64_t from, uint64_t end, bool *found) {
+    uint8_t buf[4096 + WAL_RECORD_SIZE - 1];
+    uint64_t stop = end - from > WAL_TORN_SCAN ? from + WAL_TORN_SCAN : end;
+    ledger_err_t err = LEDGER_OK;
+    *found = false;
+    while (!*found && from + WAL_RECORD_SIZE <= stop) {
+        if (fseek(w->fp, (long)from, SEEK_SET) != 0) {
+            err = LEDGER_ERR_IO;
+            break;
+        }
+        size_t want = stop - from < sizeof(buf) ? (size_t)(stop - from) : sizeof(buf);
+        size_t n = fread(buf, 1, want, w->fp);
+        if (n < WAL_RECORD_SIZE) break;
+        *found = record_in(buf, n);
+        from += n - (WAL_RECORD_SIZE - 1);
+    }
+    clearerr(w->fp);
+    return err;
+}
+
+/* A damaged record is a torn tail when no whole record follows it: a crash
+ * on a preallocated file leaves zeros or stale blocks past the last flush.
+ * Damage with records after it is corruption. The search starts at from,
+ * just past the damaged record header or, when only a body is damaged,
+ * past the frame its intact header describes. LEDGER_ERR_NOTFOUND for a
+ * torn tail. */
+static ledger_err_t bad_record(wal_t *w, uint64_t from, uint64_t end) {
+    bool found;
+    ledger_err_t err = record_follows(w, from, end, &found);
+    if (err != LEDGER_OK) return err;
+    return found ? LEDGER_ERR_IO : LEDGER_ERR_NOTFOUND;
+}
+
+/* Restores the sliced checkpoint whose end frame starts at `at`, with the
+ * file just past that frame's record: the parts logged between its begin
+ * position and the end frame are joined into one snapshot, and the file is
+ * left at the begin position, from where replay goes on. The end frame was
+ * chosen as the last whole checkpoint, so damage before it is corruption. */
+static ledger_err_t restore_sliced(wal_t *w, uint64_t at, uint32_t body_crc, size_t len,
+                                   wal_checkpoint_restore_cb_t checkpoint_cb, void *ctx) {
+    uint64_t body[2];
+    if (len != CKPT_END_BODY || fread(body, 1, len, w->fp) != len || crc32(body, len) != body_crc)
+        return LEDGER_ERR_IO;
+    uint64_t begin = body[0], total = body[1];
+    if (begin < WAL_HEADER_SIZE || begin > at || total > at - begin) return LEDGER_ERR_IO;
+    uint8_t *snap = malloc(total ? (size_t)total : 1);
+    if (!snap) return LEDGER_ERR_NOMEM;
     uint8_t buf[WAL_RECORD_PAYLOAD_SIZE];
-    ledger_err_t err;
-    while ((err = read_record(w->fp, buf, NULL)) == LEDGER_OK) {
+    uint64_t pos = begin, got = 0;
+    ledger_err_t err = fseek(w->fp, (long)begin, SEEK_SET) == 0 ? LEDGER_OK : LEDGER_ERR_IO;
+    while (err == LEDGER_OK && pos < at) {
+        if (read_record(w->fp, buf, NULL) != LEDGER_OK) {
+            err = LEDGER_ERR_IO;
+            break;
+        }
         wal_record_t *r = (wal_record_t *)buf;
+        size_t n = body_len(r);
+        pos += WAL_RECORD_SIZE + n;
+        if (r->op != WAL_CHECKPOINT || r->acct_type != CKPT_PART) {
+            if (n > 0 && fseek(w->fp, (long)n, SEEK_CUR) != 0) err = LEDGER_ERR_IO;
+            continue;
+        }
+        if (n > total - got || fread(snap + got, 1, n, w->fp) != n || crc32(snap + got, n) != r->body_crc)
+            err = LEDGER_ERR_IO;
+        got += n;
+    }
+    if (err == LEDGER_OK && (pos != at || got != total)) err = LEDGER_ERR_IO;
+    if (err == LEDGER_OK) {
+        int rc = checkpoint_cb(snap, (size_t)total, false, ctx);
+        if (rc != 0) err = (ledger_err_t)rc;
+    }
+    free(snap);
+    clearerr(w->fp);
+    if (err == LEDGER_OK && fseek(w->fp, (long)begin, SEEK_SET) != 0) err = LEDGER_ERR_IO;
+    return err;
+}
+
+/* Applies records from the current position. A record, checkpoint or bulk
+ * frame cut short by the end of the file, or a damaged one with nothing
+ * whole after it, is a torn tail, not an error: the position is left at its
+ * start, which in tail mode lets the next call pick it up once fully
+ * written. */
+static ledger_err_t replay_records(wal_t *w, wal_replay_cb_t cb, wal_checkpoint_restore_cb_t checkpoint_cb,
+                                   void *ctx) {
+    uint8_t buf[WAL_RECORD_PAYLOAD_SIZE];
+    uint64_t end = file_size(w->path);
+    for (;;) {
+        long start = ftell(w->fp);
+        if (start < 0) return LEDGER_ERR_IO;
+        ledger_err_t err = read_record(w->fp, buf, NULL);
+        wal_record_t *r = (wal_record_t *)buf;
+        size_t len = err == LEDGER_OK ? body_len(r) : 0;
+        uint64_t frame_end = (uint64_t)start + WAL_RECORD_SIZE + len;
+        if (err == LEDGER_ERR_IO && !ferror(w->fp)) err = bad_record(w, (uint64_t)start + 1, end);
+        else if (err == LEDGER_OK && r->op == WAL_BULK_POSTING && len > WAL_MAX_FRAME_BODY)
+            err = bad_record(w, (uint64_t)start + 1, end);
+        else if (err == LEDGER_OK && frame_end > end)
+            err = LEDGER_ERR_NOTFOUND;
+        else if (err == LEDGER_OK && r->op == WAL_BULK_POSTING) {
+            if (fread(w->body, 1, len, w->fp) != len) return LEDGER_ERR_IO;
+            if (crc32(w->body, len) != r->body_crc) err = bad_record(w, frame_end, end);
+        }
+        if (err == LEDGER_ERR_NOTFOUND) {
+            clearerr(w->fp);
+            if (fseek(w->fp, start, SEEK_SET) != 0) return LEDGER_ERR_IO;
+            break;
+        }
+        if (err != LEDGER_OK) return err;
         wal_op_t op = (wal_op_t)r->op;
+        if (op == WAL_CHECKPOINT && r->acct_type == CKPT_END && checkpoint_cb && (uint64_t)start == w->sliced_end) {
+            w->sliced_end = 0;
+            err = restore_sliced(w, (uint64_t)start, r->body_crc, len, checkpoint_cb, ctx);
+            if (err != LEDGER_OK) return err;
+            continue;
+        }
         if (op == WAL_CHECKPOINT) {
-            size_t snap_len = (size_t)r->tx_id;
-            if (snap_len > 0 && checkpoint_cb) {
-                void *snap = malloc(snap_len);
+            bool external = r->acct_type == CKPT_EXTERNAL;
+            if (len > 0 && checkpoint_cb && (r->acct_type == CKPT_INLINE || (external && w->external_checkpoints))) {
+                void *snap = malloc(len);
                 if (!snap) return LEDGER_ERR_NOMEM;
-                if (fread(snap, 1, snap_len, w->fp) != snap_len) {
+                if (fread(snap, 1, len, w->fp) != len) {
                     free(snap);
                     return LEDGER_ERR_IO;
                 }
-                int rc = checkpoint_cb(snap, snap_len, ctx);
+                if (crc32(snap, len) != r->body_crc) {
+                    free(snap);
+                    err = bad_record(w, frame_end, end);
+                    if (err != LEDGER_ERR_NOTFOUND) return err;
+                    if (fseek(w->fp, start, SEEK_SET) != 0) return LEDGER_ERR_IO;
+                    break;
+                }
+                int rc = checkpoint_cb(snap, len, external, ctx);
                 free(snap);
                 if (rc != 0) return (ledger_err_t)rc;
-            } else if (snap_len > 0) {
-                if (fseek(w->fp, (long)snap_len, SEEK_CUR) != 0) return LEDGER_ERR_IO;
+            } else if (len > 0) {
+                if (fseek(w->fp, (long)len, SEEK_CUR) != 0) return LEDGER_ERR_IO;
             }
             continue;
         }
-        int rc = cb(op, r->tx_id, r->account_id, r->amount, (account_type_t)r->acct_type, r->currency, ctx);
+        wal_entry_t e;
+        decode_entry(r, (uint64_t)start, &e);
+        if (op == WAL_BULK_POSTING) {
+            e.payload = w->body;
+            e.payload_len = len;
+        }
+        int rc = cb(&e, ctx);
         if (rc != 0) return (ledger_err_t)rc;
     }
-    if (err != LEDGER_OK && err != LEDGER_ERR_NOTFOUND) return err;
+    return LEDGER_OK;
+}
+
+/* Whether the body after the record at the current position matches the
+ * record's checksum; leaves the position unspecified. */
+static ledger_err_t body_intact(wal_t *w, uint32_t body_crc, size_t len, bool *ok) {
+    void *body = malloc(len);
+    if (!body) return LEDGER_ERR_NOMEM;
+    ledger_err_t err = fread(body, 1, len, w->fp) == len ? LEDGER_OK : LEDGER_ERR_IO;
+    *ok = err == LEDGER_OK && crc32(body, len) == body_crc;
+    free(body);
+    return err;
+}
+
+/* Finds the last checkpoint whose snapshot is whole by walking record
+ * headers and seeking over bodies, so recovery restores one snapshot and
+ * replays only what follows it. Only the chosen snapshot is checksummed; a
+ * damaged one sends the walk back to the checkpoint before it. For a sliced
+ * checkpoint that is its end frame; its parts are checked as they are
+ * restored. Leaves the file at that checkpoint, or where it started if there
+ * is none. Damage is left for replay to report. */
+static ledger_err_t seek_last_checkpoint(wal_t *w) {
+    uint8_t buf[WAL_RECORD_PAYLOAD_SIZE];
+    uint64_t end = file_size(w->path);
+    long first = ftell(w->fp);
+    if (first < 0) return LEDGER_ERR_IO;
+    for (;;) {
+        long from = first;
+        uint32_t from_crc = 0, from_kind = 0;
+        size_t from_len = 0;
+        if (fseek(w->fp, first, SEEK_SET) != 0) return LEDGER_ERR_IO;
+        for (;;) {
+            long start = ftell(w->fp);
+            if (start < 0) return LEDGER_ERR_IO;
+            if (read_record(w->fp, buf, NULL) != LEDGER_OK) break;
+            wal_record_t *r = (wal_record_t *)buf;
+            size_t len = body_len(r);
+            if ((uint64_t)start + WAL_RECORD_SIZE + len > end) break;
+            if (r->op == WAL_CHECKPOINT && len > 0 &&
+                (r->acct_type == CKPT_INLINE || r->acct_type == CKPT_END ||
+                 (r->acct_type == CKPT_EXTERNAL && w->external_checkpoints))) {
+                from = start;
+                from_crc = r->body_crc;
+                from_len = len;
+                from_kind = r->acct_type;
+            }
+            if (len > 0 && fseek(w->fp, (long)len, SEEK_CUR) != 0) return LEDGER_ERR_IO;
+        }
+        clearerr(w->fp);
+        if (from == first) break;
+        bool ok;
+        if (fseek(w->fp, from + WAL_RECORD_SIZE, SEEK_SET) != 0) return LEDGER_ERR_IO;
+        ledger_err_t err = body_intact(w, from_crc, from_len, &ok);
+        clearerr(w->fp);
+        if (err != LEDGER_OK) return err;
+        if (ok) {
+            w->sliced_end = from_kind == CKPT_END ? (uint64_t)from : 0;
+            return fseek(w->fp, from, SEEK_SET) == 0 ? LEDGER_OK : LEDGER_ERR_IO;
+        }
+        end = (uint64_t)from;
+    }
+    return fseek(w->fp, first, SEEK_SET) == 0 ? LEDGER_OK : LEDGER_ERR_IO;
+}
+
+/* Recovers from the last complete checkpoint, then truncates a torn tail so
+ * that new records follow the last whole one. */
+ledger_err_t wal_replay(wal_t *w, wal_replay_cb_t cb, wal_checkpoint_restore_cb_t checkpoint_cb, void *ctx) {
+    if (!w || !cb || w->read_only) return LEDGER_ERR_INVALID;
     if (fclose(w->fp) != 0) return LEDGER_ERR_IO;
+    w->fp = fopen(w->path, "rb");
+    if (!w->fp) return LEDGER_ERR_IO;
+    long valid_end = 0;
+    ledger_err_t err = check_header(w->fp);
+    if (err == LEDGER_OK) {
+        if (checkpoint_cb) err = seek_last_checkpoint(w);
+        if (err == LEDGER_OK) err = replay_records(w, cb, checkpoint_cb, ctx);
+        valid_end = ftell(w->fp);
+        if (valid_end < 0) return LEDGER_ERR_IO;
+    } else if (err == LEDGER_ERR_NOTFOUND) {
+        err = LEDGER_OK;
+    }
+    if (err != LEDGER_OK) return err;
+    if (fclose(w->fp) != 0) return LEDGER_ERR_IO;
+    w->fp = NULL;
+    if ((uint64_t)valid_end < file_size(w->path) && truncate(w->path, (off_t)valid_end) != 0) return LEDGER_ERR_IO;
     w->fp = fopen(w->path, "ab");
     if (!w->fp) return LEDGER_ERR_IO;
+    if (valid_end == 0) return write_header(w->fp);
+    return LEDGER_OK;
+}
+
+ledger_err_t wal_tail(wal_t *w, wal_replay_cb_t cb, wal_checkpoint_restore_cb_t checkpoint_cb, void *ctx) {
+    if (!w || !cb || !w->read_only) return LEDGER_ERR_INVALID;
+    if (w->read_lsn == 0) {
+        if (file_size(w->path) < WAL_HEADER_SIZE) return LEDGER_OK;
+        ledger_err_t err = check_header(w->fp);
+        if (err != LEDGER_OK) return err;
+        w->read_lsn = WAL_HEADER_SIZE;
+    }
+    ledger_err_t err = replay_records(w, cb, checkpoint_cb, ctx);
+    long pos = ftell(w->fp);
+    if (pos < 0) return LEDGER_ERR_IO;
+    w->read_lsn = (uint64_t)pos;
+    return err;
+}
+
+ledger_err_t wal_scan(wal_t *w, wal_replay_cb_t cb, void *ctx) {
+    if (!w || !w->fp || !cb) return LEDGER_ERR_INVALID;
+    if (!w->read_only && fflush(w->fp) != 0) return LEDGER_ERR_IO;
+    uint64_t end = w->read_only ? w->read_lsn : file_size(w->path);
+    if (end == 0) return LEDGER_OK;
+    int fd = open(w->path, O_RDONLY);
+    if (fd < 0) return LEDGER_ERR_IO;
+    void *image = mmap(NULL, (size_t)end, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) return LEDGER_ERR_IO;
+    wal_iter_t it;
+    wal_entry_t e;
+    ledger_err_t err = wal_iter_init(&it, image, (size_t)end);
+    while (err == LEDGER_OK && (err = wal_iter_next(&it, &e)) == LEDGER_OK) {
+        int rc = cb(&e, ctx);
+        if (rc != 0) err = (ledger_err_t)rc;
+    }
+    munmap(image, (size_t)end);
+    return err == LEDGER_ERR_NOTFOUND ? LEDGER_OK : err;
+}
+
+uint64_t wal_read_lsn(const wal_t *w) {
+    return w ? w->read_lsn : 0;
+}
+
+uint64_t wal_end_lsn(const wal_t *w) {
+    return w ? file_size(w->path) : 0;
+}
+
+ledger_err_t wal_promote(wal_t *w) {
+    if (!w || !w->read_only) return LEDGER_ERR_INVALID;
+    /* Drop any torn record past the follower's position before appending. */
+    if (truncate(w->path, (off_t)w->read_lsn) != 0) return LEDGER_ERR_IO;
+    if (fclose(w->fp) != 0) return LEDGER_ERR_IO;
+    w->fp = fopen(w->path, "ab");
+    if (!w->fp) return LEDGER_ERR_IO;
+    w->read_only = false;
+    if (w->read_lsn == 0) return write_header(w->fp);
+    return LEDGER_OK;
+}
+
+ledger_err_t wal_iter_init(wal_iter_t *it, const void *image, size_t len) {
+    if (!it || (len > 0 && !image)) return LEDGER_ERR_INVALID;
+    it->base = image;
+    it->len = len;
+    it->pos = 0;
+    if (len == 0) return LEDGER_OK;
+    uint32_t hdr[2];
+    if (len < WAL_HEADER_SIZE) return LEDGER_ERR_IO;
+    memcpy(hdr, image, WAL_HEADER_SIZE);
+    if (hdr[0] != WAL_MAGIC || hdr[1] != WAL_VERSION) return LEDGER_ERR_IO;
+    it->pos = WAL_HEADER_SIZE;
+    return LEDGER_OK;
+}
+
+/* bad_record() over the image: the same torn-tail rule as replay. */
+static ledger_err_t iter_bad_record(const wal_iter_t *it, size_t from) {
+    if (from >= it->len) return LEDGER_ERR_NOTFOUND;
+    size_t n = it->len - from > WAL_TORN_SCAN ? WAL_TORN_SCAN : it->len - from;
+    return record_in(it->base + from, n) ? LEDGER_ERR_IO : LEDGER_ERR_NOTFOUND;
+}
+
+ledger_err_t wal_iter_next(wal_iter_t *it, wal_entry_t *e) {
+    if (!it || !e) return LEDGER_ERR_INVALID;
+    if (it->len - it->pos < WAL_RECORD_SIZE) return LEDGER_ERR_NOTFOUND;
+    const uint8_t *p = it->base + it->pos;
+    uint32_t stored;
+    memcpy(&stored, p + WAL_RECORD_PAYLOAD_SIZE, 4);
+    if (stored != crc32(p, WAL_RECORD_PAYLOAD_SIZE)) return iter_bad_record(it, it->pos + 1);
+    const wal_record_t *r = (const wal_record_t *)p;
+    size_t len = body_len(r);
+    if (r->op == WAL_BULK_POSTING && len > WAL_MAX_FRAME_BODY) return iter_bad_record(it, it->pos + 1);
+    if (it->len - it->pos - WAL_RECORD_SIZE < len) return LEDGER_ERR_NOTFOUND;
+    decode_entry(r, it->pos, e);
+    if (len > 0) {
+        e->payload = p + WAL_RECORD_SIZE;
+        e->payload_len = len;
+        if (crc32(e->payload, len) != r->body_crc) return iter_bad_record(it, it->pos + WAL_RECORD_SIZE + len);
+    }
+    it->pos += WAL_RECORD_SIZE + len;
     return LEDGER_OK;
 }
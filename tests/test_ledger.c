@@ -1,16 +1,46 @@
+#define _POSIX_C_SOURCE 200809L
 #include "ledger.h"
+#include "scheduler.h"
+#include "transaction.h"
+#include "wal.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/resource.h>
 
 #define TMP_WAL "test_ledger.wal"
+#define TMP_PAGES "test_ledger.pages"
+/* Built alongside the tests by make test. */
+#define LEDGER_SCAN "./build/ledger-scan"
+
+/* Linked with --wrap so tests can count allocations made by the library. */
+static unsigned long alloc_count;
+void *__real_malloc(size_t n);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t n);
+int __real_posix_memalign(void **p, size_t align, size_t n);
+/* Set to make the next library malloc fail. */
+static bool fail_next_malloc;
+void *__wrap_malloc(size_t n) {
+    __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+    if (__atomic_exchange_n(&fail_next_malloc, false, __ATOMIC_RELAXED)) return NULL;
+    return __real_malloc(n);
+}
+void *__wrap_calloc(size_t n, size_t size) { __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED); return __real_calloc(n, size); }
+void *__wrap_realloc(void *p, size_t n) { __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED); return __real_realloc(p, n); }
+int __wrap_posix_memalign(void **p, size_t align, size_t n) {
+    __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+    return __real_posix_memalign(p, align, n);
+}
 
 static void test_create_and_balance(void) {
     remove(TMP_WAL);
     ledger_t *l = ledger_open(TMP_WAL);
     assert(l);
-    uint32_t id;
+    uint64_t id;
     assert(ledger_create_account(l, ACCT_CHECKING, "USD", &id) == LEDGER_OK);
     assert(id > 0);
     int64_t bal;
@@ -25,7 +55,7 @@ static void test_deposit_withdraw(void) {
     remove(TMP_WAL);
     ledger_t *l = ledger_open(TMP_WAL);
     assert(l);
-    uint32_t id;
+    uint64_t id;
     ledger_create_account(l, ACCT_CHECKING, "USD", &id);
     assert(ledger_deposit(l, id, 10000) == LEDGER_OK);
     int64_t bal;
@@ -44,7 +74,7 @@ static void test_transfer(void) {
     remove(TMP_WAL);
     ledger_t *l = ledger_open(TMP_WAL);
     assert(l);
-    uint32_t id1, id2;
+    uint64_t id1, id2;
     ledger_create_account(l, ACCT_CHECKING, "USD", &id1);
     ledger_create_account(l, ACCT_SAVINGS, "USD", &id2);
     ledger_deposit(l, id1, 50000);
@@ -62,7 +92,7 @@ static void test_wal_recovery(void) {
     remove(TMP_WAL);
     ledger_t *l = ledger_open(TMP_WAL);
     assert(l);
-    uint32_t id;
+    uint64_t id;
     ledger_create_account(l, ACCT_CHECKING, "USD", &id);
     ledger_deposit(l, id, 12345);
     int64_t bal;
@@ -79,11 +109,1335 @@ static void test_wal_recovery(void) {
     printf("test_wal_recovery: OK\n");
 }
 
+static void test_checkpoint_recovery(void) {
+    remove(TMP_WAL);
+    ledger_t *l = ledger_open(TMP_WAL);
+    assert(l);
+    uint64_t id;
+    ledger_create_account(l, ACCT_SAVINGS, "EUR", &id);
+    for (int i = 0; i < 250; i++) assert(ledger_deposit(l, id, 10) == LEDGER_OK);
+    uint64_t next_tx = ledger_next_tx_id(l);
+    ledger_close(l);
+
+    l = ledger_open(TMP_WAL);
+    assert(l);
+    int64_t bal;
+    assert(ledger_balance(l, id, &bal) == LEDGER_OK && bal == 2500);
+    assert(ledger_balance(l, 0, &bal) == LEDGER_OK && bal == -2500);
+    assert(ledger_next_tx_id(l) == next_tx);
+    assert(ledger_replayed_records(l) <= 4 * LEDGER_CHECKPOINT_INTERVAL);
+
+    /* Recovery time tracks the checkpoint interval, not the log: whatever
+     * the log has grown to, replay after the checkpoint stays bounded.
+     * Refused transfers write records too and must not escape the bound. */
+    uint64_t other;
+    assert(ledger_create_account(l, ACCT_CHECKING, "USD", &other) == LEDGER_OK);
+    uint64_t logged = 0;
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < 7 * LEDGER_CHECKPOINT_INTERVAL + 13; i++) {
+            ledger_err_t err = i % 3 == 2 ? ledger_transfer(l, other, id, 1000000) : ledger_transfer(l, id, other, 1);
+            assert(err == (i % 3 == 2 ? LEDGER_ERR_CONSTRAINT : LEDGER_OK));
+            logged += 4;
+        }
+        ledger_close(l);
+        l = ledger_open(TMP_WAL);
+        assert(l);
+        assert(ledger_replayed_records(l) > 0 && ledger_replayed_records(l) <= 4 * LEDGER_CHECKPOINT_INTERVAL);
+        assert(logged > 10 * ledger_replayed_records(l));
+    }
+    ledger_close(l);
+    remove(TMP_WAL);
+    printf("test_checkpoint_recovery: OK\n");
+}
+
+/* Sliced checkpoints and postings over two segments of ids, with writes
+ * landing between the steps. */
+static void test_sliced_checkpoint(void) {
+    remove(TMP_WAL);
+    ledger_t *l = ledger_open(TMP_WAL);
+    assert(l);
+    ledger_set_sliced_checkpoints(l, true);
+    const uint64_t n = ACCOUNT_POSTING_SLICE + 1000, hi = 1 + 4099 * 16;
+    uint64_t id;
+    for (uint64_t i = 1; i <= n; i++) assert(ledger_create_account(l, ACCT_SAVINGS, "EUR", &id) == LEDGER_OK && id == i);
+    for (uint64_t i = 1; i <= hi; i += 4099) assert(ledger_deposit(l, i, 100000) == LEDGER_OK);
+    assert(ledger_posting_slices(l) == 2);
+
+    /* The first step begins the checkpoint, the next logs the first segment. */
+    bool more;
+    assert(ledger_checkpoint_step(l, &more) == LEDGER_OK && more);
+    assert(ledger_checkpoint_step(l, &more) == LEDGER_OK && more);
+    /* Posted after it began, so replayed rather than restored: the second
+     * slice copies its segment into the snapshot before changing it. */
+    account_rate_t rate = { ACCT_SAVINGS, "EUR", 10000 };
+    int64_t total;
+    assert(ledger_post_periodic_slice(l, &rate, 1, 0, 0, &total) == LEDGER_OK && total == 16 * 1000);
+    assert(ledger_post_periodic_slice(l, &rate, 1, 0, 1, &total) == LEDGER_OK && total == 1000);
+    assert(ledger_post_periodic_slice(l, &rate, 1, 0, UINT64_MAX, &total) == LEDGER_ERR_INVALID);
+    assert(ledger_checkpoint_step(l, &more) == LEDGER_OK && !more);
+    assert(ledger_transfer(l, 1, 4100, 7) == LEDGER_OK);
+    uint64_t next_tx = ledger_next_tx_id(l);
+    ledger_close(l);
+
+    l = ledger_open(TMP_WAL);
+    assert(l);
+    assert(ledger_replayed_records(l) == 2 + 4 && ledger_skipped_postings(l) == 0);
+    assert(ledger_next_tx_id(l) == next_tx);
+    int64_t bal, net;
+    assert(ledger_balance(l, 1, &bal) == LEDGER_OK && bal == 101000 - 7);
+    assert(ledger_balance(l, 4100, &bal) == LEDGER_OK && bal == 101000 + 7);
+    assert(ledger_balance(l, hi, &bal) == LEDGER_OK && bal == 101000);
+    assert(ledger_balance(l, n, &bal) == LEDGER_OK && bal == 0);
+    assert(ledger_balance(l, 0, &bal) == LEDGER_OK && bal == -17 * 101000);
+    assert(ledger_trial_balance(l, true, &net) == LEDGER_OK);
+
+    /* A checkpoint cut off before its end frame is never restored. */
+    ledger_set_sliced_checkpoints(l, true);
+    for (int i = 0; i < LEDGER_CHECKPOINT_INTERVAL; i++) assert(ledger_transfer(l, 4100, 1, 1) == LEDGER_OK);
+    assert(ledger_checkpoint_step(l, &more) == LEDGER_OK && more);
+    assert(ledger_checkpoint_step(l, &more) == LEDGER_OK && more);
+    ledger_close(l);
+    l = ledger_open(TMP_WAL);
+    assert(l);
+    assert(ledger_replayed_records(l) > 4 * LEDGER_CHECKPOINT_INTERVAL);
+    assert(ledger_balance(l, 1, &bal) == LEDGER_OK && bal == 101000 - 7 + LEDGER_CHECKPOINT_INTERVAL);
+    assert(ledger_trial_balance(l, true, &net) == LEDGER_OK);
+    ledger_close(l);
+    remove(TMP_WAL);
+    printf("test_sliced_checkpoint: OK\n");
+}
+
+static void test_segmented_store(void) {
+    account_store_t *s = account_store_create();
+    assert(s);
+    const uint64_t n = 200000;
+    for (uint64_t i = 0; i < n; i++) {
+        uint64_t id;
+        assert(account_create(s, ACCT_CHECKING, "USD", &id) == LEDGER_OK);
+        assert(id == i);
+        assert(account_apply_delta(s, id, (int64_t)i, 1) == LEDGER_OK);
+    }
+    assert(account_create_with_id(s, (1ull << 36) + 7, ACCT_INVESTMENT, "JPY") == LEDGER_ERR_INVALID);
+    const uint64_t far_id = n + ACCOUNT_MAX_ID_GAP - 1;
+    assert(account_create_with_id(s, far_id, ACCT_INVESTMENT, "JPY") == LEDGER_OK);
+    assert(account_create_with_id(s, far_id, ACCT_INVESTMENT, "JPY") == LEDGER_ERR_INVALID);
+    assert(account_create_with_id(s, MAX_ACCOUNTS, ACCT_CHECKING, "USD") == LEDGER_ERR_INVALID);
+    assert(account_count(s) == n + 1);
+    account_t a;
+    for (uint64_t i = 0; i < n; i += 997) {
+        assert(account_get(s, i, &a) == LEDGER_OK);
+        assert(a.id == i && a.balance_cents == (int64_t)i);
+    }
+    assert(account_get(s, far_id, &a) == LEDGER_OK && a.type == ACCT_INVESTMENT);
+    assert(account_get(s, n, &a) == LEDGER_ERR_NOTFOUND);
+    uint64_t id;
+    assert(account_create(s, ACCT_CHECKING, "USD", &id) == LEDGER_OK && id == far_id + 1);
+    account_store_destroy(s);
+    printf("test_segmented_store: OK\n");
+}
+
+static void test_aggregates_and_trial_balance(void) {
+    remove(TMP_WAL);
+    ledger_t *l = ledger_open(TMP_WAL);
+    assert(l);
+    uint64_t chk, sav, eur;
+    ledger_create_account(l, ACCT_CHECKING, "USD", &chk);
+    ledger_create_account(l, ACCT_SAVINGS, "USD", &sav);
+    ledger_create_account(l, ACCT_SAVINGS, "EUR", &eur);
+    ledger_deposit(l, chk, 7000);
+    ledger_deposit(l, sav, 500);
+    ledger_deposit(l, eur, 40);
+    assert(ledger_transfer(l, chk, sav, 1000) == LEDGER_OK);
+    assert(ledger_withdraw(l, eur, 100) == LEDGER_ERR_CONSTRAINT);
+
+    int64_t sum;
+    assert(ledger_sum_by_type(l, ACCT_SAVINGS, &sum) == LEDGER_OK && sum == 1540);
+    assert(ledger_sum_by_type(l, ACCT_INVESTMENT, &sum) == LEDGER_OK && sum == 0);
+    assert(ledger_sum_by_currency(l, "EUR", &sum) == LEDGER_OK && sum == 40);
+    /* USD includes the cash account, so the currency nets to zero. */
+    assert(ledger_sum_by_currency(l, "USD", &sum) == LEDGER_OK && sum == -40);
+    assert(ledger_trial_balance(l, false, &sum) == LEDGER_OK && sum == 0);
+    assert(ledger_trial_balance(l, true, &sum) == LEDGER_OK && sum == 0);
+    ledger_close(l);
+
+    l = ledger_open(TMP_WAL);
+    assert(l);
+    assert(ledger_trial_balance(l, true, &sum) == LEDGER_OK && sum == 0);
+    ledger_close(l);
+    remove(TMP_WAL);
+    printf("test_aggregates_and_trial_balance: OK\n");
+}
+
+static void test_column_scans(void) {
+    account_store_t *s = account_store_create();
+    assert(s);
+    int64_t expect_inv = 0, expect_all = 0;
+    for (uint64_t i = 0; i < 70001; i++) {
+        uint64_t id;
+        account_type_t t = (account_type_t)(i % 3);
+        assert(account_create(s, t, (i & 1) ? "GBP" : "USD", &id) == LEDGER_OK);
+        int64_t amt = (int64_t)(i * 7 % 1000);
+        assert(account_apply_delta(s, id, amt, 1) == LEDGER_OK);
+        expect_all += amt;
+        if (t == ACCT_INVESTMENT) expect_inv += amt;
+    }
+    int64_t sum;
+    assert(account_sum_balances(s, &sum) == LEDGER_OK && sum == expect_all);
+    assert(account_total_balance(s) == expect_all);
+    assert(account_sum_by_type(s, ACCT_INVESTMENT, &sum) == LEDGER_OK && sum == expect_inv);
+    int64_t gbp, usd;
+    assert(account_sum_by_currency(s, "GBP", &gbp) == LEDGER_OK);
+    assert(account_sum_by_currency(s, "USD", &usd) == LEDGER_OK);
+    assert(gbp + usd == expect_all && gbp > 0 && usd > 0);
+    account_store_destroy(s);
+    printf("test_column_scans: OK\n");
+}
+
+static void test_follower_replica(void) {
+    remove(TMP_WAL);
+    ledger_t *p = ledger_open(TMP_WAL);
+    assert(p);
+    uint64_t a, b;
+    ledger_create_account(p, ACCT_CHECKING, "USD", &a);
+    ledger_create_account(p, ACCT_SAVINGS, "USD", &b);
+    ledger_deposit(p, a, 9000);
+
+    ledger_t *f = ledger_open_follower(TMP_WAL);
+    assert(f);
+    int64_t bal;
+    assert(ledger_balance(f, a, &bal) == LEDGER_OK && bal == 9000);
+    assert(ledger_deposit(f, a, 1) == LEDGER_ERR_INVALID);
+    uint64_t lag;
+    assert(ledger_replication_lag(f, &lag) == LEDGER_OK && lag == 0);
+
+    for (int i = 0; i < 150; i++) ledger_transfer(p, a, b, 10);
+    assert(ledger_transfer(p, b, a, 1000000) == LEDGER_ERR_CONSTRAINT);
+    assert(ledger_replication_lag(f, &lag) == LEDGER_OK && lag > 0);
+    /* History answers from what the follower has applied. */
+    int64_t credits, debits;
+    size_t legs;
+    assert(ledger_history(f, b, &credits, &debits, &legs) == LEDGER_OK && legs == 0);
+    uint64_t applied;
+    assert(ledger_follower_poll(f, &applied) == LEDGER_OK && applied > 0);
+    assert(ledger_replication_lag(f, &lag) == LEDGER_OK && lag == 0);
+    assert(ledger_balance(f, b, &bal) == LEDGER_OK && bal == 1500);
+    assert(ledger_history(f, a, &credits, &debits, &legs) == LEDGER_OK);
+    assert(credits == 9000 && debits == 1500 && legs == 151);
+    assert(ledger_history(f, b, &credits, &debits, &legs) == LEDGER_OK);
+    assert(credits == 1500 && debits == 0 && legs == 150);
+    assert(ledger_history(p, b, &credits, NULL, NULL) == LEDGER_OK && credits == 1500);
+    assert(ledger_history(f, 999, NULL, NULL, NULL) == LEDGER_ERR_NOTFOUND);
+    assert(ledger_trial_balance(f, true, NULL) == LEDGER_OK);
+    ledger_close(p);
+
+    /* A torn append is left for the next poll rather than misread. */
+    FILE *fp = fopen(TMP_WAL, "ab");
+    assert(fp);
+    fwrite("\x01\x00\x00", 1, 3, fp);
+    fclose(fp);
+    assert(ledger_follower_poll(f, NULL) == LEDGER_OK);
+    assert(ledger_replication_lag(f, &lag) == LEDGER_OK && lag == 3);
+
+    assert(ledger_promote(f) == LEDGER_OK);
+    assert(ledger_transfer(f, b, a, 500) == LEDGER_OK);
+    ledger_close(f);
+
+    p = ledger_open(TMP_WAL);
+    assert(p);
+    assert(ledger_balance(p, a, &bal) == LEDGER_OK && bal == 7500 + 500);
+    assert(ledger_trial_balance(p, true, NULL) == LEDGER_OK);
+    ledger_close(p);
+    remove(TMP_WAL);
+    printf("test_follower_replica: OK\n");
+}
+
+static void test_transfer_allocation_free(void) {
+    remove(TMP_WAL);
+    ledger_t *l = ledger_open(TMP_WAL);
+    assert(l);
+    uint64_t a, b;
+    ledger_create_account(l, ACCT_CHECKING, "USD", &a);
+    ledger_create_account(l, ACCT_SAVINGS, "USD", &b);
+    ledger_deposit(l, a, 1000000);
+    /* Warm-up: the first transfer creates the reusable transaction and the
+     * first checkpoint sizes the snapshot buffer. */
+    for (int i = 0; i < 200; i++) assert(ledger_transfer(l, a, b, 1) == LEDGER_OK);
+
+    alloc_count = 0;
+    for (int i = 0; i < 1000; i++) {
+        assert(ledger_transfer(l, a, b, 3) == LEDGER_OK);
+        assert(ledger_deposit(l, b, 2) == LEDGER_OK);
+        assert(ledger_withdraw(l, b, 1) == LEDGER_OK);
+    }
+    assert(ledger_withdraw(l, a, 100000000) == LEDGER_ERR_CONSTRAINT);
+    assert(alloc_count == 0);
+    assert(ledger_trial_balance(l, true, NULL) == LEDGER_OK);
+    ledger_close(l);
+    remove(TMP_WAL);
+    printf("test_transfer_allocation_free: OK\n");
+}
+
+static long file_size(const char *path) {
+    FILE *f = fopen(path, "rb");
+    assert(f);
+    fseek(f, 0, SEEK_END);
+    long n = ftell(f);
+    fclose(f);
+    return n;
+}
+
+static void append_tail(const uint8_t *tail, size_t len) {
+    FILE *fp = fopen(TMP_WAL, "ab");
+    assert(fp && fwrite(tail, 1, len, fp) == len);
+    fclose(fp);
+}
+
+/* Makes writes that grow the log past its size plus slack fail, as a full
+ * disk would. */
+static void limit_wal_growth(long slack, struct rlimit *saved) {
+    struct rlimit lim;
+    getrlimit(RLIMIT_FSIZE, saved);
+    lim = *saved;
+    lim.rlim_cur = (rlim_t)(file_size(TMP_WAL) + slack);
+    signal(SIGXFSZ, SIG_IGN);
+    setrlimit(RLIMIT_FSIZE, &lim);
+}
+
+static void unlimit_wal_growth(const struct rlimit *saved) {
+    setrlimit(RLIMIT_FSIZE, saved);
+    signal(SIGXFSZ, SIG_DFL);
+}
+
+/* An account whose creation could not be logged is not served. */
+static void test_create_log_failure(void) {
+    remove(TMP_WAL);
+    ledger_t *l = ledger_open(TMP_WAL);
+    assert(l);
+    uint64_t a, b;
+    assert(ledger_create_account(l, ACCT_CHECKING, "USD", &a) == LEDGER_OK);
+    struct rlimit saved;
+    limit_wal_growth(0, &saved);
+    ledger_err_t err = ledger_create_account(l, ACCT_CHECKING, "USD", &b);
+    unlimit_wal_growth(&saved);
+    assert(err == LEDGER_ERR_IO);
+    assert(ledger_create_account(l, ACCT_CHECKING, "USD", &b) == LEDGER_ERR_INVALID);
+    assert(ledger_deposit(l, a, 1) == LEDGER_ERR_INVALID);
+    ledger_close(l);
+    l = ledger_open(TMP_WAL);
+    assert(l);
+    int64_t bal;
+    assert(ledger_balance(l, a, &bal) == LEDGER_OK);
+    assert(ledger_balance(l, a + 1, &bal) == LEDGER_ERR_NOTFOUND);
+    ledger_close(l);
+    remove(TMP_WAL);
+    printf("test_create_log_failure: OK\n");
+}
+
+static void test_group_commit(void) {
+    remove(TMP_WAL);
+    ledger_t *l = ledger_open(TMP_WAL);
+    assert(l);
+    uint64_t a, b;
+    int64_t bal;
+    ledger_create_account(l, ACCT_CHECKING, "USD", &a);
+    ledger_create_account(l, ACCT_SAVINGS, "USD", &b);
+    ledger_deposit(l, a, 10000);
+    ledger_transfer_t xfers[8];
+    ledger_err_t results[8];
+    for (int i = 0; i < 8; i++) xfers[i] = (ledger_transfer_t){ a, b, 100 };
+    xfers[3].amount_cents = 1000000;
+    assert(ledger_transfer_batch(l, xfers, 8, results) == LEDGER_OK);
+    for (int i = 0; i < 8; i++) assert(results[i] == (i == 3 ? LEDGER_ERR_CONSTRAINT : LEDGER_OK));
+    assert(ledger_balance(l, a, &bal) == LEDGER_OK && bal == 9300);
+
+    /* Let the group's flush write only part of the batch. */
+    xfers[3].amount_cents = 100;
+    struct rlimit saved;
+    limit_wal_growth(100, &saved);
+    ledger_err_t err = ledger_transfer_batch(l, xfers, 8, results);
+    unlimit_wal_growth(&saved);
+    assert(err == LEDGER_ERR_IO);
+    for (int i = 0; i < 8; i++) assert(results[i] == LEDGER_ERR_IO);
+    /* Nothing from the failed batch is served, and writes are refused. */
+    assert(ledger_balance(l, a, &bal) == LEDGER_OK && bal == 9300);
+    assert(ledger_balance(l, b, &bal) == LEDGER_OK && bal == 700);
+    assert(ledger_transfer(l, a, b, 1) == LEDGER_ERR_INVALID);
+    assert(ledger_trial_balance(l, true, NULL) == LEDGER_OK);
+    ledger_close(l);
+
+    /* The partial group is an uncommitted tail. */
+    l = ledger_open(TMP_WAL);
+    assert(l);
+    assert(ledger_balance(l, a, &bal) == LEDGER_OK && bal == 9300);
+    assert(ledger_balance(l, b, &bal) == LEDGER_OK && bal == 700);
+    assert(ledger_transfer_batch(l, xfers, 8, results) == LEDGER_OK);
+    assert(ledger_balance(l, a, &bal) == LEDGER_OK && bal == 8500);
+
+    /* Batches spanning checkpoint intervals: each batch's transfers carry
+     * their own amount, and no checkpoint lands between two of them. */
+    ledger_transfer_t big[64];
+    ledger_err_t big_results[64];
+    for (int k = 1; k <= 5; k++) {
+        for (int i = 0; i < 64; i++) big[i] = (ledger_transfer_t){ a, b, k };
+        assert(ledger_transfer_batch(l, big, 64, big_results) == LEDGER_OK);
+    }
+    ledger_close(l);
+    FILE *fp = fopen(TMP_WAL, "rb");
+    assert(fp);
+    size_t len = (size_t)file_size(TMP_WAL);
+    uint8_t *image = malloc(len);
+    assert(image && fread(image, 1, len, fp) == len);
+    fclose(fp);
+    wal_iter_t it;
+    wal_entry_t e;
+    int64_t last_debit = 0;
+    int checkpoints = 0;
+    bool after_checkpoint = false;
+    assert(wal_iter_init(&it, image, len) == LEDGER_OK);
+    while (wal_iter_next(&it, &e) == LEDGER_OK) {
+        if (e.op == WAL_CHECKPOINT) {
+            checkpoints++;
+            after_checkpoint = true;
+        } else if (e.op == WAL_DEBIT) {
+            if (after_checkpoint && e.amount <= 5) assert(e.amount != last_debit);
+            last_debit = e.amount;
+            after_checkpoint = false;
+        }
+    }
+    assert(checkpoints >= 2);
+    free(image);
+    remove(TMP_WAL);
+    printf("test_group_commit: OK\n");
+}
+
+static void test_large_journal(void) {
+    account_store_t *s = account_store_create();
+    assert(s);
+    uint64_t ids[40];
+    for (int i = 0; i < 40; i++) assert(account_create_with_id(s, ids[i] = (uint64_t)i + 1, ACCT_CHECKING, "USD") == LEDGER_OK);
+    account_apply_delta(s, ids[0], 1000, 1);
+    transaction_t *tx = transaction_begin(s, 7);
+    assert(tx);
+    assert(transaction_credit(tx, ids[0], 39 * 10) == LEDGER_OK);
+    for (int i = 1; i < 40; i++) assert(transaction_debit(tx, ids[i], 10) == LEDGER_OK);
+    assert(transaction_commit(tx) == LEDGER_OK);
+    /* Reuse keeps the spilled entry array; an overdraft rolls back fully. */
+    assert(transaction_reset(tx, s, 8) == LEDGER_OK);
+    for (int i = 1; i < 40; i++) assert(transaction_debit(tx, ids[i], 100) == LEDGER_OK);
+    assert(transaction_credit(tx, ids[0], 39 * 100) == LEDGER_OK);
+    assert(transaction_commit(tx) == LEDGER_ERR_CONSTRAINT);
+    account_t acct;
+    assert(account_get(s, ids[0], &acct) == LEDGER_OK && acct.balance_cents == 610 && acct.version == 7);
+    assert(account_get(s, ids[1], &acct) == LEDGER_OK && acct.balance_cents == 10 && acct.version == 7);
+    assert(account_get(s, ids[39], &acct) == LEDGER_OK && acct.balance_cents == 10);
+    assert(account_total_balance(s) == 1000);
+    transaction_destroy(tx);
+    account_store_destroy(s);
+    printf("test_large_journal: OK\n");
+}
+
+static void test_balance_many(void) {
+    remove(TMP_WAL);
+    ledger_t *l = ledger_open(TMP_WAL);
+    assert(l);
+    uint64_t ids[50];
+    for (int i = 0; i < 48; i++) {
+        ledger_create_account(l, ACCT_CHECKING, "USD", &ids[i]);
+        ledger_deposit(l, ids[i], 100 + i);
+    }
+    ids[48] = 0;
+    ids[49] = 1ull << 35;
+    int64_t out[50];
+    ledger_err_t errs[50];
+    assert(ledger_balance_many(l, ids, 50, out, errs) == LEDGER_ERR_NOTFOUND);
+    int64_t deposited = 0;
+    for (int i = 0; i < 48; i++) {
+        assert(errs[i] == LEDGER_OK && out[i] == 100 + i);
+        deposited += out[i];
+    }
+    assert(errs[48] == LEDGER_OK && out[48] == -deposited);
+    assert(errs[49] == LEDGER_ERR_NOTFOUND && out[49] == 0);
+    assert(ledger_balance_many(l, ids, 49, out, NULL) == LEDGER_OK);
+    ledger_close(l);
+    remove(TMP_WAL);
+    printf("test_balance_many: OK\n");
+}
+
+#define STRIPE_THREADS 4
+#define STRIPE_OPS     200000
+
+struct stripe_worker {
+    account_store_t *store;
+    uint64_t savings_id;
+    long debited;
+};
+
+static void *stripe_worker_run(void *arg) {
+    struct stripe_worker *w = arg;
+    for (int i = 0; i < STRIPE_OPS; i++) {
+        assert(account_apply_delta(w->store, 0, 3, (uint64_t)i) == LEDGER_OK);
+        if (account_apply_delta(w->store, w->savings_id, -1, (uint64_t)i) == LEDGER_OK) w->debited++;
+    }
+    return NULL;
+}
+
+static void test_striped_hot_accounts(void) {
+    account_store_t *s = account_store_create();
+    assert(s);
+    uint64_t sav;
+    assert(account_create_with_id(s, 0, ACCT_CHECKING, "USD") == LEDGER_OK);
+    assert(account_create(s, ACCT_SAVINGS, "USD", &sav) == LEDGER_OK);
+    const int64_t seed = 500000;
+    assert(account_apply_delta(s, sav, seed, 1) == LEDGER_OK);
+    assert(account_apply_delta(s, 0, -seed, 1) == LEDGER_OK);
+    assert(account_set_striped(s, 0, true) == LEDGER_OK);
+    assert(account_set_striped(s, sav, true) == LEDGER_OK);
+    assert(account_total_balance(s) == 0);
+
+    pthread_t th[STRIPE_THREADS];
+    struct stripe_worker w[STRIPE_THREADS];
+    for (int t = 0; t < STRIPE_THREADS; t++) {
+        w[t] = (struct stripe_worker){ .store = s, .savings_id = sav, .debited = 0 };
+        assert(pthread_create(&th[t], NULL, stripe_worker_run, &w[t]) == 0);
+    }
+    long debited = 0;
+    for (int t = 0; t < STRIPE_THREADS; t++) {
+        pthread_join(th[t], NULL);
+        debited += w[t].debited;
+    }
+    /* Reservations let every cent be spent but never more. */
+    assert(debited == seed);
+    account_t a;
+    assert(account_get(s, sav, &a) == LEDGER_OK && a.balance_cents == 0);
+    assert(account_get(s, 0, &a) == LEDGER_OK);
+    assert(a.balance_cents == -seed + 3LL * STRIPE_THREADS * STRIPE_OPS);
+    int64_t sum;
+    assert(account_sum_balances(s, &sum) == LEDGER_OK && sum == account_total_balance(s));
+
+    assert(account_set_striped(s, 0, false) == LEDGER_OK);
+    assert(account_get(s, 0, &a) == LEDGER_OK && a.balance_cents == -seed + 3LL * STRIPE_THREADS * STRIPE_OPS);
+    assert(account_apply_delta(s, sav, -1, 9) == LEDGER_ERR_CONSTRAINT);
+    assert(account_apply_delta(s, sav, 10, 9) == LEDGER_OK);
+    assert(account_get(s, sav, &a) == LEDGER_OK && a.balance_cents == 10);
+    account_store_destroy(s);
+    printf("test_striped_hot_accounts: OK\n");
+}
+
+static void test_periodic_posting(void) {
+    remove(TMP_WAL);
+    ledger_t *l = ledger_open(TMP_WAL);
+    assert(l);
+    uint64_t eur[3], usd_sav, chk, expense;
+    const int64_t eur_bal[3] = { 100000, 250050, 99 };
+    for (int i = 0; i < 3; i++) {
+        assert(ledger_create_account(l, ACCT_SAVINGS, "EUR", &eur[i]) == LEDGER_OK);
+        assert(ledger_deposit(l, eur[i], eur_bal[i]) == LEDGER_OK);
+    }
+    assert(ledger_create_account(l, ACCT_SAVINGS, "USD", &usd_sav) == LEDGER_OK);
+    assert(ledger_deposit(l, usd_sav, 300000) == LEDGER_OK);
+    assert(ledger_create_account(l, ACCT_CHECKING, "USD", &chk) == LEDGER_OK);
+    assert(ledger_deposit(l, chk, 50000) == LEDGER_OK);
+    assert(ledger_create_account(l, ACCT_CHECKING, "USD", &expense) == LEDGER_OK);
+
+    account_rate_t rates[3] = {
+        { ACCT_SAVINGS, "EUR", 10000 },   /* 1% interest */
+        { ACCT_SAVINGS, "USD", 5000 },    /* 0.5% interest */
+        { ACCT_CHECKING, "USD", -2000 },  /* 0.2% fee */
+    };
+    /* An unfunded expense account cannot pay the interest. */
+    uint64_t next_tx = ledger_next_tx_id(l);
+    assert(ledger_post_periodic(l, rates, 3, expense, NULL) == LEDGER_ERR_CONSTRAINT);
+    assert(ledger_next_tx_id(l) == next_tx);
+    account_rate_t bad = { ACCT_SAVINGS, "EUR", 2000000 };
+    assert(ledger_post_periodic(l, &bad, 1, 0, NULL) == LEDGER_ERR_INVALID);
+
+    assert(ledger_deposit(l, expense, 1000000) == LEDGER_OK);
+    int64_t total;
+    assert(ledger_post_periodic(l, rates, 3, expense, &total) == LEDGER_OK);
+    /* The expense and cash accounts match the fee rate but are never posted. */
+    int64_t want = 1000 + 2500 + 0 + 1500 - 100;
+    assert(total == want);
+    int64_t bal;
+    assert(ledger_balance(l, eur[0], &bal) == LEDGER_OK && bal == 101000);
+    assert(ledger_balance(l, eur[1], &bal) == LEDGER_OK && bal == 252550);
+    assert(ledger_balance(l, eur[2], &bal) == LEDGER_OK && bal == 99);
+    assert(ledger_balance(l, usd_sav, &bal) == LEDGER_OK && bal == 301500);
+    assert(ledger_balance(l, chk, &bal) == LEDGER_OK && bal == 49900);
+    assert(ledger_balance(l, expense, &bal) == LEDGER_OK && bal == 1000000 - want);
+    int64_t net;
+    assert(ledger_trial_balance(l, true, &net) == LEDGER_OK && net == 0);
+    next_tx = ledger_next_tx_id(l);
+    ledger_close(l);
+
+    /* Replay re-derives the same postings from the single frame. */
+    l = ledger_open(TMP_WAL);
+    assert(l);
+    assert(ledger_next_tx_id(l) == next_tx);
+    assert(ledger_balance(l, eur[1], &bal) == LEDGER_OK && bal == 252550);
+    assert(ledger_balance(l, chk, &bal) == LEDGER_OK && bal == 49900);
+    assert(ledger_balance(l, expense, &bal) == LEDGER_OK && bal == 1000000 - want);
+    assert(ledger_trial_balance(l, true, &net) == LEDGER_OK);
+    assert(ledger_skipped_postings(l) == 0);
+    ledger_close(l);
+
+    /* A frame whose postings no longer reproduce its total is skipped on
+     * replay instead of refusing to open the ledger. */
+    wal_t *w = wal_open(TMP_WAL);
+    assert(w);
+    uint8_t body[12];
+    uint32_t type = ACCT_SAVINGS;
+    memcpy(body, &type, 4);
+    memcpy(body + 4, rates[0].currency, CURRENCY_LEN);
+    memcpy(body + 8, &rates[0].rate_ppm, 4);
+    assert(wal_bulk_posting(w, next_tx, expense, 1, body, sizeof(body)) == LEDGER_OK);
+    wal_close(w);
+    l = ledger_open(TMP_WAL);
+    assert(l);
+    assert(ledger_skipped_postings(l) == 1);
+    assert(ledger_next_tx_id(l) == next_tx + 1);
+    assert(ledger_balance(l, eur[1], &bal) == LEDGER_OK && bal == 252550);
+    assert(ledger_balance(l, expense, &bal) == LEDGER_OK && bal == 1000000 - want);
+    assert(ledger_deposit(l, eur[1], 1) == LEDGER_OK);
+    ledger_close(l);
+    remove(TMP_WAL);
+    printf("test_periodic_posting: OK\n");
+}
+
+static void test_wal_iterator(void) {
+    remove(TMP_WAL);
+    ledger_t *l = ledger_open(TMP_WAL);
+    assert(l);
+    uint64_t id;
+    assert(ledger_create_account(l, ACCT_SAVINGS, "EUR", &id) == LEDGER_OK);
+    for (int i = 0; i < 120; i++) assert(ledger_deposit(l, id, 100) == LEDGER_OK);
+    account_rate_t rate = { ACCT_SAVINGS, "EUR", 1000 };
+    assert(ledger_post_periodic(l, &rate, 1, 0, NULL) == LEDGER_OK);
+    ledger_close(l);
+
+    FILE *fp = fopen(TMP_WAL, "rb");
+    assert(fp);
+    fseek(fp, 0, SEEK_END);
+    size_t len = (size_t)ftell(fp);
+    rewind(fp);
+    uint8_t *image = malloc(len);
+    assert(image && fread(image, 1, len, fp) == len);
+    fclose(fp);
+
+    wal_iter_t it;
+    wal_entry_t e;
+    size_t counts[WAL_BULK_POSTING + 1] = {0};
+    size_t bulk_lsn = 0;
+    assert(wal_iter_init(&it, image, len) == LEDGER_OK);
+    ledger_err_t err;
+    while ((err = wal_iter_next(&it, &e)) == LEDGER_OK) {
+        counts[e.op]++;
+        if (e.op == WAL_CHECKPOINT) assert(e.payload_len > ACCOUNT_SNAPSHOT_HEADER_SIZE && e.payload);
+        if (e.op == WAL_BULK_POSTING) {
+            assert(e.account_id == 0 && e.amount == 12 && e.payload_len == 12);
+            bulk_lsn = e.lsn;
+        }
+    }
+    assert(err == LEDGER_ERR_NOTFOUND && it.pos == len);
+    assert(counts[WAL_CREATE_ACCOUNT] == 2 && counts[WAL_COMMIT] == 120 && counts[WAL_DEBIT] == 120);
+    assert(counts[WAL_CHECKPOINT] == 1 && counts[WAL_BULK_POSTING] == 1);
+
+    /* A torn final frame ends the log at the last whole record. */
+    assert(wal_iter_init(&it, image, len - 3) == LEDGER_OK);
+    while ((err = wal_iter_next(&it, &e)) == LEDGER_OK) {}
+    assert(err == LEDGER_ERR_NOTFOUND && it.pos == bulk_lsn);
+    /* So is a damaged final frame, as in replay, and a zero or garbage tail
+     * after the log; damage with whole records after it is corruption. */
+    image[bulk_lsn + 20] ^= 1;
+    assert(wal_iter_init(&it, image, len) == LEDGER_OK);
+    while ((err = wal_iter_next(&it, &e)) == LEDGER_OK) {}
+    assert(err == LEDGER_ERR_NOTFOUND && it.pos == bulk_lsn);
+    image[bulk_lsn + 20] ^= 1;
+    uint8_t *tailed = malloc(len + 4096);
+    assert(tailed);
+    memcpy(tailed, image, len);
+    for (int garbage = 0; garbage < 2; garbage++) {
+        for (size_t i = 0; i < 4096; i++) tailed[len + i] = garbage ? (uint8_t)(i * 131 + 7) : 0;
+        assert(wal_iter_init(&it, tailed, len + 4096) == LEDGER_OK);
+        while ((err = wal_iter_next(&it, &e)) == LEDGER_OK) {}
+        assert(err == LEDGER_ERR_NOTFOUND && it.pos == len);
+    }
+    free(tailed);
+    image[8 + 20] ^= 1;
+    assert(wal_iter_init(&it, image, len) == LEDGER_OK);
+    assert(wal_iter_next(&it, &e) == LEDGER_ERR_IO && it.pos == 8);
+    free(image);
+
+    /* ledger-scan reads what recovery reads: a crashed log with a zero or
+     * garbage tail scans cleanly, mid-log damage does not. */
+    l = ledger_open(TMP_WAL);
+    assert(l);
+    ledger_close(l);
+    uint8_t tail[4096];
+    memset(tail, 0, sizeof(tail));
+    append_tail(tail, sizeof(tail));
+    assert(system(LEDGER_SCAN " --turnover " TMP_WAL " >/dev/null 2>&1") == 0);
+    for (size_t i = 0; i < sizeof(tail); i++) tail[i] = (uint8_t)(i * 131 + 7);
+    append_tail(tail, sizeof(tail));
+    assert(system(LEDGER_SCAN " --op commit " TMP_WAL " >/dev/null 2>&1") == 0);
+    l = ledger_open(TMP_WAL);
+    assert(l);
+    ledger_close(l);
+    fp = fopen(TMP_WAL, "r+b");
+    assert(fp && fseek(fp, 8 + 20, SEEK_SET) == 0);
+    fputc(0xff, fp);
+    fclose(fp);
+    assert(system(LEDGER_SCAN " " TMP_WAL " >/dev/null 2>&1") != 0);
+    remove(TMP_WAL);
+    printf("test_wal_iterator: OK\n");
+}
+
+static void test_tiered_store(void) {
+    account_store_t *s = account_store_create();
+    assert(s);
+    assert(account_store_enable_tiering(s, TMP_PAGES, 2 * 4096) == LEDGER_OK);
+    const uint64_t n = 10 * 4096;
+    for (uint64_t i = 0; i < n; i++) {
+        uint64_t id;
+        assert(account_create(s, (account_type_t)(i % 3), i % 2 ? "EUR" : "USD", &id) == LEDGER_OK);
+    }
+    for (uint64_t i = 1; i < n; i += 7) assert(account_apply_delta(s, i, (int64_t)i, i) == LEDGER_OK);
+    account_tier_stats_t st;
+    account_tier_stats(s, &st);
+    assert(st.max_resident_pages == 2 && st.resident_pages == 2);
+    assert(st.evictions >= 8 && st.faults > st.evictions);
+
+    /* Evicted accounts fault back in with their data intact. */
+    account_t a;
+    assert(account_get(s, 8, &a) == LEDGER_OK && a.balance_cents == 8 && a.version == 8);
+    assert(a.type == ACCT_INVESTMENT && strcmp(a.currency, "USD") == 0);
+    int64_t expect = 0, sum;
+    for (uint64_t i = 1; i < n; i += 7) expect += (int64_t)i;
+    assert(account_sum_balances(s, &sum) == LEDGER_OK && sum == expect);
+    assert(account_total_balance(s) == expect);
+    int64_t by_type[3], total = 0;
+    for (int t = 0; t < 3; t++) {
+        assert(account_sum_by_type(s, (account_type_t)t, &by_type[t]) == LEDGER_OK);
+        total += by_type[t];
+    }
+    assert(total == expect);
+    account_tier_stats_t after;
+    account_tier_stats(s, &after);
+    assert(after.faults == st.faults + 1); /* scans read evicted pages without faulting */
+
+    /* Sync writes back only dirty resident pages. */
+    assert(account_store_sync(s) == LEDGER_OK);
+    account_tier_stats(s, &st);
+    assert(st.writebacks - after.writebacks <= 2);
+    assert(account_store_sync(s) == LEDGER_OK);
+    account_tier_stats(s, &after);
+    assert(after.writebacks == st.writebacks);
+    assert(account_apply_delta(s, 8, 1, 99) == LEDGER_OK);
+    assert(account_store_sync(s) == LEDGER_OK);
+    account_tier_stats(s, &st);
+    assert(st.writebacks == after.writebacks + 1);
+
+    uint64_t ids[3] = { 1, n / 2, n - 1 };
+    assert(account_prefetch(s, ids, 3) == LEDGER_OK);
+    int64_t out[3];
+    assert(account_balance_many(s, ids, 3, out, NULL) == LEDGER_OK);
+    assert(out[0] == 1 && out[2] == 0);
+    account_store_destroy(s);
+    remove(TMP_PAGES);
+    printf("test_tiered_store: OK\n");
+}
+
+/* Every 97th account gets a deposit and pays 1 to the account 4096 ids up. */
+static int64_t tiered_expected(uint64_t id, uint64_t n) {
+    int64_t bal = 0;
+    if (id % 97 == 1) bal += id + 4096 <= n ? 999 : 1000;
+    if (id > 4096 && (id - 4096) % 97 == 1) bal += 1;
+    return bal;
+}
+
+static void test_tiered_ledger(void) {
+    remove(TMP_WAL);
+    ledger_t *l = ledger_open_tiered(TMP_WAL, TMP_PAGES, 4096);
+    assert(l);
+    const int n = 5 * 4096;
+    for (int i = 0; i < n; i++) {
+        uint64_t id;
+        assert(ledger_create_account(l, ACCT_CHECKING, "USD", &id) == LEDGER_OK);
+    }
+    for (uint64_t i = 1; i <= (uint64_t)n; i += 97) assert(ledger_deposit(l, i, 1000) == LEDGER_OK);
+    for (uint64_t i = 1; i + 4096 <= (uint64_t)n; i += 97) assert(ledger_transfer(l, i, i + 4096, 1) == LEDGER_OK);
+    account_tier_stats_t st;
+    assert(ledger_tier_stats(l, &st) == LEDGER_OK);
+    assert(st.resident_pages <= st.max_resident_pages && st.evictions > 0);
+    int64_t net;
+    assert(ledger_trial_balance(l, true, &net) == LEDGER_OK && net == 0);
+    int64_t bal;
+    for (uint64_t i = 1; i <= (uint64_t)n; i += 13)
+        assert(ledger_balance(l, i, &bal) == LEDGER_OK && bal == tiered_expected(i, n));
+    ledger_close(l);
+
+    /* A plain reopen has no page file: it skips the page checkpoints and
+     * replays the whole log. */
+    l = ledger_open(TMP_WAL);
+    assert(l);
+    assert(ledger_replayed_records(l) > (uint64_t)n);
+    assert(ledger_balance(l, 1, &bal) == LEDGER_OK && bal == 999);
+    assert(ledger_trial_balance(l, true, &net) == LEDGER_OK);
+    ledger_close(l);
+    /* A tiered reopen restores the last page checkpoint and replays only
+     * what follows it. */
+    l = ledger_open_tiered(TMP_WAL, TMP_PAGES, 4096);
+    assert(l);
+    assert(ledger_replayed_records(l) <= 4 * LEDGER_CHECKPOINT_INTERVAL);
+    for (uint64_t i = (uint64_t)n; i > 11; i -= 11)
+        assert(ledger_balance(l, i, &bal) == LEDGER_OK && bal == tiered_expected(i, n));
+
+    /* Pages written back after a checkpoint go to their other slot, so
+     * closing before the next checkpoint (as a crash would) leaves the
+     * checkpointed pages intact for the next reopen. */
+    const uint64_t moved = LEDGER_CHECKPOINT_INTERVAL / 2;
+    for (uint64_t k = 0; k < moved; k++) assert(ledger_transfer(l, 1 + 97 * k, 1 + 97 * k + 4096, 1) == LEDGER_OK);
+    assert(ledger_tier_stats(l, &st) == LEDGER_OK && st.writebacks > 0);
+    ledger_close(l);
+    l = ledger_open_tiered(TMP_WAL, TMP_PAGES, 4096);
+    assert(l);
+    assert(ledger_replayed_records(l) <= 4 * LEDGER_CHECKPOINT_INTERVAL);
+    for (uint64_t i = 1; i <= (uint64_t)n; i++) {
+        int64_t want = tiered_expected(i, n);
+        if (i % 97 == 1 && i / 97 < moved) want--;
+        if (i > 4096 && (i - 4096) % 97 == 1 && (i - 4096) / 97 < moved) want++;
+        assert(ledger_balance(l, i, &bal) == LEDGER_OK && bal == want);
+    }
+    assert(ledger_trial_balance(l, true, &net) == LEDGER_OK && net == 0);
+    ledger_close(l);
+    remove(TMP_WAL);
+    remove(TMP_PAGES);
+    printf("test_tiered_ledger: OK\n");
+}
+
+static void test_secondary_indexes(void) {
+    remove(TMP_WAL);
+    ledger_t *l = ledger_open(TMP_WAL);
+    assert(l);
+    uint64_t id;
+    /* Accounts created both before and after the index exists. */
+    for (int i = 1; i <= 40; i++) {
+        if (i == 21) assert(ledger_enable_indexes(l, INDEX_ATTRS | INDEX_BALANCE) == LEDGER_OK);
+        assert(ledger_create_account(l, (account_type_t)(i % 3), i % 2 ? "EUR" : "USD", &id) == LEDGER_OK);
+        assert(ledger_deposit(l, id, (int64_t)id * 100) == LEDGER_OK);
+    }
+    account_iter_t it;
+    int64_t bal, prev;
+    uint64_t n = 0, last = 0;
+    assert(ledger_query_attrs(l, &it, ACCT_SAVINGS, "EUR") == LEDGER_OK);
+    while (account_iter_next(&it, &id, NULL)) {
+        assert(id % 3 == ACCT_SAVINGS && id % 2 == 1 && (n == 0 || id > last));
+        last = id;
+        n++;
+    }
+    assert(n == 7); /* 1, 7, 13, 19, 25, 31, 37 */
+    n = 0;
+    assert(ledger_query_attrs(l, &it, -1, "USD") == LEDGER_OK);
+    while (account_iter_next(&it, &id, NULL)) n++;
+    assert(n == 21); /* 20 plus the cash account */
+    assert(ledger_query_attrs(l, &it, -1, "JPY") == LEDGER_OK && !account_iter_next(&it, &id, NULL));
+
+    /* Top three by balance, then a range; the striped cash account is merged
+     * in at its folded balance. */
+    uint64_t top[3];
+    n = 0;
+    assert(ledger_query_balances(l, &it, INT64_MIN, INT64_MAX, true) == LEDGER_OK);
+    while (n < 3 && account_iter_next(&it, &top[n], &bal)) n++;
+    assert(n == 3 && top[0] == 40 && top[1] == 39 && top[2] == 38);
+    assert(ledger_transfer(l, 40, 2, 3000) == LEDGER_OK);
+    assert(ledger_query_balances(l, &it, 3000, 3500, false) == LEDGER_OK);
+    n = 0;
+    prev = INT64_MIN;
+    while (account_iter_next(&it, &id, &bal)) {
+        assert(bal >= 3000 && bal <= 3500 && bal >= prev);
+        assert(ledger_balance(l, id, &prev) == LEDGER_OK && prev == bal);
+        n++;
+    }
+    assert(n == 7); /* 30..35 and 2 */
+    assert(ledger_query_balances(l, &it, INT64_MIN, -1, false) == LEDGER_OK);
+    assert(account_iter_next(&it, &id, &bal) && id == 0 && bal == -82000);
+    assert(!account_iter_next(&it, &id, &bal));
+
+    /* Postings move every matching account. */
+    account_rate_t rate = { ACCT_SAVINGS, "EUR", 100000 };
+    assert(ledger_post_periodic(l, &rate, 1, 0, NULL) == LEDGER_OK);
+    assert(ledger_query_balances(l, &it, 4000, 4100, false) == LEDGER_OK);
+    assert(account_iter_next(&it, &id, &bal) && id == 37 && bal == 4070);
+    assert(!account_iter_next(&it, &id, &bal));
+    ledger_close(l);
+
+    /* Indexes live in memory only; enabling them after reopen rebuilds them. */
+    l = ledger_open(TMP_WAL);
+    assert(l);
+    assert(ledger_query_balances(l, &it, 0, 0, false) == LEDGER_ERR_INVALID);
+    assert(ledger_enable_indexes(l, INDEX_BALANCE) == LEDGER_OK);
+    assert(ledger_query_attrs(l, &it, ACCT_SAVINGS, NULL) == LEDGER_ERR_INVALID);
+    assert(ledger_query_balances(l, &it, INT64_MIN, INT64_MAX, true) == LEDGER_OK);
+    assert(account_iter_next(&it, &id, &bal) && id == 37 && bal == 4070);
+    n = 1;
+    prev = bal;
+    while (account_iter_next(&it, &id, &bal)) {
+        assert(bal <= prev);
+        prev = bal;
+        n++;
+    }
+    assert(n == 41 && id == 0);
+    int64_t net;
+    assert(ledger_trial_balance(l, true, &net) == LEDGER_OK && net == 0);
+    ledger_close(l);
+    remove(TMP_WAL);
+
+    /* A failed add leaves the account out of both indexes. */
+    account_store_t *s = account_store_create();
+    assert(s);
+    assert(account_store_enable_index(s, INDEX_ATTRS | INDEX_BALANCE) == LEDGER_OK);
+    assert(account_create(s, ACCT_SAVINGS, "EUR", &id) == LEDGER_OK && id == 0);
+    fail_next_malloc = true;
+    assert(account_create(s, ACCT_SAVINGS, "EUR", &id) == LEDGER_ERR_NOMEM);
+    assert(account_count(s) == 1);
+    assert(account_iter_attrs(s, &it, ACCT_SAVINGS, "EUR") == LEDGER_OK);
+    assert(account_iter_next(&it, &id, NULL) && id == 0 && !account_iter_next(&it, &id, NULL));
+    assert(account_create(s, ACCT_SAVINGS, "EUR", &id) == LEDGER_OK && id == 1);
+    assert(account_iter_balances(s, &it, INT64_MIN, INT64_MAX, false) == LEDGER_OK);
+    for (n = 0; account_iter_next(&it, &id, &bal); n++) {}
+    assert(n == 2);
+    account_store_destroy(s);
+
+    /* Postings over several segments, twice on the same worker pool, move
+     * each posted account in balance order; the contra account keeps its
+     * place at its own balance. */
+    s = account_store_create();
+    assert(s);
+    assert(account_store_enable_index(s, INDEX_BALANCE) == LEDGER_OK);
+    for (uint64_t i = 0; i < 3 * ACCOUNT_POSTING_SLICE; i++) assert(account_create(s, ACCT_SAVINGS, "EUR", &id) == LEDGER_OK);
+    for (uint64_t i = 1; i < 3 * ACCOUNT_POSTING_SLICE; i += 4099)
+        assert(account_set_balance(s, i, (int64_t)(i % 7) * 100000, 1) == LEDGER_OK);
+    rate.rate_ppm = 10000;
+    for (uint64_t v = 2; v <= 3; v++) {
+        int64_t total;
+        assert(account_sum_postings(s, &rate, 1, 0, &total) == LEDGER_OK && total > 0);
+        assert(account_apply_postings(s, &rate, 1, 0, v, total) == LEDGER_OK);
+    }
+    assert(account_iter_balances(s, &it, 1, INT64_MAX, true) == LEDGER_OK);
+    prev = INT64_MAX;
+    for (n = 0; account_iter_next(&it, &id, &bal); n++) {
+        account_t a;
+        assert(account_get(s, id, &a) == LEDGER_OK && a.balance_cents == bal && bal <= prev);
+        assert(bal == (int64_t)(id % 7) * 102010 && a.version == 3);
+        prev = bal;
+    }
+    assert(n == 41); /* 48 seeded, 7 of them at zero */
+    assert(account_iter_balances(s, &it, INT64_MIN, -1, false) == LEDGER_OK);
+    assert(account_iter_next(&it, &id, &bal) && id == 0 && !account_iter_next(&it, &id, &bal));
+    account_store_destroy(s);
+    printf("test_secondary_indexes: OK\n");
+}
+
+/* Committed state after each step of the crash workload. */
+#define CRASH_ACCOUNTS 7
+struct crash_state {
+    uint64_t accounts; /* including the cash account */
+    int64_t balances[CRASH_ACCOUNTS];
+};
+
+static void crash_snapshot(ledger_t *l, uint64_t accounts, struct crash_state *st) {
+    st->accounts = accounts;
+    for (uint64_t id = 0; id < CRASH_ACCOUNTS; id++) {
+        st->balances[id] = 0;
+        if (id < accounts) assert(ledger_balance(l, id, &st->balances[id]) == LEDGER_OK);
+    }
+}
+
+static void write_prefix(const uint8_t *image, size_t len) {
+    FILE *fp = fopen(TMP_WAL, "wb");
+    assert(fp);
+    assert(len == 0 || fwrite(image, 1, len, fp) == len);
+    fclose(fp);
+}
+
+static void check_crash_state(ledger_t *l, const struct crash_state *st) {
+    int64_t bal, net;
+    for (uint64_t id = 0; id < CRASH_ACCOUNTS; id++) {
+        if (id < st->accounts) assert(ledger_balance(l, id, &bal) == LEDGER_OK && bal == st->balances[id]);
+        else assert(ledger_balance(l, id, &bal) == LEDGER_ERR_NOTFOUND);
+    }
+    assert(ledger_trial_balance(l, true, &net) == LEDGER_OK && net == 0);
+}
+
+/* Crash torture: a scripted workload (creates, deposits, transfers, refused
+ * transfers, a bulk posting, checkpoints and, towards the end, sliced
+ * checkpoints stepped between transfers) is cut at every byte offset of
+ * its log, which is what a crash leaves behind since records are flushed in
+ * order. Each prefix must reopen to exactly the state after the last commit
+ * point it contains, and the repaired log must take new commits. */
+static void test_crash_recovery(void) {
+    remove(TMP_WAL);
+    ledger_t *l = ledger_open(TMP_WAL);
+    assert(l);
+    static struct crash_state states[512];
+    size_t n_states = 0;
+    uint64_t accounts = 1, id;
+    crash_snapshot(l, accounts, &states[n_states++]);
+    for (int i = 1; i < CRASH_ACCOUNTS; i++) {
+        assert(ledger_create_account(l, (account_type_t)(i % 3), i % 2 ? "EUR" : "USD", &id) == LEDGER_OK);
+        crash_snapshot(l, ++accounts, &states[n_states++]);
+        assert(ledger_deposit(l, id, 1000 * i) == LEDGER_OK);
+        crash_snapshot(l, accounts, &states[n_states++]);
+    }
+    uint64_t rng = 0x9E3779B97F4A7C15ull;
+    for (int i = 0; i < 400; i++) {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        uint64_t from = 1 + rng % (CRASH_ACCOUNTS - 1), to = 1 + (rng >> 8) % (CRASH_ACCOUNTS - 1);
+        int64_t amount = 1 + (int64_t)((rng >> 16) % 600);
+        ledger_err_t err = from == to ? ledger_withdraw(l, from, amount) : ledger_transfer(l, from, to, amount);
+        if (err == LEDGER_OK) crash_snapshot(l, accounts, &states[n_states++]);
+        if (i == 200) {
+            account_rate_t rate = { ACCT_SAVINGS, "EUR", 20000 };
+            assert(ledger_post_periodic(l, &rate, 1, 0, NULL) == LEDGER_OK);
+            crash_snapshot(l, accounts, &states[n_states++]);
+        }
+        if (i >= 250) {
+            bool more;
+            ledger_set_sliced_checkpoints(l, true);
+            assert(ledger_checkpoint_step(l, &more) == LEDGER_OK);
+        }
+    }
+    ledger_close(l);
+
+    FILE *fp = fopen(TMP_WAL, "rb");
+    assert(fp);
+    fseek(fp, 0, SEEK_END);
+    size_t len = (size_t)ftell(fp);
+    rewind(fp);
+    uint8_t *image = malloc(len);
+    assert(image && fread(image, 1, len, fp) == len);
+    fclose(fp);
+
+    /* Commit points: the end of every record that makes a change durable.
+     * The first is the cash account's creation, which reopening redoes. */
+    static size_t commit_end[512];
+    size_t n_commits = 0, n_checkpoints = 0, checkpoint_mid = 0;
+    wal_iter_t it;
+    wal_entry_t e;
+    assert(wal_iter_init(&it, image, len) == LEDGER_OK);
+    while (wal_iter_next(&it, &e) == LEDGER_OK) {
+        if (e.op == WAL_CREATE_ACCOUNT || e.op == WAL_COMMIT || e.op == WAL_BULK_POSTING) commit_end[n_commits++] = it.pos;
+        if (e.op == WAL_CHECKPOINT) {
+            n_checkpoints++;
+            checkpoint_mid = ((size_t)e.lsn + it.pos) / 2;
+        }
+    }
+    assert(n_commits == n_states && n_checkpoints >= 2 && n_states > 300);
+
+    /* Every byte with LEDGER_TEST_CRASH set (make test-crash); otherwise each
+     * commit point and its neighbours plus a stride coprime to the record
+     * size, so cuts still fall at every position within a record. */
+    bool every_byte = getenv("LEDGER_TEST_CRASH") != NULL;
+    size_t k = 0, n_cuts = 0;
+    for (size_t cut = 0; cut <= len; cut++) {
+        while (k < n_commits && commit_end[k] <= cut) k++;
+        bool near_commit = (k > 0 && cut - commit_end[k - 1] <= 1) || (k < n_commits && commit_end[k] - cut <= 1);
+        if (!every_byte && !near_commit && cut % 29 != 0 && cut != len) continue;
+        n_cuts++;
+        const struct crash_state *st = &states[k ? k - 1 : 0];
+        write_prefix(image, cut);
+        l = ledger_open(TMP_WAL);
+        assert(l);
+        check_crash_state(l, st);
+        if (cut % 61 == 0 || cut == len) {
+            /* New commits land after the last whole record, not the torn bytes. */
+            struct crash_state next = *st;
+            if (next.accounts > 1) {
+                assert(ledger_deposit(l, 1, 7) == LEDGER_OK);
+                next.balances[1] += 7;
+                next.balances[0] -= 7;
+            } else {
+                assert(ledger_create_account(l, ACCT_CHECKING, "USD", &id) == LEDGER_OK && id == 1);
+                next.accounts = 2;
+            }
+            ledger_close(l);
+            l = ledger_open(TMP_WAL);
+            assert(l);
+            check_crash_state(l, &next);
+        }
+        ledger_close(l);
+    }
+
+    /* On a preallocated file a crash leaves zeros or stale blocks past the
+     * last flush rather than a short file; both reopen like a clean cut. */
+    static uint8_t tails[2][4096];
+    for (size_t b = 0; b < sizeof(tails[1]); b++) {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        tails[1][b] = (uint8_t)rng;
+    }
+    const size_t tail_cuts[] = { commit_end[n_commits / 3], commit_end[n_commits / 2] + 17, checkpoint_mid, len - 5, len };
+    for (int t = 0; t < 2; t++) {
+        for (size_t c = 0; c < sizeof(tail_cuts) / sizeof(tail_cuts[0]); c++) {
+            size_t cut = tail_cuts[c];
+            for (k = 0; k < n_commits && commit_end[k] <= cut; k++) {}
+            struct crash_state next = states[k - 1];
+            write_prefix(image, cut);
+            append_tail(tails[t], sizeof(tails[t]));
+            l = ledger_open(TMP_WAL);
+            assert(l);
+            check_crash_state(l, &next);
+            assert(ledger_deposit(l, 1, 7) == LEDGER_OK);
+            next.balances[1] += 7;
+            next.balances[0] -= 7;
+            ledger_close(l);
+            l = ledger_open(TMP_WAL);
+            assert(l);
+            check_crash_state(l, &next);
+            ledger_close(l);
+        }
+    }
+    /* Damage with whole records after it is corruption, not a torn tail. */
+    write_prefix(image, len);
+    fp = fopen(TMP_WAL, "r+b");
+    assert(fp && fseek(fp, (long)commit_end[n_commits / 2] - 10, SEEK_SET) == 0);
+    fputc(image[commit_end[n_commits / 2] - 10] ^ 0x40, fp);
+    fclose(fp);
+    assert(ledger_open(TMP_WAL) == NULL);
+
+    free(image);
+    remove(TMP_WAL);
+    printf("test_crash_recovery (%zu of %zu cut points, %zu commits): OK\n", n_cuts, len + 1, n_commits);
+}
+
+struct sched_client {
+    scheduler_t *sched;
+    uint64_t from;
+    uint64_t to;
+    int busy;
+};
+
+static void *sched_client_run(void *arg) {
+    struct sched_client *c = (struct sched_client *)arg;
+    for (int i = 0; i < 200; i++) {
+        sched_request_t req = { .op = SCHED_TRANSFER, .from_id = c->from, .to_id = c->to, .amount_cents = 1 };
+        while (scheduler_submit(c->sched, SCHED_STANDARD, &req) == LEDGER_ERR_BUSY) c->busy++;
+        assert(scheduler_wait(c->sched, &req) == LEDGER_OK);
+    }
+    return NULL;
+}
+
+static void test_scheduler(void) {
+    remove(TMP_WAL);
+    ledger_t *l = ledger_open(TMP_WAL);
+    assert(l);
+    uint64_t id;
+    for (int i = 0; i < 4; i++) {
+        assert(ledger_create_account(l, ACCT_SAVINGS, "EUR", &id) == LEDGER_OK);
+        assert(ledger_deposit(l, id, 100000) == LEDGER_OK);
+    }
+    scheduler_config_t cfg;
+    scheduler_default_config(&cfg);
+    cfg.capacity[SCHED_INTERACTIVE] = 4;
+    cfg.budget_ns[SCHED_STANDARD] = 1000000000ull; /* keep the dispatch order below deterministic */
+    cfg.budget_ns[SCHED_BULK] = 10000000000ull;
+    scheduler_t *sched = scheduler_create(l, &cfg);
+    assert(sched);
+
+    /* While paused, work queues up to each lane's bound and is then turned
+     * away. */
+    scheduler_pause(sched);
+    sched_request_t bulk[8], inter[5], reads[3], late;
+    for (int i = 0; i < 8; i++) {
+        bulk[i] = (sched_request_t){ .op = SCHED_TRANSFER, .from_id = 1, .to_id = 2, .amount_cents = 10 };
+        assert(scheduler_submit(sched, SCHED_BULK, &bulk[i]) == LEDGER_OK);
+    }
+    account_rate_t rate = { ACCT_SAVINGS, "EUR", 1000 };
+    sched_request_t post = { .op = SCHED_POST_PERIODIC, .rates = &rate, .n_rates = 1, .contra_id = 0 };
+    assert(scheduler_submit(sched, SCHED_BULK, &post) == LEDGER_OK);
+    for (int i = 0; i < 3; i++) {
+        reads[i] = (sched_request_t){ .op = SCHED_BALANCE, .account_id = (uint64_t)i + 2 };
+        assert(scheduler_submit(sched, SCHED_STANDARD, &reads[i]) == LEDGER_OK);
+    }
+    late = (sched_request_t){ .op = SCHED_TRANSFER, .from_id = 4, .to_id = 1, .amount_cents = 5,
+                              .deadline_ns = scheduler_now_ns() };
+    assert(scheduler_submit(sched, SCHED_STANDARD, &late) == LEDGER_OK);
+    for (int i = 0; i < 5; i++) {
+        inter[i] = (sched_request_t){ .op = SCHED_TRANSFER, .from_id = 3, .to_id = 4, .amount_cents = 100 };
+        assert(scheduler_submit(sched, SCHED_INTERACTIVE, &inter[i]) == (i < 4 ? LEDGER_OK : LEDGER_ERR_BUSY));
+    }
+    assert(scheduler_wait(sched, &inter[4]) == LEDGER_ERR_BUSY);
+    sched_lane_stats_t st;
+    assert(scheduler_lane_stats(sched, SCHED_INTERACTIVE, &st) == LEDGER_OK);
+    assert(st.depth == 4 && st.max_depth == 4 && st.capacity == 4 && st.rejected == 1 && st.completed == 0);
+
+    /* Interactive first, as one group commit; then the standard lane, where
+     * the expired transfer is dropped; bulk last, transfers coalesced and
+     * the posting on its own. */
+    scheduler_resume(sched);
+    for (int i = 0; i < 8; i++) assert(scheduler_wait(sched, &bulk[i]) == LEDGER_OK);
+    assert(scheduler_wait(sched, &post) == LEDGER_OK && post.balance_cents > 0);
+    for (int i = 0; i < 4; i++) assert(scheduler_wait(sched, &inter[i]) == LEDGER_OK && inter[i].batch == 1);
+    for (int i = 0; i < 3; i++) {
+        assert(scheduler_wait(sched, &reads[i]) == LEDGER_OK && reads[i].batch == 2);
+        assert(reads[i].balance_cents == (i == 2 ? 100400 : i == 1 ? 99600 : 100000));
+    }
+    assert(scheduler_wait(sched, &late) == LEDGER_ERR_TIMEOUT && late.batch == 0);
+    for (int i = 0; i < 8; i++) assert(bulk[i].batch == 3);
+    assert(post.batch == 4);
+    assert(scheduler_lane_stats(sched, SCHED_STANDARD, &st) == LEDGER_OK);
+    assert(st.depth == 0 && st.submitted == 4 && st.expired == 1 && st.completed == 3 && st.batches == 1);
+    assert(scheduler_lane_stats(sched, SCHED_BULK, &st) == LEDGER_OK);
+    assert(st.completed == 9 && st.batches == 2 && st.wait_max_ns > 0);
+    assert(sched_wait_quantile_ns(&st, 0.99) >= st.wait_max_ns / 2);
+
+    /* Concurrent clients; their transfers are group committed. */
+    pthread_t th[4];
+    struct sched_client clients[4];
+    for (int i = 0; i < 4; i++) {
+        clients[i] = (struct sched_client){ sched, (uint64_t)i + 1, (uint64_t)(i + 1) % 4 + 1, 0 };
+        assert(pthread_create(&th[i], NULL, sched_client_run, &clients[i]) == 0);
+    }
+    for (int i = 0; i < 4; i++) pthread_join(th[i], NULL);
+    assert(scheduler_lane_stats(sched, SCHED_STANDARD, &st) == LEDGER_OK);
+    assert(st.completed == 3 + 800 && st.depth == 0);
+    scheduler_destroy(sched);
+
+    int64_t bal[5], net;
+    for (uint64_t i = 1; i <= 4; i++) assert(ledger_balance(l, i, &bal[i]) == LEDGER_OK);
+    assert(ledger_trial_balance(l, true, &net) == LEDGER_OK && net == 0);
+    ledger_close(l);
+    l = ledger_open(TMP_WAL);
+    assert(l);
+    for (uint64_t i = 1; i <= 4; i++) {
+        int64_t b;
+        assert(ledger_balance(l, i, &b) == LEDGER_OK && b == bal[i]);
+    }
+    assert(bal[2] == 100080 * 1001 / 1000 && bal[3] == 99600 * 1001 / 1000);
+    ledger_close(l);
+    remove(TMP_WAL);
+    printf("test_scheduler: OK\n");
+}
+
+struct interactive_client {
+    scheduler_t *sched;
+    int transfers;
+};
+
+static void *interactive_client_run(void *arg) {
+    struct interactive_client *c = (struct interactive_client *)arg;
+    for (int i = 0; i < c->transfers; i++) {
+        sched_request_t req = { .op = SCHED_TRANSFER, .from_id = 0, .to_id = 2, .amount_cents = 1 };
+        assert(scheduler_submit(c->sched, SCHED_INTERACTIVE, &req) == LEDGER_OK);
+        assert(scheduler_wait(c->sched, &req) == LEDGER_OK);
+    }
+    return NULL;
+}
+
+/* Under the scheduler, checkpoints and periodic postings run a slice at a
+ * time between dispatches, so interactive transfers arriving meanwhile wait
+ * for about one slice rather than the whole job. */
+static void test_scheduler_background(void) {
+    remove(TMP_WAL);
+    ledger_t *l = ledger_open(TMP_WAL);
+    assert(l);
+    ledger_set_sliced_checkpoints(l, true);
+    const uint64_t n = 16 * ACCOUNT_POSTING_SLICE;
+    uint64_t id;
+    for (uint64_t i = 0; i < n; i++) assert(ledger_create_account(l, ACCT_SAVINGS, "EUR", &id) == LEDGER_OK);
+    for (uint64_t i = 1; i < n; i += 1009) assert(ledger_deposit(l, i, 100000) == LEDGER_OK);
+    /* What the dispatcher would be held for by one checkpoint taken inline. */
+    bool more = true;
+    uint64_t t0 = scheduler_now_ns();
+    while (more) assert(ledger_checkpoint_step(l, &more) == LEDGER_OK);
+    uint64_t whole_ns = scheduler_now_ns() - t0;
+
+    scheduler_t *sched = scheduler_create(l, NULL);
+    assert(sched);
+    /* Enough transfers for several checkpoints to fall due, with a posting
+     * run submitted while they go on. */
+    struct interactive_client client = { sched, 4 * LEDGER_CHECKPOINT_INTERVAL };
+    pthread_t th;
+    assert(pthread_create(&th, NULL, interactive_client_run, &client) == 0);
+    account_rate_t rate = { ACCT_SAVINGS, "EUR", 1000 };
+    sched_request_t post = { .op = SCHED_POST_PERIODIC, .rates = &rate, .n_rates = 1, .contra_id = 0 };
+    assert(scheduler_submit(sched, SCHED_BULK, &post) == LEDGER_OK);
+    assert(scheduler_wait(sched, &post) == LEDGER_OK);
+    pthread_join(th, NULL);
+    sched_lane_stats_t st;
+    assert(scheduler_lane_stats(sched, SCHED_INTERACTIVE, &st) == LEDGER_OK);
+    assert(st.completed == (uint64_t)client.transfers);
+    assert(st.wait_max_ns < whole_ns / 2 && sched_wait_quantile_ns(&st, 0.99) <= whole_ns);
+    scheduler_destroy(sched);
+
+    int64_t bal, net;
+    assert(post.balance_cents == (int64_t)((n - 2) / 1009 + 1) * 100);
+    assert(ledger_trial_balance(l, true, &net) == LEDGER_OK);
+    uint64_t next_tx = ledger_next_tx_id(l);
+    ledger_close(l);
+    l = ledger_open(TMP_WAL);
+    assert(l);
+    assert(ledger_next_tx_id(l) == next_tx && ledger_skipped_postings(l) == 0);
+    assert(ledger_replayed_records(l) < 2 * (uint64_t)client.transfers);
+    assert(ledger_balance(l, 1010, &bal) == LEDGER_OK && bal == 100100);
+    assert(ledger_trial_balance(l, true, &net) == LEDGER_OK);
+    ledger_close(l);
+    remove(TMP_WAL);
+    printf("test_scheduler_background (checkpoint %.1f ms, interactive wait max %.2f ms): OK\n", whole_ns / 1e6,
+           st.wait_max_ns / 1e6);
+}
+
+/* Opt-in: LEDGER_TEST_SCALE=<accounts> (make test-scale runs 100M). */
+static void test_scale(void) {
+    const char *env = getenv("LEDGER_TEST_SCALE");
+    if (!env) return;
+    uint64_t n = strtoull(env, NULL, 10);
+    account_store_t *s = account_store_create();
+    assert(s);
+    for (uint64_t i = 0; i < n; i++) {
+        uint64_t id;
+        assert(account_create(s, ACCT_CHECKING, "USD", &id) == LEDGER_OK);
+    }
+    assert(account_count(s) == n);
+    for (uint64_t i = 1; i < n; i += 4099) {
+        assert(account_apply_delta(s, i, 100, 1) == LEDGER_OK);
+        assert(account_apply_delta(s, i, -40, 2) == LEDGER_OK);
+    }
+    account_t a;
+    assert(account_get(s, n - 1, &a) == LEDGER_OK && a.id == n - 1);
+    assert(account_get(s, 1, &a) == LEDGER_OK && a.balance_cents == 60 && a.version == 2);
+    account_store_destroy(s);
+    printf("test_scale (%llu accounts): OK\n", (unsigned long long)n);
+}
+
 int main(void) {
     test_create_and_balance();
     test_deposit_withdraw();
     test_transfer();
     test_wal_recovery();
+    test_checkpoint_recovery();
+    test_sliced_checkpoint();
+    test_segmented_store();
+    test_aggregates_and_trial_balance();
+    test_column_scans();
+    test_striped_hot_accounts();
+    test_follower_replica();
+    test_transfer_allocation_free();
+    test_group_commit();
+    test_create_log_failure();
+    test_large_journal();
+    test_balance_many();
+    test_tiered_store();
+    test_tiered_ledger();
+    test_periodic_posting();
+    test_wal_iterator();
+    test_secondary_indexes();
+    test_crash_recovery();
+    test_scheduler();
+    test_scheduler_background();
+    test_scale();
     printf("All tests passed.\n");
     return 0;
 }
@@ -0,0 +1,334 @@
+#define _POSIX_C_SOURCE 200809L
+#include "wal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Offline WAL scanner. Maps each log read-only and walks it with the WAL
+ * iterator, so it never builds an account store. Records that pass the
+ * filters are printed as CSV, written as raw column files, or folded into
+ * per-account turnover over committed transactions. */
+
+#define OP_COUNT (WAL_BULK_POSTING + 1)
+
+static const char *op_names[OP_COUNT] = {
+    "begin", "debit", "credit", "commit", "abort", "checkpoint", "create", "bulk",
+};
+
+struct filter {
+    uint64_t tx_min;
+    uint64_t tx_max;
+    bool has_account;
+    uint64_t account;
+    uint32_t ops; /* bit per wal_op_t; 0 keeps every op */
+};
+
+struct turnover {
+    uint64_t id;
+    int64_t out_cents; /* leaves the account: WAL_DEBIT legs, contra of interest */
+    int64_t in_cents;
+    uint64_t legs;
+};
+
+/* Open-addressing map from account id to turnover, doubled at half load. */
+struct turnover_map {
+    struct turnover *slots;
+    size_t cap;
+    size_t count;
+};
+
+struct leg {
+    uint64_t account_id;
+    int64_t amount;
+    bool out;
+};
+
+struct scan {
+    struct filter f;
+    enum { OUT_CSV, OUT_COLUMNS, OUT_TURNOVER } mode;
+    FILE *cols[5];
+    struct turnover_map map;
+    struct leg *legs; /* legs of the open transaction, kept until COMMIT */
+    size_t n_legs;
+    uint64_t leg_tx;
+    uint64_t records;
+    uint64_t matched;
+    uint64_t bulk_frames; /* turnover: frames whose per-account legs are not in the log */
+    uint64_t bytes;
+};
+
+#define EMPTY_ID UINT64_MAX
+
+static struct turnover *map_get(struct turnover_map *m, uint64_t id) {
+    if (2 * (m->count + 1) > m->cap) {
+        size_t cap = m->cap ? m->cap * 2 : 1024;
+        struct turnover *n = malloc(cap * sizeof(struct turnover));
+        if (!n) return NULL;
+        for (size_t i = 0; i < cap; i++) n[i].id = EMPTY_ID;
+        for (size_t i = 0; i < m->cap; i++) {
+            if (m->slots[i].id == EMPTY_ID) continue;
+            size_t j = (size_t)(m->slots[i].id * 0x9E3779B97F4A7C15ull) & (cap - 1);
+            while (n[j].id != EMPTY_ID) j = (j + 1) & (cap - 1);
+            n[j] = m->slots[i];
+        }
+        free(m->slots);
+        m->slots = n;
+        m->cap = cap;
+    }
+    size_t j = (size_t)(id * 0x9E3779B97F4A7C15ull) & (m->cap - 1);
+    while (m->slots[j].id != EMPTY_ID && m->slots[j].id != id) j = (j + 1) & (m->cap - 1);
+    if (m->slots[j].id == EMPTY_ID) {
+        m->slots[j] = (struct turnover){ .id = id };
+        m->count++;
+    }
+    return &m->slots[j];
+}
+
+static int by_id(const void *a, const void *b) {
+    uint64_t x = ((const struct turnover *)a)->id, y = ((const struct turnover *)b)->id;
+    return x < y ? -1 : x > y;
+}
+
+static bool keep(const struct filter *f, wal_op_t op, uint64_t tx_id, uint64_t account_id) {
+    if (f->ops && !(f->ops & (1u << op))) return false;
+    if (tx_id < f->tx_min || tx_id > f->tx_max) return false;
+    return !f->has_account || account_id == f->account;
+}
+
+static int add_leg(struct scan *sc, uint64_t account_id, int64_t amount, bool out) {
+    if (!keep(&sc->f, out ? WAL_DEBIT : WAL_CREDIT, sc->leg_tx, account_id)) return 0;
+    struct turnover *t = map_get(&sc->map, account_id);
+    if (!t) return -1;
+    if (out)
+        t->out_cents += amount;
+    else
+        t->in_cents += amount;
+    t->legs++;
+    return 0;
+}
+
+/* Legs count only once their transaction commits, as in replay. A bulk
+ * posting frame is self-committing; the log holds only its total, which is
+ * booked against the contra account. The per-account postings depend on
+ * replayed balances, which the scanner does not keep, so they are left out
+ * and the frames counted. */
+static int turnover_entry(struct scan *sc, const wal_entry_t *e) {
+    switch (e->op) {
+        case WAL_BEGIN_TX:
+            sc->n_legs = 0;
+            sc->leg_tx = e->tx_id;
+            break;
+        case WAL_DEBIT:
+        case WAL_CREDIT:
+            if (e->tx_id != sc->leg_tx || sc->n_legs >= MAX_TX_ENTRIES) break;
+            sc->legs[sc->n_legs++] = (struct leg){ e->account_id, e->amount, e->op == WAL_DEBIT };
+            break;
+        case WAL_COMMIT:
+            if (e->tx_id != sc->leg_tx) break;
+            for (size_t i = 0; i < sc->n_legs; i++)
+                if (add_leg(sc, sc->legs[i].account_id, sc->legs[i].amount, sc->legs[i].out) != 0) return -1;
+            /* fall through */
+        case WAL_ABORT:
+            sc->n_legs = 0;
+            break;
+        case WAL_BULK_POSTING:
+            sc->leg_tx = e->tx_id;
+            sc->bulk_frames++;
+            if (add_leg(sc, e->account_id, e->amount < 0 ? -e->amount : e->amount, e->amount > 0) != 0) return -1;
+            break;
+        default:
+            break;
+    }
+    return 0;
+}
+
+static void emit_csv(const wal_entry_t *e) {
+    char cur[CURRENCY_LEN + 1] = {0};
+    if (e->op == WAL_CREATE_ACCOUNT) memcpy(cur, e->currency, CURRENCY_LEN);
+    printf("%llu,%s,%llu,%llu,%lld,%d,%s,%zu\n", (unsigned long long)e->lsn, op_names[e->op],
+           (unsigned long long)e->tx_id, (unsigned long long)e->account_id, (long long)e->amount,
+           (int)e->acct_type, cur, e->payload_len);
+}
+
+static int emit_columns(struct scan *sc, const wal_entry_t *e) {
+    uint8_t op = (uint8_t)e->op;
+    if (fwrite(&e->lsn, 8, 1, sc->cols[0]) != 1 || fwrite(&op, 1, 1, sc->cols[1]) != 1 ||
+        fwrite(&e->tx_id, 8, 1, sc->cols[2]) != 1 || fwrite(&e->account_id, 8, 1, sc->cols[3]) != 1 ||
+        fwrite(&e->amount, 8, 1, sc->cols[4]) != 1)
+        return -1;
+    return 0;
+}
+
+static int scan_file(struct scan *sc, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "%s: cannot open\n", path);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    size_t len = (size_t)st.st_size;
+    void *image = NULL;
+    if (len > 0) {
+        image = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (image == MAP_FAILED) {
+            fprintf(stderr, "%s: mmap failed\n", path);
+            close(fd);
+            return -1;
+        }
+        posix_madvise(image, len, POSIX_MADV_SEQUENTIAL);
+    }
+    close(fd);
+    wal_iter_t it;
+    ledger_err_t err = wal_iter_init(&it, image, len);
+    wal_entry_t e;
+    while (err == LEDGER_OK && (err = wal_iter_next(&it, &e)) == LEDGER_OK) {
+        sc->records++;
+        if ((unsigned)e.op >= OP_COUNT) continue;
+        if (sc->mode == OUT_TURNOVER) {
+            if (turnover_entry(sc, &e) != 0) err = LEDGER_ERR_NOMEM;
+            continue;
+        }
+        if (!keep(&sc->f, e.op, e.tx_id, e.account_id)) continue;
+        sc->matched++;
+        if (sc->mode == OUT_CSV)
+            emit_csv(&e);
+        else if (emit_columns(sc, &e) != 0)
+            err = LEDGER_ERR_IO;
+    }
+    sc->bytes += it.pos;
+    if (image) munmap(image, len);
+    if (err == LEDGER_ERR_NOTFOUND) {
+        if (it.pos < len) fprintf(stderr, "%s: ignoring %zu torn bytes at lsn %zu\n", path, len - it.pos, it.pos);
+        return 0;
+    }
+    if (err == LEDGER_OK) return 0;
+    fprintf(stderr, "%s: %s at lsn %zu\n", path, err == LEDGER_ERR_IO ? "corrupt record" : "scan failed", it.pos);
+    return -1;
+}
+
+static int open_columns(struct scan *sc, const char *prefix) {
+    static const char *names[5] = { "lsn", "op", "tx_id", "account_id", "amount" };
+    char path[WAL_PATH_MAX + 16];
+    for (int i = 0; i < 5; i++) {
+        snprintf(path, sizeof(path), "%s.%s", prefix, names[i]);
+        sc->cols[i] = fopen(path, "wb");
+        if (!sc->cols[i]) {
+            fprintf(stderr, "%s: cannot create\n", path);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int parse_op(const char *name) {
+    for (int i = 0; i < OP_COUNT; i++)
+        if (strcmp(name, op_names[i]) == 0) return i;
+    return -1;
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "usage: ledger-scan [options] wal...\n"
+            "  --tx-from N, --tx-to N   keep records with tx ids in [N, M]\n"
+            "  --account ID             keep records whose account is ID\n"
+            "  --op NAME                keep only this op (repeatable):\n"
+            "                           begin debit credit commit abort checkpoint create bulk\n"
+            "  --turnover               per-account committed turnover as CSV; bulk posting\n"
+            "                           frames add only their total, against the contra account\n"
+            "  --columns PREFIX         write raw little-endian columns to PREFIX.{lsn,op,tx_id,account_id,amount}\n"
+            "Without --turnover or --columns, matching records are printed as CSV.\n");
+}
+
+int main(int argc, char **argv) {
+    struct scan sc = { .f = { .tx_min = 0, .tx_max = UINT64_MAX }, .mode = OUT_CSV };
+    const char *prefix = NULL;
+    int i = 1;
+    for (; i < argc && strncmp(argv[i], "--", 2) == 0; i++) {
+        const char *opt = argv[i];
+        const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(opt, "--turnover") == 0) {
+            sc.mode = OUT_TURNOVER;
+            continue;
+        }
+        if (!val) {
+            usage();
+            return 2;
+        }
+        i++;
+        if (strcmp(opt, "--tx-from") == 0) {
+            sc.f.tx_min = strtoull(val, NULL, 10);
+        } else if (strcmp(opt, "--tx-to") == 0) {
+            sc.f.tx_max = strtoull(val, NULL, 10);
+        } else if (strcmp(opt, "--account") == 0) {
+            sc.f.has_account = true;
+            sc.f.account = strtoull(val, NULL, 10);
+        } else if (strcmp(opt, "--op") == 0) {
+            int op = parse_op(val);
+            if (op < 0) {
+                usage();
+                return 2;
+            }
+            sc.f.ops |= 1u << op;
+        } else if (strcmp(opt, "--columns") == 0) {
+            sc.mode = OUT_COLUMNS;
+            prefix = val;
+        } else {
+            usage();
+            return 2;
+        }
+    }
+    if (i >= argc) {
+        usage();
+        return 2;
+    }
+    if (sc.mode == OUT_TURNOVER && (sc.f.ops & (1u << WAL_BULK_POSTING))) {
+        fprintf(stderr, "--turnover cannot select bulk postings: their per-account legs are not in the log\n");
+        return 2;
+    }
+    if (sc.mode == OUT_COLUMNS && open_columns(&sc, prefix) != 0) return 1;
+    if (sc.mode == OUT_TURNOVER) {
+        sc.legs = malloc(MAX_TX_ENTRIES * sizeof(struct leg));
+        if (!sc.legs) return 1;
+    }
+    if (sc.mode == OUT_CSV) printf("lsn,op,tx_id,account_id,amount,type,currency,payload_bytes\n");
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int rc = 0;
+    for (; i < argc && rc == 0; i++) rc = scan_file(&sc, argv[i]);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    if (rc == 0 && sc.mode == OUT_TURNOVER) {
+        size_t n = 0;
+        for (size_t k = 0; k < sc.map.cap; k++)
+            if (sc.map.slots[k].id != EMPTY_ID) sc.map.slots[n++] = sc.map.slots[k];
+        qsort(sc.map.slots, n, sizeof(struct turnover), by_id);
+        printf("account_id,out_cents,in_cents,net_cents,legs\n");
+        for (size_t k = 0; k < n; k++) {
+            const struct turnover *t = &sc.map.slots[k];
+            printf("%llu,%lld,%lld,%lld,%llu\n", (unsigned long long)t->id, (long long)t->out_cents,
+                   (long long)t->in_cents, (long long)(t->in_cents - t->out_cents), (unsigned long long)t->legs);
+        }
+        sc.matched = n;
+        if (sc.bulk_frames)
+            fprintf(stderr, "%llu bulk posting frames counted by total only\n", (unsigned long long)sc.bulk_frames);
+    }
+    for (int c = 0; c < 5; c++)
+        if (sc.cols[c] && fclose(sc.cols[c]) != 0) rc = -1;
+    double secs = (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) / 1e9;
+    fprintf(stderr, "%llu records, %llu %s, %.1f MB in %.3f s (%.0f MB/s)\n", (unsigned long long)sc.records,
+            (unsigned long long)sc.matched, sc.mode == OUT_TURNOVER ? "accounts" : "matched", (double)sc.bytes / 1e6,
+            secs, secs > 0 ? (double)sc.bytes / 1e6 / secs : 0.0);
+    free(sc.map.slots);
+    free(sc.legs);
+    return rc == 0 ? 0 : 1;
+}